@@ -0,0 +1,76 @@
+#include <lamtram/background-task.h>
+#include <lamtram/macros.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <exception>
+#include <iostream>
+
+using namespace std;
+using namespace lamtram;
+
+// Read exactly size bytes, failing if the other end was closed first
+inline bool ReadFully(int fd, char * data, size_t size) {
+  while(size > 0) {
+    ssize_t len = read(fd, data, size);
+    if(len <= 0) return false;
+    data += len;
+    size -= len;
+  }
+  return true;
+}
+
+BackgroundTask::~BackgroundTask() {
+  if(pid_ != -1) {
+    close(fd_);
+    waitpid(pid_, nullptr, 0);
+  }
+}
+
+void BackgroundTask::Start(const TaskFunc & func) {
+  if(pid_ != -1) THROW_ERROR("Can't start a background task before the last one is finished");
+  int fds[2];
+  if(pipe(fds) == -1) THROW_ERROR("Could not create a pipe for a background task");
+  cout.flush(); cerr.flush();
+  pid_t pid = fork();
+  if(pid == -1) THROW_ERROR("Could not fork a background task");
+  if(pid == 0) {
+    close(fds[0]);
+    int ret = 0;
+    try {
+      vector<double> vals = func();
+      size_t size = vals.size();
+      if(write(fds[1], &size, sizeof(size)) != sizeof(size) ||
+         write(fds[1], vals.data(), size * sizeof(double)) != (ssize_t)(size * sizeof(double)))
+        ret = 1;
+    } catch(std::exception & e) {
+      cerr << e.what() << endl;
+      ret = 1;
+    }
+    close(fds[1]);
+    cout.flush(); cerr.flush();
+    // Don't run the destructors of the parent's objects
+    _exit(ret);
+  }
+  close(fds[1]);
+  pid_ = pid;
+  fd_ = fds[0];
+}
+
+std::vector<double> BackgroundTask::Wait() {
+  if(pid_ == -1) THROW_ERROR("No background task is running");
+  size_t size = 0;
+  vector<double> vals;
+  bool ok = ReadFully(fd_, (char*)&size, sizeof(size));
+  if(ok) {
+    vals.resize(size);
+    ok = ReadFully(fd_, (char*)vals.data(), size * sizeof(double));
+  }
+  close(fd_);
+  int status = 0;
+  waitpid(pid_, &status, 0);
+  pid_ = -1;
+  fd_ = -1;
+  if(!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    THROW_ERROR("The background task failed");
+  return vals;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sys/types.h>
+#include <functional>
+#include <vector>
+
+namespace lamtram {
+
+// Runs a function in a forked child process while the current process goes
+// on with other work. The child sees a copy-on-write snapshot of the memory at
+// the time the task was started, so it can evaluate a model that the parent
+// keeps training. The function returns a few numbers, which are sent back
+// through a pipe and received by Wait().
+class BackgroundTask {
+
+public:
+    typedef std::function<std::vector<double>()> TaskFunc;
+
+    BackgroundTask() : pid_(-1), fd_(-1) { }
+    // Waits for a running task, throwing away its result
+    ~BackgroundTask();
+
+    // Fork a child that runs the function and exits
+    void Start(const TaskFunc & func);
+    // Wait for the child to finish and get the result of the function
+    std::vector<double> Wait();
+
+    bool IsRunning() const { return pid_ != -1; }
+
+protected:
+
+    pid_t pid_;
+    int fd_;
+
+};
+
+}
@@ -0,0 +1,134 @@
+#include <lamtram/binary-corpus.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/macros.h>
+#include <dynet/dict.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+static const char kCorpusMagic[8] = {'L','A','M','T','R','A','M','C'};
+static const uint32_t kCorpusVersion = 1;
+static const uint64_t kCorpusAlign = 64;
+static const uint32_t kCorpusHasWeights = 1;
+static const uint32_t kCorpusHasKickout = 2;
+
+// The fixed-size part at the start of the file, followed by the words
+struct CorpusPreamble {
+  char magic[8];
+  uint32_t version, flags;
+  uint64_t num_sents, num_words;
+  uint64_t words_offset, src_offsets_offset, trg_offsets_offset, weights_offset, kickout_offset;
+  uint64_t header_offset, header_size;
+};
+
+inline uint64_t AlignCorpusOffset(uint64_t offset) {
+  return (offset + kCorpusAlign - 1) / kCorpusAlign * kCorpusAlign;
+}
+
+BinaryCorpus::BinaryCorpus(const std::string & file) : file_(file), data_(nullptr), data_size_(0), num_sents_(0),
+                                                       weights_(nullptr), kickout_keep_(nullptr) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if(fd == -1) THROW_ERROR("Could not open corpus file " << file);
+  struct stat st;
+  if(fstat(fd, &st) == -1) { close(fd); THROW_ERROR("Could not get the size of corpus file " << file); }
+  data_size_ = st.st_size;
+  if(data_size_ < sizeof(CorpusPreamble)) { close(fd); THROW_ERROR("Not a binary corpus file: " << file); }
+  void * mapped = mmap(nullptr, data_size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) THROW_ERROR("Could not map corpus file " << file);
+  data_ = (char*)mapped;
+  // Find the sections
+  CorpusPreamble pre;
+  memcpy(&pre, data_, sizeof(pre));
+  if(memcmp(pre.magic, kCorpusMagic, sizeof(kCorpusMagic)) != 0)
+    THROW_ERROR("Not a binary corpus file: " << file);
+  if(pre.version != kCorpusVersion)
+    THROW_ERROR("Expecting binary corpus version " << kCorpusVersion << " but got " << pre.version << " in " << file);
+  num_sents_ = pre.num_sents;
+  if(pre.words_offset + pre.num_words * sizeof(WordId) > data_size_ ||
+     pre.src_offsets_offset + (num_sents_+1) * sizeof(uint64_t) > data_size_ ||
+     pre.trg_offsets_offset + num_sents_ * sizeof(uint64_t) > data_size_ ||
+     ((pre.flags & kCorpusHasWeights) && pre.weights_offset + num_sents_ * sizeof(float) > data_size_) ||
+     ((pre.flags & kCorpusHasKickout) && pre.kickout_offset + num_sents_ * sizeof(float) > data_size_) ||
+     pre.header_offset + pre.header_size > data_size_)
+    THROW_ERROR("Premature end of binary corpus file " << file);
+  words_ = (const WordId*)(data_ + pre.words_offset);
+  src_offsets_ = (const uint64_t*)(data_ + pre.src_offsets_offset);
+  trg_offsets_ = (const uint64_t*)(data_ + pre.trg_offsets_offset);
+  if(pre.flags & kCorpusHasWeights) weights_ = (const float*)(data_ + pre.weights_offset);
+  if(pre.flags & kCorpusHasKickout) kickout_keep_ = (const float*)(data_ + pre.kickout_offset);
+  header_ = string(data_ + pre.header_offset, pre.header_size);
+}
+
+BinaryCorpus::~BinaryCorpus() {
+  if(data_ != nullptr) munmap(data_, data_size_);
+}
+
+void BinaryCorpus::ReadVocab(DictPtr & vocab_src, DictPtr & vocab_trg) const {
+  istringstream in(header_);
+  vocab_src.reset(ReadDict(in));
+  vocab_trg.reset(ReadDict(in));
+}
+
+BinaryCorpusWriter::BinaryCorpusWriter(const std::string & file, bool has_weights, bool has_kickout_keep) :
+      file_(file), out_(file, ios::binary), has_weights_(has_weights), has_kickout_keep_(has_kickout_keep), num_words_(0) {
+  if(!out_) THROW_ERROR("Could not open output file: " << file);
+  // Leave space for the preamble, which is written once the sizes are known
+  string padding(AlignCorpusOffset(sizeof(CorpusPreamble)), '\0');
+  out_.write(padding.data(), padding.size());
+}
+
+void BinaryCorpusWriter::AddSentence(const Sentence & src, const Sentence & trg, float weight, float kickout_keep) {
+  src_offsets_.push_back(num_words_);
+  out_.write((const char*)src.data(), src.size() * sizeof(WordId));
+  num_words_ += src.size();
+  trg_offsets_.push_back(num_words_);
+  out_.write((const char*)trg.data(), trg.size() * sizeof(WordId));
+  num_words_ += trg.size();
+  if(has_weights_) weights_.push_back(weight);
+  if(has_kickout_keep_) kickout_keep_.push_back(kickout_keep);
+}
+
+void BinaryCorpusWriter::Finish(const Dict & vocab_src, const Dict & vocab_trg) {
+  CorpusPreamble pre;
+  memset(&pre, 0, sizeof(pre));
+  memcpy(pre.magic, kCorpusMagic, sizeof(kCorpusMagic));
+  pre.version = kCorpusVersion;
+  pre.flags = (has_weights_ ? kCorpusHasWeights : 0) | (has_kickout_keep_ ? kCorpusHasKickout : 0);
+  pre.num_sents = trg_offsets_.size();
+  pre.num_words = num_words_;
+  pre.words_offset = AlignCorpusOffset(sizeof(CorpusPreamble));
+  uint64_t pos = pre.words_offset + num_words_ * sizeof(WordId);
+  // Write each table aligned, with a final source offset marking the end of the last sentence
+  src_offsets_.push_back(num_words_);
+  auto write_table = [&](const char * data, size_t size) {
+    uint64_t offset = AlignCorpusOffset(pos);
+    string padding(offset - pos, '\0');
+    out_.write(padding.data(), padding.size());
+    out_.write(data, size);
+    pos = offset + size;
+    return offset;
+  };
+  pre.src_offsets_offset = write_table((const char*)src_offsets_.data(), src_offsets_.size() * sizeof(uint64_t));
+  pre.trg_offsets_offset = write_table((const char*)trg_offsets_.data(), trg_offsets_.size() * sizeof(uint64_t));
+  if(has_weights_)
+    pre.weights_offset = write_table((const char*)weights_.data(), weights_.size() * sizeof(float));
+  if(has_kickout_keep_)
+    pre.kickout_offset = write_table((const char*)kickout_keep_.data(), kickout_keep_.size() * sizeof(float));
+  ostringstream header;
+  WriteDict(vocab_src, header);
+  WriteDict(vocab_trg, header);
+  pre.header_size = header.str().size();
+  pre.header_offset = write_table(header.str().data(), pre.header_size);
+  out_.seekp(0);
+  out_.write((const char*)&pre, sizeof(pre));
+  out_.close();
+  if(!out_) THROW_ERROR("Failed writing binary corpus file: " << file_);
+}
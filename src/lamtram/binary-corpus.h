@@ -0,0 +1,91 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dynet {
+class Dict;
+}
+
+namespace lamtram {
+
+// A parallel training corpus stored as word ids in a single binary file that
+// is mapped into memory, created by lamtram-prep.
+//
+// The file starts with the magic string "LAMTRAMC", a version number, and the
+// locations of the other sections. The words of each sentence pair are stored as
+// 32-bit ids, followed by offset tables giving where each source and target
+// sentence starts, the optional instance weights and kickout keep rates, and
+// the source and target vocabularies in the same format as model files.
+//
+// Nothing is parsed when loading, and sentences are only copied out of the
+// mapping when they are needed to build a minibatch.
+class BinaryCorpus {
+
+public:
+    // Map a binary corpus into memory
+    BinaryCorpus(const std::string & file);
+    ~BinaryCorpus();
+
+    size_t GetNumSents() const { return num_sents_; }
+    // Each source sentence is directly followed by its target sentence
+    size_t GetSrcLength(size_t id) const { return trg_offsets_[id] - src_offsets_[id]; }
+    size_t GetTrgLength(size_t id) const { return src_offsets_[id+1] - trg_offsets_[id]; }
+    const WordId * GetSrcWords(size_t id) const { return words_ + src_offsets_[id]; }
+    const WordId * GetTrgWords(size_t id) const { return words_ + trg_offsets_[id]; }
+    void GetSrc(size_t id, Sentence & sent) const { sent.assign(GetSrcWords(id), GetSrcWords(id) + GetSrcLength(id)); }
+    void GetTrg(size_t id, Sentence & sent) const { sent.assign(GetTrgWords(id), GetTrgWords(id) + GetTrgLength(id)); }
+
+    bool HasWeights() const { return weights_ != nullptr; }
+    bool HasKickoutKeep() const { return kickout_keep_ != nullptr; }
+    float GetWeight(size_t id) const { return weights_[id]; }
+    float GetKickoutKeep(size_t id) const { return kickout_keep_[id]; }
+
+    // Read the vocabularies the corpus was encoded with, which are frozen
+    void ReadVocab(std::shared_ptr<dynet::Dict> & vocab_src, std::shared_ptr<dynet::Dict> & vocab_trg) const;
+
+protected:
+
+    std::string file_;
+    char * data_;
+    size_t data_size_;
+    uint64_t num_sents_;
+    const WordId * words_;
+    const uint64_t * src_offsets_;
+    const uint64_t * trg_offsets_;
+    const float * weights_;
+    const float * kickout_keep_;
+    std::string header_;
+
+};
+
+typedef std::shared_ptr<BinaryCorpus> BinaryCorpusPtr;
+
+// Writes a binary corpus one sentence at a time, so the sentences don't need
+// to be kept in memory
+class BinaryCorpusWriter {
+
+public:
+    BinaryCorpusWriter(const std::string & file, bool has_weights, bool has_kickout_keep);
+
+    void AddSentence(const Sentence & src, const Sentence & trg, float weight, float kickout_keep);
+
+    // Write the tables and vocabularies and close the file
+    void Finish(const dynet::Dict & vocab_src, const dynet::Dict & vocab_trg);
+
+protected:
+
+    std::string file_;
+    std::ofstream out_;
+    bool has_weights_, has_kickout_keep_;
+    uint64_t num_words_;
+    std::vector<uint64_t> src_offsets_, trg_offsets_;
+    std::vector<float> weights_, kickout_keep_;
+
+};
+
+}
@@ -0,0 +1,227 @@
+#include <lamtram/binary-model.h>
+#include <lamtram/macros.h>
+#include <lamtram/quantized-matrix.h>
+#include <dynet/tensor.h>
+#include <dynet/devices.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+static const char kBinaryMagic[8] = {'L','A','M','T','R','A','M','B'};
+// Version 1 files have no type for each parameter, as they only hold floats
+static const uint32_t kBinaryVersion = 2;
+static const uint64_t kBinaryAlign = 64;
+
+std::map<const Tensor*, QuantizedMatrixPtr> BinaryModelFile::quantized_;
+
+inline uint64_t AlignOffset(uint64_t offset) {
+  return (offset + kBinaryAlign - 1) / kBinaryAlign * kBinaryAlign;
+}
+
+template <class T>
+inline void WriteValue(string & out, T val) {
+  out.append((const char*)&val, sizeof(T));
+}
+
+template <class T>
+inline T ReadValue(const char * data, size_t data_size, size_t & pos) {
+  if(pos + sizeof(T) > data_size) THROW_ERROR("Premature end of binary model file");
+  T val;
+  memcpy(&val, data + pos, sizeof(T));
+  pos += sizeof(T);
+  return val;
+}
+
+// Get the values, dimensions, and names of all parameters in a collection
+inline void GetParamTensors(ParameterCollection & mod, vector<Tensor*> & tensors, vector<string> & names, vector<vector<unsigned> > & dims) {
+  for(auto & p : mod.parameters_list()) {
+    tensors.push_back(&p->values);
+    names.push_back(p->name);
+    dims.push_back(vector<unsigned>(p->dim.d, p->dim.d + p->dim.nd));
+  }
+  for(auto & p : mod.lookup_parameters_list()) {
+    tensors.push_back(&p->all_values);
+    names.push_back(p->name);
+    dims.push_back(vector<unsigned>(p->all_dim.d, p->all_dim.d + p->all_dim.nd));
+  }
+}
+
+bool BinaryModelFile::IsBinaryModel(const std::string & file) {
+  ifstream in(file, ios::binary);
+  char magic[sizeof(kBinaryMagic)];
+  return in.read(magic, sizeof(magic)) && memcmp(magic, kBinaryMagic, sizeof(magic)) == 0;
+}
+
+void BinaryModelFile::Write(const std::string & file, const std::string & header, ParameterCollection & mod,
+                            const std::string & quantize) {
+  vector<Tensor*> tensors;
+  vector<string> names;
+  vector<vector<unsigned> > dims;
+  GetParamTensors(mod, tensors, names, dims);
+  // Quantize the matrices, but keep vectors such as biases as floats
+  vector<QuantizedMatrixPtr> quants(tensors.size());
+  if(quantize.size()) {
+    QuantizedMatrix::Type type = QuantizedMatrix::ParseType(quantize);
+    for(size_t i = 0; i < tensors.size(); i++) {
+      if(dims[i].size() < 2) continue;
+      vector<float> vals = as_vector(*tensors[i]);
+      quants[i].reset(new QuantizedMatrix(type, dims[i][0], vals.size() / dims[i][0]));
+      quants[i]->SetColumnMajor(vals.data());
+    }
+  }
+  // The size of the table doesn't depend on the offsets, so find where the data starts first
+  uint64_t table_size = 0;
+  for(size_t i = 0; i < tensors.size(); i++)
+    table_size += sizeof(uint32_t) + names[i].size() + sizeof(uint32_t) * (2 + dims[i].size()) + 2 * sizeof(uint64_t);
+  uint64_t offset = AlignOffset(sizeof(kBinaryMagic) + 2 * sizeof(uint32_t) + sizeof(uint64_t) + header.size() + table_size);
+  // Write the magic string, header, and table
+  string out(kBinaryMagic, sizeof(kBinaryMagic));
+  WriteValue<uint32_t>(out, kBinaryVersion);
+  WriteValue<uint32_t>(out, tensors.size());
+  WriteValue<uint64_t>(out, header.size());
+  out += header;
+  vector<uint64_t> offsets;
+  for(size_t i = 0; i < tensors.size(); i++) {
+    WriteValue<uint32_t>(out, names[i].size());
+    out += names[i];
+    WriteValue<uint32_t>(out, dims[i].size());
+    for(unsigned d : dims[i]) WriteValue<uint32_t>(out, d);
+    WriteValue<uint32_t>(out, quants[i].get() != nullptr ? quants[i]->GetType() : 0);
+    uint64_t size = tensors[i]->d.size();
+    WriteValue<uint64_t>(out, offset);
+    WriteValue<uint64_t>(out, size);
+    offsets.push_back(offset);
+    offset = AlignOffset(offset + (quants[i].get() != nullptr ? quants[i]->GetByteSize() : size * sizeof(float)));
+  }
+  // Write the parameter values to a temporary file, so anything that has the
+  // old file mapped keeps it, and it isn't lost if writing fails
+  string tmp_file = file + ".tmp";
+  {
+    ofstream file_out(tmp_file, ios::binary);
+    if(!file_out) THROW_ERROR("Could not open output file: " << tmp_file);
+    file_out.write(out.data(), out.size());
+    uint64_t pos = out.size();
+    for(size_t i = 0; i < tensors.size(); i++) {
+      string padding(offsets[i] - pos, '\0');
+      file_out.write(padding.data(), padding.size());
+      if(quants[i].get() != nullptr) {
+        string vals;
+        quants[i]->Write(vals);
+        file_out.write(vals.data(), vals.size());
+        pos = offsets[i] + vals.size();
+      } else {
+        vector<float> vals = as_vector(*tensors[i]);
+        file_out.write((const char*)vals.data(), vals.size() * sizeof(float));
+        pos = offsets[i] + vals.size() * sizeof(float);
+      }
+    }
+    file_out.close();
+    if(!file_out) THROW_ERROR("Failed writing binary model file: " << tmp_file);
+  }
+  if(rename(tmp_file.c_str(), file.c_str()) != 0)
+    THROW_ERROR("Could not move " << tmp_file << " to " << file);
+}
+
+BinaryModelFile::BinaryModelFile(const std::string & file) : file_(file), data_(nullptr), data_size_(0) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if(fd == -1) THROW_ERROR("Could not open model file " << file);
+  struct stat st;
+  if(fstat(fd, &st) == -1) { close(fd); THROW_ERROR("Could not get the size of model file " << file); }
+  data_size_ = st.st_size;
+  void * mapped = mmap(nullptr, data_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) THROW_ERROR("Could not map model file " << file);
+  data_ = (char*)mapped;
+  // Read the magic string, header, and parameter table
+  if(data_size_ < sizeof(kBinaryMagic) || memcmp(data_, kBinaryMagic, sizeof(kBinaryMagic)) != 0)
+    THROW_ERROR("Not a binary model file: " << file);
+  size_t pos = sizeof(kBinaryMagic);
+  uint32_t version = ReadValue<uint32_t>(data_, data_size_, pos);
+  if(version < 1 || version > kBinaryVersion)
+    THROW_ERROR("Expecting binary model version " << kBinaryVersion << " but got " << version << " in " << file);
+  uint32_t num_params = ReadValue<uint32_t>(data_, data_size_, pos);
+  uint64_t header_size = ReadValue<uint64_t>(data_, data_size_, pos);
+  if(pos + header_size > data_size_) THROW_ERROR("Premature end of binary model file");
+  header_ = string(data_ + pos, header_size);
+  pos += header_size;
+  params_.resize(num_params);
+  for(auto & param : params_) {
+    uint32_t name_size = ReadValue<uint32_t>(data_, data_size_, pos);
+    if(pos + name_size > data_size_) THROW_ERROR("Premature end of binary model file");
+    param.name = string(data_ + pos, name_size);
+    pos += name_size;
+    param.dims.resize(ReadValue<uint32_t>(data_, data_size_, pos));
+    for(auto & d : param.dims) d = ReadValue<uint32_t>(data_, data_size_, pos);
+    param.type = (version >= 2 ? ReadValue<uint32_t>(data_, data_size_, pos) : 0);
+    param.offset = ReadValue<uint64_t>(data_, data_size_, pos);
+    param.size = ReadValue<uint64_t>(data_, data_size_, pos);
+    if(param.type != 0 && (param.type > QuantizedMatrix::kFloat16 || param.dims.size() < 2 ||
+                           param.dims[0] == 0 || param.size % param.dims[0] != 0))
+      THROW_ERROR("Bad quantization for parameter " << param.name << " in " << file);
+    if(param.offset % sizeof(float) != 0 || param.offset + GetByteSize(param) > data_size_)
+      THROW_ERROR("Bad location for parameter " << param.name << " in " << file);
+  }
+}
+
+QuantizedMatrixPtr BinaryModelFile::GetQuantized(const Tensor & values) {
+  auto it = quantized_.find(&values);
+  return (it != quantized_.end() ? it->second : QuantizedMatrixPtr());
+}
+
+uint64_t BinaryModelFile::GetByteSize(const ParamEntry & param) {
+  if(param.type == 0) return param.size * sizeof(float);
+  return QuantizedMatrix::GetByteSize((QuantizedMatrix::Type)param.type, param.dims[0], param.size / param.dims[0]);
+}
+
+BinaryModelFile::~BinaryModelFile() {
+  for(const Tensor * values : populated_)
+    quantized_.erase(values);
+  if(data_ != nullptr) munmap(data_, data_size_);
+}
+
+void BinaryModelFile::Populate(ParameterCollection & mod) {
+  vector<Tensor*> tensors;
+  vector<string> names;
+  vector<vector<unsigned> > dims;
+  GetParamTensors(mod, tensors, names, dims);
+  if(tensors.size() != params_.size())
+    THROW_ERROR("Expecting " << tensors.size() << " parameters but found " << params_.size() << " in " << file_);
+  for(size_t i = 0; i < tensors.size(); i++) {
+    if(names[i] != params_[i].name || dims[i] != params_[i].dims)
+      THROW_ERROR("Parameter " << names[i] << " does not match " << params_[i].name << " in " << file_);
+    if(params_[i].type != 0) {
+      // Quantized values are converted back to floats in the parameter's own
+      // memory, and also used in place by anything that can score with them
+      QuantizedMatrixPtr quant(new QuantizedMatrix((QuantizedMatrix::Type)params_[i].type, params_[i].dims[0], params_[i].size / params_[i].dims[0],
+                                                   data_ + params_[i].offset, GetByteSize(params_[i])));
+      vector<float> vals(params_[i].size);
+      quant->GetColumnMajor(vals.data());
+      TensorTools::set_elements(*tensors[i], vals);
+      if(tensors[i]->device->type == DeviceType::CPU) {
+        quantized_[tensors[i]] = quant;
+        populated_.push_back(tensors[i]);
+      }
+      continue;
+    }
+    float * vals = (float*)(data_ + params_[i].offset);
+    if(tensors[i]->device->type == DeviceType::CPU) {
+      tensors[i]->v = vals;
+    } else {
+      TensorTools::set_elements(*tensors[i], vector<float>(vals, vals + params_[i].size));
+    }
+  }
+  // Lookup parameters also keep a view of each of their rows
+  for(auto & p : mod.lookup_parameters_list()) {
+    if(p->all_values.device->type != DeviceType::CPU) continue;
+    for(size_t i = 0; i < p->values.size(); i++)
+      p->values[i].v = p->all_values.v + i * p->dim.size();
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <dynet/model.h>
+#include <lamtram/quantized-matrix.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// A model stored in a single binary file that can be mapped into memory.
+//
+// The file starts with the magic string "LAMTRAMB" and a version number,
+// then holds the text header (the vocabularies and model description that
+// are written to text model files), a table describing each parameter, and
+// finally the parameter values as raw floats aligned to 64 bytes.
+//
+// When loading, parameters on the CPU use the mapped values in place, so no
+// floats are parsed or copied, and processes that load the same file share
+// the pages through the page cache. The mapping is private, so a process
+// that updates the parameters only changes its own copy.
+//
+// Matrices can also be stored quantized to int8 or fp16 (see QuantizedMatrix)
+// to make the file smaller. These are converted back to floats when loading,
+// but the quantized values are also kept mapped so that the output layer can
+// score words with them directly (see GetQuantized).
+class BinaryModelFile {
+
+public:
+    // Map a binary model file into memory
+    BinaryModelFile(const std::string & file);
+    ~BinaryModelFile();
+
+    // Check if a file is in the binary model format
+    static bool IsBinaryModel(const std::string & file);
+
+    // Write the header and the parameters in mod to a binary model file,
+    // quantizing the matrices to "int8" or "fp16" if quantize is set
+    static void Write(const std::string & file, const std::string & header, dynet::ParameterCollection & mod,
+                      const std::string & quantize = "");
+
+    // Get the text header containing the vocabularies and model description
+    const std::string & GetHeader() const { return header_; }
+
+    // Set the values of the parameters in mod, which must have been created
+    // with the same header that the file was written with
+    void Populate(dynet::ParameterCollection & mod);
+
+    // Get the quantized values that the parameter with these values was
+    // loaded from, or null if there are none. They are valid while the file
+    // they are in is still mapped.
+    static QuantizedMatrixPtr GetQuantized(const dynet::Tensor & values);
+
+protected:
+
+    struct ParamEntry {
+        std::string name;
+        std::vector<unsigned> dims;
+        // 0 for floats, or a QuantizedMatrix::Type
+        uint32_t type;
+        uint64_t offset, size;
+    };
+
+    // The number of bytes that the values of a parameter take in the file
+    static uint64_t GetByteSize(const ParamEntry & param);
+
+    std::string file_;
+    char * data_;
+    size_t data_size_;
+    std::string header_;
+    std::vector<ParamEntry> params_;
+
+    // The quantized values of the parameters loaded from any file
+    static std::map<const dynet::Tensor*, QuantizedMatrixPtr> quantized_;
+    std::vector<const dynet::Tensor*> populated_;
+
+};
+
+typedef std::shared_ptr<BinaryModelFile> BinaryModelFilePtr;
+
+}
@@ -0,0 +1,193 @@
+#include <lamtram/checkpoint.h>
+#include <lamtram/macros.h>
+#include <dynet/model.h>
+#include <dynet/tensor.h>
+#include <dynet/globals.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+static const char kCheckpointMagic[8] = {'L','A','M','T','R','A','M','K'};
+static const uint32_t kCheckpointVersion = 1;
+
+inline void WriteTensor(ostream & out, const Tensor & tensor) {
+  vector<float> vals = as_vector(tensor);
+  uint64_t size = vals.size();
+  out.write((const char*)&size, sizeof(size));
+  out.write((const char*)vals.data(), size * sizeof(float));
+}
+
+inline void ReadTensor(istream & in, Tensor & tensor, const string & file) {
+  uint64_t size = 0;
+  if(!in.read((char*)&size, sizeof(size)))
+    THROW_ERROR("Premature end of checkpoint file " << file);
+  if(size != tensor.d.size())
+    THROW_ERROR("The checkpoint " << file << " doesn't match the model, was it written with different settings?");
+  vector<float> vals(size);
+  if(!in.read((char*)vals.data(), size * sizeof(float)))
+    THROW_ERROR("Premature end of checkpoint file " << file);
+  TensorTools::set_elements(tensor, vals);
+}
+
+template <class T>
+inline void ReadValue(istream & in, const string & name, T & val, const string & file) {
+  string read_name;
+  if(!(in >> read_name) || read_name != name || !(in >> val))
+    THROW_ERROR("Expected " << name << " in checkpoint file " << file);
+}
+
+// Floats may be infinite before the first evaluation, which >> can't read
+inline void ReadValue(istream & in, const string & name, float & val, const string & file) {
+  string read_name, str;
+  if(!(in >> read_name) || read_name != name || !(in >> str))
+    THROW_ERROR("Expected " << name << " in checkpoint file " << file);
+  val = strtof(str.c_str(), nullptr);
+}
+
+void Checkpoint::Write(const std::string & file, const TrainingState & state,
+                       ParameterCollection & mod, Trainer & trainer) {
+  TrainerState * trainer_state = dynamic_cast<TrainerState*>(&trainer);
+  if(trainer_state == nullptr) THROW_ERROR("This trainer can't be saved in checkpoints");
+  // The state of the training loop and trainer as text
+  ostringstream header;
+  header.precision(9);
+  header << "epoch " << state.epoch << endl
+         << "loc " << state.loc << endl
+         << "sent_loc " << state.sent_loc << endl
+         << "curr_sent_loc " << state.curr_sent_loc << endl
+         << "num_evals " << state.num_evals << endl
+         << "evals_since_improvement " << state.evals_since_improvement << endl
+         << "epoch_frac " << state.epoch_frac << endl
+         << "learning_rate " << state.learning_rate << endl
+         << "last_loss " << state.last_loss << endl
+         << "best_loss " << state.best_loss << endl
+         << "words " << state.words << endl
+         << "unk " << state.unk << endl
+         << "correct " << state.correct << endl
+         << "loss " << state.loss << endl
+         << "updates " << trainer.updates << endl
+         << "clips " << trainer.clips << endl
+         << "order " << state.order.size();
+  for(size_t id : state.order) header << ' ' << id;
+  header << endl << "rng " << *rndeng << endl;
+  string header_str = header.str();
+  // Write to a temporary file
+  string tmp_file = file + ".tmp";
+  {
+    ofstream out(tmp_file, ios::binary);
+    if(!out) THROW_ERROR("Could not open checkpoint file: " << tmp_file);
+    uint64_t header_size = header_str.size();
+    out.write(kCheckpointMagic, sizeof(kCheckpointMagic));
+    out.write((const char*)&kCheckpointVersion, sizeof(kCheckpointVersion));
+    out.write((const char*)&header_size, sizeof(header_size));
+    out.write(header_str.data(), header_size);
+    // The parameters, followed by what the trainer keeps for each of them
+    for(auto & p : mod.parameters_list())
+      WriteTensor(out, p->values);
+    for(auto & p : mod.lookup_parameters_list())
+      WriteTensor(out, p->all_values);
+    ShadowList shadows;
+    LookupShadowList lookup_shadows;
+    trainer_state->GetShadows(shadows, lookup_shadows);
+    for(auto * shadow : shadows) {
+      uint64_t size = shadow->size();
+      out.write((const char*)&size, sizeof(size));
+      for(auto & sp : *shadow) WriteTensor(out, sp.h);
+    }
+    for(auto * shadow : lookup_shadows) {
+      uint64_t size = shadow->size();
+      out.write((const char*)&size, sizeof(size));
+      for(auto & sp : *shadow) WriteTensor(out, sp.all_h);
+    }
+    out.close();
+    if(!out) THROW_ERROR("Failed writing checkpoint file: " << tmp_file);
+  }
+  if(rename(tmp_file.c_str(), file.c_str()) != 0)
+    THROW_ERROR("Could not move " << tmp_file << " to " << file);
+}
+
+void Checkpoint::Read(const std::string & file, TrainingState & state,
+                      ParameterCollection & mod, Trainer & trainer) {
+  TrainerState * trainer_state = dynamic_cast<TrainerState*>(&trainer);
+  if(trainer_state == nullptr) THROW_ERROR("This trainer can't be restored from checkpoints");
+  ifstream in(file, ios::binary);
+  if(!in) THROW_ERROR("Could not open checkpoint file: " << file);
+  char magic[sizeof(kCheckpointMagic)];
+  uint32_t version = 0;
+  uint64_t header_size = 0;
+  if(!in.read(magic, sizeof(magic)) || memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0)
+    THROW_ERROR("Not a checkpoint file: " << file);
+  if(!in.read((char*)&version, sizeof(version)) || version != kCheckpointVersion)
+    THROW_ERROR("Expecting checkpoint version " << kCheckpointVersion << " but got " << version << " in " << file);
+  if(!in.read((char*)&header_size, sizeof(header_size)))
+    THROW_ERROR("Premature end of checkpoint file " << file);
+  string header_str(header_size, '\0');
+  if(!in.read(&header_str[0], header_size))
+    THROW_ERROR("Premature end of checkpoint file " << file);
+  istringstream header(header_str);
+  real updates = 0, clips = 0;
+  size_t order_size = 0;
+  ReadValue(header, "epoch", state.epoch, file);
+  ReadValue(header, "loc", state.loc, file);
+  ReadValue(header, "sent_loc", state.sent_loc, file);
+  ReadValue(header, "curr_sent_loc", state.curr_sent_loc, file);
+  ReadValue(header, "num_evals", state.num_evals, file);
+  ReadValue(header, "evals_since_improvement", state.evals_since_improvement, file);
+  ReadValue(header, "epoch_frac", state.epoch_frac, file);
+  ReadValue(header, "learning_rate", state.learning_rate, file);
+  ReadValue(header, "last_loss", state.last_loss, file);
+  ReadValue(header, "best_loss", state.best_loss, file);
+  ReadValue(header, "words", state.words, file);
+  ReadValue(header, "unk", state.unk, file);
+  ReadValue(header, "correct", state.correct, file);
+  ReadValue(header, "loss", state.loss, file);
+  ReadValue(header, "updates", updates, file);
+  ReadValue(header, "clips", clips, file);
+  ReadValue(header, "order", order_size, file);
+  state.order.resize(order_size);
+  for(size_t & id : state.order)
+    if(!(header >> id)) THROW_ERROR("Expected order in checkpoint file " << file);
+  ReadValue(header, "rng", *rndeng, file);
+  // The trainer only allocates its values at the first update, which changes
+  // nothing while the gradients are zero
+  ShadowList shadows;
+  LookupShadowList lookup_shadows;
+  trainer_state->GetShadows(shadows, lookup_shadows);
+  if((shadows.size() && !shadows[0]->size()) || (lookup_shadows.size() && !lookup_shadows[0]->size())) {
+    mod.reset_gradient();
+    trainer.update();
+  }
+  // The parameters and trainer values
+  for(auto & p : mod.parameters_list())
+    ReadTensor(in, p->values, file);
+  for(auto & p : mod.lookup_parameters_list())
+    ReadTensor(in, p->all_values, file);
+  for(auto * shadow : shadows) {
+    // Nothing is saved if the trainer hadn't made an update yet
+    uint64_t size = 0;
+    if(!in.read((char*)&size, sizeof(size)) || (size != 0 && size != shadow->size()))
+      THROW_ERROR("The checkpoint " << file << " doesn't match the trainer, was it written with different settings?");
+    if(size != 0)
+      for(auto & sp : *shadow) ReadTensor(in, sp.h, file);
+  }
+  for(auto * shadow : lookup_shadows) {
+    // Nothing is saved if the trainer hadn't made an update yet
+    uint64_t size = 0;
+    if(!in.read((char*)&size, sizeof(size)) || (size != 0 && size != shadow->size()))
+      THROW_ERROR("The checkpoint " << file << " doesn't match the trainer, was it written with different settings?");
+    if(size != 0)
+      for(auto & sp : *shadow) ReadTensor(in, sp.all_h, file);
+  }
+  trainer.updates = updates;
+  trainer.clips = clips;
+  // Bring the trainer's learning rate schedule to the same point
+  for(int i = 0; i < state.num_evals; i++)
+    trainer.update_epoch();
+}
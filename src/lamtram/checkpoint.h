@@ -0,0 +1,88 @@
+#pragma once
+
+#include <dynet/training.h>
+#include <dynet/shadow-params.h>
+#include <string>
+#include <vector>
+
+namespace dynet {
+class ParameterCollection;
+}
+
+namespace lamtram {
+
+// The position of a training loop, and everything else needed to continue it
+// exactly where it was
+struct TrainingState {
+    TrainingState() : epoch(0), loc(0), sent_loc(0), curr_sent_loc(0), num_evals(0), evals_since_improvement(0),
+                      epoch_frac(0.f), learning_rate(0.f), last_loss(1e99), best_loss(1e99),
+                      words(0), unk(0), correct(0), loss(0.f) { }
+    int epoch, loc, sent_loc, curr_sent_loc;
+    // Each evaluation called update_epoch() on the trainer once
+    int num_evals, evals_since_improvement;
+    float epoch_frac, learning_rate, last_loss, best_loss;
+    // Training statistics since the last evaluation
+    int words, unk, correct;
+    dynet::real loss;
+    // The shuffled order of the minibatches
+    std::vector<size_t> order;
+};
+
+typedef std::vector<std::vector<dynet::ShadowParameters>*> ShadowList;
+typedef std::vector<std::vector<dynet::ShadowLookupParameters>*> LookupShadowList;
+
+// A trainer that gives access to the values it keeps for each parameter, such
+// as the moments of Adam, so they can be saved in checkpoints
+class TrainerState {
+public:
+    virtual ~TrainerState() { }
+    virtual void GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) = 0;
+};
+
+template <class TrainerType>
+class CheckpointTrainer : public TrainerType, public TrainerState {
+public:
+    CheckpointTrainer(dynet::ParameterCollection & model, dynet::real learning_rate) : TrainerType(model, learning_rate) { }
+    virtual void GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) override;
+};
+
+template <>
+inline void CheckpointTrainer<dynet::SimpleSGDTrainer>::GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) {
+  shadows.clear(); lookup_shadows.clear();
+}
+template <>
+inline void CheckpointTrainer<dynet::MomentumSGDTrainer>::GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) {
+  shadows = {&this->vp}; lookup_shadows = {&this->vlp};
+}
+template <>
+inline void CheckpointTrainer<dynet::AdagradTrainer>::GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) {
+  shadows = {&this->vp}; lookup_shadows = {&this->vlp};
+}
+template <>
+inline void CheckpointTrainer<dynet::AdadeltaTrainer>::GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) {
+  shadows = {&this->hg, &this->hd}; lookup_shadows = {&this->hlg, &this->hld};
+}
+template <>
+inline void CheckpointTrainer<dynet::AdamTrainer>::GetShadows(ShadowList & shadows, LookupShadowList & lookup_shadows) {
+  shadows = {&this->m, &this->v}; lookup_shadows = {&this->lm, &this->lv};
+}
+
+// Checkpoints hold the parameters, the state of the trainer, the random number
+// generator, and the training loop in a single file. They are only valid for
+// the same training data and settings, so resuming builds the model and
+// minibatches as usual and then overwrites their state from the checkpoint.
+class Checkpoint {
+public:
+
+    // Write a checkpoint to a temporary file and then rename it, so an
+    // interrupted write never leaves a broken checkpoint behind
+    static void Write(const std::string & file, const TrainingState & state,
+                      dynet::ParameterCollection & mod, dynet::Trainer & trainer);
+
+    // Read a checkpoint into a new model and trainer
+    static void Read(const std::string & file, TrainingState & state,
+                     dynet::ParameterCollection & mod, dynet::Trainer & trainer);
+
+};
+
+}
@@ -0,0 +1,267 @@
+#include <lamtram/data-parallel.h>
+#include <lamtram/macros.h>
+#include <dynet/model.h>
+#include <dynet/tensor.h>
+#include <dynet/devices.h>
+#include <dynet/globals.h>
+#include <dynet/training.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+inline size_t AlignSize(size_t size, size_t align) {
+  return (size + align - 1) / align * align;
+}
+
+DataParallel::DataParallel(int num_procs, bool async, ParameterCollection & mod) :
+      mod_(mod), num_procs_(num_procs), rank_(0), async_(async), shared_(nullptr), shared_size_(0), slot_size_(0), parity_(0),
+      params_(nullptr), params_size_(0), row_locks_(nullptr) {
+  if(num_procs_ < 2) THROW_ERROR("Data-parallel training needs at least two processes");
+  // Find the size of a slot
+  size_t num_floats = 0, num_rows = 0;
+  for(auto & p : mod_.parameters_list()) {
+    if(p->g.device->type != DeviceType::CPU) THROW_ERROR("Data-parallel training is only supported on the CPU");
+    num_floats += p->g.d.size();
+  }
+  for(auto & p : mod_.lookup_parameters_list()) {
+    if(p->all_grads.device->type != DeviceType::CPU) THROW_ERROR("Data-parallel training is only supported on the CPU");
+    num_floats += p->all_grads.d.size();
+    num_rows += p->grads.size();
+  }
+  // Asynchronous processes share the values instead of exchanging gradients
+  if(async_) {
+    ShareValues();
+    num_floats = num_rows = 0;
+  }
+  flags_offset_ = num_floats * sizeof(float);
+  values_offset_ = AlignSize(flags_offset_ + num_rows, sizeof(double));
+  slot_size_ = AlignSize(values_offset_ + kMaxValues * sizeof(double), 64);
+  shared_size_ = 2 * num_procs_ * slot_size_;
+  void * mapped = mmap(nullptr, shared_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(mapped == MAP_FAILED) THROW_ERROR("Could not allocate " << shared_size_ << " bytes of shared memory for data-parallel training");
+  shared_ = (char*)mapped;
+  // Fork the workers
+  for(int i = 1; i < num_procs_; i++) {
+    int to_fd[2], from_fd[2];
+    if(pipe(to_fd) == -1 || pipe(from_fd) == -1)
+      THROW_ERROR("Could not create pipes for data-parallel training");
+    cout.flush(); cerr.flush();
+    pid_t pid = fork();
+    if(pid == -1) THROW_ERROR("Could not fork data-parallel training process");
+    if(pid == 0) {
+      // The worker only keeps the pipes to the first process
+      for(int fd : to_fds_) close(fd);
+      for(int fd : from_fds_) close(fd);
+      close(to_fd[1]);
+      close(from_fd[0]);
+      to_fds_.assign(1, from_fd[1]);
+      from_fds_.assign(1, to_fd[0]);
+      pids_.clear();
+      rank_ = i;
+      return;
+    }
+    close(to_fd[0]);
+    close(from_fd[1]);
+    to_fds_.push_back(to_fd[1]);
+    from_fds_.push_back(from_fd[0]);
+    pids_.push_back(pid);
+  }
+}
+
+DataParallel::~DataParallel() {
+  // Workers are done once training finishes, but errors go up to be reported
+  if(rank_ != 0 && !std::uncaught_exception())
+    _exit(0);
+  for(int fd : to_fds_) close(fd);
+  for(int fd : from_fds_) close(fd);
+  for(pid_t pid : pids_) waitpid(pid, nullptr, 0);
+  if(shared_ != nullptr) munmap(shared_, shared_size_);
+  // The shared parameter values are still used by the model, so they stay mapped
+}
+
+void DataParallel::ShareValues() {
+  size_t num_floats = 0;
+  for(auto & p : mod_.parameters_list())
+    num_floats += p->values.d.size();
+  for(auto & p : mod_.lookup_parameters_list())
+    num_floats += p->all_values.d.size();
+  size_t locks_offset = AlignSize(num_floats * sizeof(float), 64);
+  params_size_ = locks_offset + kNumRowLocks * sizeof(std::atomic<int>);
+  void * mapped = mmap(nullptr, params_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(mapped == MAP_FAILED) THROW_ERROR("Could not allocate " << params_size_ << " bytes of shared memory for asynchronous training");
+  params_ = (char*)mapped;
+  row_locks_ = (std::atomic<int>*)(params_ + locks_offset);
+  for(size_t i = 0; i < kNumRowLocks; i++)
+    new (&row_locks_[i]) std::atomic<int>(0);
+  // Copy the values over and point the parameters at the copies
+  float * vals = (float*)params_;
+  for(auto & p : mod_.parameters_list()) {
+    memcpy(vals, p->values.v, p->values.d.size() * sizeof(float));
+    p->values.v = vals;
+    vals += p->values.d.size();
+  }
+  for(auto & p : mod_.lookup_parameters_list()) {
+    size_t row_size = p->dim.size();
+    memcpy(vals, p->all_values.v, p->all_values.d.size() * sizeof(float));
+    p->all_values.v = vals;
+    for(size_t row = 0; row < p->values.size(); row++)
+      p->values[row].v = vals + row * row_size;
+    vals += p->all_values.d.size();
+  }
+}
+
+void DataParallel::LockRows() {
+  // Always lock in increasing order, so processes can't deadlock
+  size_t param_id = 0;
+  for(auto & p : mod_.lookup_parameters_list()) {
+    if(p->all_updated) {
+      locked_.resize(kNumRowLocks);
+      std::iota(locked_.begin(), locked_.end(), 0);
+      break;
+    }
+    for(unsigned row : p->non_zero_grads)
+      locked_.push_back((param_id * 1000003 + row) % kNumRowLocks);
+    param_id++;
+  }
+  sort(locked_.begin(), locked_.end());
+  locked_.erase(unique(locked_.begin(), locked_.end()), locked_.end());
+  for(size_t id : locked_)
+    while(row_locks_[id].exchange(1, std::memory_order_acquire))
+      sched_yield();
+}
+
+void DataParallel::UnlockRows() {
+  for(size_t id : locked_)
+    row_locks_[id].store(0, std::memory_order_release);
+  locked_.clear();
+}
+
+void DataParallel::Update(Trainer & trainer) {
+  if(async_) {
+    // Dense lookup updates would write rows that aren't locked, and even rows
+    // without gradients are rewritten from values that may be stale, so only
+    // the rows with gradients may be updated
+    trainer.sparse_updates_enabled = true;
+    LockRows();
+    try {
+      trainer.update();
+    } catch(...) {
+      UnlockRows();
+      throw;
+    }
+    UnlockRows();
+  } else {
+    SumGradients();
+    trainer.update();
+  }
+}
+
+void DataParallel::Barrier() {
+  char c = 0;
+  if(rank_ == 0) {
+    for(int fd : from_fds_)
+      if(read(fd, &c, 1) != 1) THROW_ERROR("A data-parallel training process exited unexpectedly");
+    for(int fd : to_fds_)
+      if(write(fd, &c, 1) != 1) THROW_ERROR("A data-parallel training process exited unexpectedly");
+  } else {
+    if(write(to_fds_[0], &c, 1) != 1 || read(from_fds_[0], &c, 1) != 1)
+      THROW_ERROR("The first data-parallel training process exited unexpectedly");
+  }
+}
+
+void DataParallel::SumGradients() {
+  if(async_) THROW_ERROR("Gradients are not summed in asynchronous training");
+  // Write the gradients of this process, only copying the rows of lookup
+  // parameters that were used
+  char * slot = GetSlot(rank_);
+  float * vals = (float*)slot;
+  unsigned char * flags = (unsigned char*)(slot + flags_offset_);
+  for(auto & p : mod_.parameters_list()) {
+    memcpy(vals, p->g.v, p->g.d.size() * sizeof(float));
+    vals += p->g.d.size();
+  }
+  for(auto & p : mod_.lookup_parameters_list()) {
+    size_t row_size = p->dim.size(), num_rows = p->grads.size();
+    if(p->all_updated) {
+      memcpy(vals, p->all_grads.v, p->all_grads.d.size() * sizeof(float));
+      memset(flags, 1, num_rows);
+    } else {
+      memset(flags, 0, num_rows);
+      for(unsigned row : p->non_zero_grads) {
+        memcpy(vals + row * row_size, p->grads[row].v, row_size * sizeof(float));
+        flags[row] = 1;
+      }
+    }
+    vals += p->all_grads.d.size();
+    flags += num_rows;
+  }
+  Barrier();
+  // Sum the gradients of all processes in order of rank
+  size_t offset = 0, row_offset = 0;
+  for(auto & p : mod_.parameters_list()) {
+    size_t size = p->g.d.size();
+    float * g = p->g.v;
+    memcpy(g, (float*)GetSlot(0) + offset, size * sizeof(float));
+    for(int r = 1; r < num_procs_; r++) {
+      const float * other = (float*)GetSlot(r) + offset;
+      for(size_t i = 0; i < size; i++) g[i] += other[i];
+    }
+    offset += size;
+  }
+  for(auto & p : mod_.lookup_parameters_list()) {
+    size_t row_size = p->dim.size(), num_rows = p->grads.size();
+    for(size_t row = 0; row < num_rows; row++) {
+      float * g = p->grads[row].v;
+      bool used = false;
+      for(int r = 0; r < num_procs_; r++) {
+        char * other_slot = GetSlot(r);
+        if(!other_slot[flags_offset_ + row_offset + row]) continue;
+        const float * other = (float*)other_slot + offset + row * row_size;
+        if(!used) {
+          memcpy(g, other, row_size * sizeof(float));
+        } else {
+          for(size_t i = 0; i < row_size; i++) g[i] += other[i];
+        }
+        used = true;
+      }
+      if(used) p->non_zero_grads.insert(row);
+    }
+    offset += p->all_grads.d.size();
+    row_offset += num_rows;
+  }
+  parity_ ^= 1;
+}
+
+void DataParallel::SumValues(std::vector<double> & vals) {
+  if(vals.size() > kMaxValues) THROW_ERROR("Can only sum " << kMaxValues << " values between processes, but got " << vals.size());
+  memcpy(GetSlot(rank_) + values_offset_, vals.data(), vals.size() * sizeof(double));
+  Barrier();
+  for(size_t i = 0; i < vals.size(); i++) {
+    double sum = 0.0;
+    for(int r = 0; r < num_procs_; r++)
+      sum += ((double*)(GetSlot(r) + values_offset_))[i];
+    vals[i] = sum;
+  }
+  parity_ ^= 1;
+}
+
+void DataParallel::SyncRandom() {
+  vector<double> seed(1, rank_ == 0 ? (double)(*rndeng)() : 0.0);
+  SumValues(seed);
+  rndeng->seed((std::mt19937::result_type)seed[0]);
+}
+
+void DataParallel::SplitRandom() {
+  rndeng->seed((*rndeng)() + rank_);
+}
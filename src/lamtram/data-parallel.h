@@ -0,0 +1,107 @@
+#pragma once
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace dynet {
+class ParameterCollection;
+struct Trainer;
+}
+
+namespace lamtram {
+
+// Data-parallel training in several processes on one machine. Creating this
+// forks num_procs-1 workers that continue running from the point of creation
+// with a copy of the model, and each process then trains on different
+// minibatches.
+//
+// In synchronous mode, the gradients of all processes are summed through
+// shared memory before every update, always in the order of the process ranks,
+// so every process makes the same update and the parameters stay identical.
+//
+// In asynchronous mode, the parameter values themselves are moved to shared
+// memory and each process updates them as soon as it has a gradient, without
+// waiting for the others (Hogwild). Dense parameters are updated without any
+// locking, but the rows of lookup parameters are protected by striped locks so
+// two processes don't update the same word embedding at the same time. Only
+// the rows with gradients are updated, so the trainer's sparse updates are
+// always enabled.
+// Trainer state such as momentum stays local to each process.
+//
+// Processes synchronize through pipes to the first process, so if any of them
+// dies the others get an error instead of waiting forever. When this is
+// destroyed, the workers exit and the first process waits for them.
+class DataParallel {
+
+public:
+    DataParallel(int num_procs, bool async, dynet::ParameterCollection & mod);
+    ~DataParallel();
+
+    int GetRank() const { return rank_; }
+    int GetNumProcs() const { return num_procs_; }
+    bool IsAsync() const { return async_; }
+
+    // Update the parameters with the gradient of this process, summed with the
+    // other processes in synchronous mode
+    void Update(dynet::Trainer & trainer);
+
+    // Replace the gradients of each process with the sum over all processes
+    void SumGradients();
+
+    // Replace each value with the sum over all processes (at most kMaxValues)
+    void SumValues(std::vector<double> & vals);
+
+    // Give all processes the same random state, as it is used differently by
+    // each one while training on different minibatches
+    void SyncRandom();
+    // Give each process a different random state, so dropout differs between them
+    void SplitRandom();
+
+    // Wait until all processes have reached the barrier
+    void Barrier();
+
+    static const size_t kMaxValues = 16;
+    static const size_t kNumRowLocks = 4096;
+
+protected:
+
+    // The shared memory for a process in the current round
+    char * GetSlot(int rank) { return shared_ + (parity_ * num_procs_ + rank) * slot_size_; }
+
+    // Move the parameter values to shared memory before forking
+    void ShareValues();
+    // Lock or unlock the stripes of all lookup rows with gradients
+    void LockRows();
+    void UnlockRows();
+
+    dynet::ParameterCollection & mod_;
+    int num_procs_, rank_;
+    bool async_;
+    std::vector<pid_t> pids_;
+    // Pipes from the workers to the first process and back
+    std::vector<int> from_fds_, to_fds_;
+
+    // Shared memory with a slot for each process, and two sets of slots that
+    // are used in alternate rounds so one can be written while the other is
+    // still being read. Each slot holds the gradients (synchronous mode only),
+    // a flag for each row of the lookup parameters that has a gradient, and
+    // the values to be summed.
+    char * shared_;
+    size_t shared_size_, slot_size_;
+    size_t flags_offset_, values_offset_;
+    int parity_;
+
+    // Shared parameter values and row locks in asynchronous mode
+    char * params_;
+    size_t params_size_;
+    std::atomic<int> * row_locks_;
+    std::vector<size_t> locked_;
+
+};
+
+typedef std::shared_ptr<DataParallel> DataParallelPtr;
+
+}
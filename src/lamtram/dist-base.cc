@@ -29,3 +29,7 @@ void DistBase::calc_all_word_dists(const Sentence & ctxt_ngram,
   sparse_offset += get_sparse_size();
   dense_offset += get_dense_size();
 }
+
+void DistBase::write_binary(DictPtr dict, const std::string & file) const {
+  THROW_ERROR("Distribution " << get_sig() << " can't be written in the binary format");
+}
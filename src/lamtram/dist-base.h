@@ -74,6 +74,8 @@ public:
   // Read/write model. If dict is null, use numerical ids, otherwise strings.
   virtual void write(DictPtr dict, std::ostream & str) const = 0;
   virtual void read(DictPtr dict, std::istream & str) = 0;
+  // Write the model to a binary file, if this distribution supports one
+  virtual void write_binary(DictPtr dict, const std::string & file) const;
 
 protected:
   size_t ctxt_len_;  
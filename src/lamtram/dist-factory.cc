@@ -27,6 +27,8 @@ DistPtr DistFactory::create_dist(const std::string & sig) {
 }
 
 DistPtr DistFactory::from_file(const std::string & file_name, DictPtr dict) {
+  if(DistNgram::is_binary(file_name))
+    return DistPtr(DistNgram::read_binary(dict, file_name));
   InputFileStream in(file_name);
   if(!in) THROW_ERROR("Could not open " << file_name);
   string line;
@@ -8,6 +8,12 @@
 #include <lamtram/dict-utils.h>
 #include <lamtram/string-util.h>
 #include <lamtram/counts.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
 #include <math.h>
 
 #define EOS_ID 0
@@ -20,7 +26,7 @@ using namespace lamtram;
 // 1) ngram
 // 2) lin/mabs/mkn: where "lin" means linear, "mabs" means modified absolute
 //    discounting, and "mkn" means modified kneser ney
-DistNgram::DistNgram(const std::string & sig) : DistBase(sig) {
+DistNgram::DistNgram(const std::string & sig) : DistBase(sig), mapped_data_(nullptr), mapped_size_(0) {
   // Split and sanity check signature
   std::vector<std::string> strs;
   boost::split(strs,sig,boost::is_any_of("_"));
@@ -38,6 +44,7 @@ DistNgram::DistNgram(const std::string & sig) : DistBase(sig) {
     }
   }
   ngram_len_ = ctxt_pos_.size() + 1;
+  table_ = NgramTable(ngram_len_);
   // save the smoothing type
   if(strs[1] == "lin") {
     smoothing_ = SMOOTH_LIN;
@@ -50,6 +57,10 @@ DistNgram::DistNgram(const std::string & sig) : DistBase(sig) {
   }
 }
 
+DistNgram::~DistNgram() {
+  if(mapped_data_ != nullptr) munmap(mapped_data_, mapped_size_);
+}
+
 std::string DistNgram::get_sig() const {
   ostringstream oss;
   oss << "ngram" << (heuristics_?"h":"") << "_" << (smoothing_ == SMOOTH_LIN ? "lin" : "mabs");
@@ -85,8 +96,8 @@ int DistNgram::get_tmp_ctxt_id(const Sentence & ngram) {
   return ret;
 }
 int DistNgram::get_existing_ctxt_id(const Sentence & ngram) const {
-  auto it = mapping_.find(ngram);
-  return it != mapping_.end() ? it->second : -1;
+  const int * id = table_.Find(ngram);
+  return id != nullptr ? *id : -1;
 }
 
 // Add stats from one sentence at training time for count-based models
@@ -180,12 +191,17 @@ void DistNgram::finalize_stats() {
         disc_ctxt_cnts_[ngram.second] += ctxt_cnts_[ngram.second].second;
       }
       if(value > 0) {
-        int id = get_existing_ctxt_id(get_prev_ctxt(ngram.first));
-        assert(id != -1);
-        disc_ctxt_cnts_[id] -= discounts_[ngram.first.size()-1][min(3,value)];
+        auto it = mapping_.find(get_prev_ctxt(ngram.first));
+        assert(it != mapping_.end());
+        disc_ctxt_cnts_[it->second] -= discounts_[ngram.first.size()-1][min(3,value)];
       }
     }
   }
+  // Move the mapping into the table
+  table_ = NgramTable(ngram_len_);
+  for(const auto & ngram : mapping_)
+    table_.Insert(ngram.first, ngram.second);
+  std::unordered_map<Sentence, int>().swap(mapping_);
 }
 
 // Get the number of ctxtual features we can expect from this model
@@ -196,10 +212,15 @@ size_t DistNgram::get_ctxt_size() const {
 // And calculate these features
 void DistNgram::calc_ctxt_feats(const Sentence & ctxt, float* feats_out) const {
   assert(ctxt.size() >= ctxt_len_);
-  Sentence ngram;
+  // The context of each order is a suffix of the longest one
+  Sentence ngram_buf(ngram_len_);
+  const WordId * ngram = ngram_buf.data();
+  for(size_t j = 1; j < ngram_len_; j++)
+    ngram_buf[j-1] = ctxt[ctxt.size()-ctxt_pos_[j-1]];
   int ctxt_size = (smoothing_ == SMOOTH_LIN ? 3 : 4);
   for(int j = ctxt_pos_.size(); j >= 0; j--) {
-    int id = get_existing_ctxt_id(ngram);
+    const int * found = table_.Find(ngram + j, ctxt_pos_.size() - j);
+    int id = (found != nullptr ? *found : -1);
     if(id == -1 || ctxt_cnts_[id].second == 0) {
       for(int j2 = j; j2 >= 0; j2--) {
         *(feats_out++) = 1.f;
@@ -213,8 +234,6 @@ void DistNgram::calc_ctxt_feats(const Sentence & ctxt, float* feats_out) const {
       if(smoothing_ != SMOOTH_LIN)
         *(feats_out++) = log(disc_ctxt_cnts_[id]);
     }
-    if(j != 0)
-      ngram.insert(ngram.begin(), ctxt[ctxt.size()-ctxt_pos_[j-1]]);
   }
 }
 
@@ -232,22 +251,28 @@ void DistNgram::calc_word_dists(const Sentence & ngram,
   int & write_offset = (heuristics_?temp_offset:dense_offset);
   // Calculate the probability
   float base_prob = (*ngram.rbegin() != UNK_ID ? 1.0 : unk_prob);
-  Sentence this_ngram(1, *ngram.rbegin()), this_ctxt;
+  // The n-gram of each order is a suffix of the longest one, and its context
+  // is the same without the last word
+  Sentence ngram_buf(ngram_len_);
+  WordId * this_ngram = ngram_buf.data();
+  this_ngram[ngram_len_-1] = *ngram.rbegin();
+  for(size_t j = 1; j < ngram_len_; j++)
+    this_ngram[j-1] = ngram[ngram.size()-ctxt_pos_[j-1]-1];
   for(int j = ctxt_pos_.size(); j >= 0; j--) {
-    auto ngram_it = mapping_.find(this_ngram);
-    auto context_it = mapping_.find(this_ctxt);
-    if(ngram_it == mapping_.end()) {
-      float my_prob = (context_it != mapping_.end() ? 0.0 : uniform_prob * base_prob);
+    const int * ngram_it = table_.Find(this_ngram + j, ngram_len_ - j);
+    const int * context_it = table_.Find(this_ngram + j, ngram_len_ - j - 1);
+    if(ngram_it == nullptr) {
+      float my_prob = (context_it != nullptr ? 0.0 : uniform_prob * base_prob);
       // cerr << "my_prob: " << my_prob << endl;
       write_vec[write_offset++] = my_prob;
     } else {
-      if(context_it == mapping_.end())
-        THROW_ERROR("ngram ("<<this_ngram<<") exists but ctxt (" << this_ctxt << ") doesn't");
-      int value = (j == 0 ? ngram_it->second : ctxt_cnts_[ngram_it->second].first);
+      if(context_it == nullptr)
+        THROW_ERROR("ngram ("<<Sentence(this_ngram + j, this_ngram + ngram_len_)<<") exists but ctxt (" << Sentence(this_ngram + j, this_ngram + ngram_len_ - 1) << ") doesn't");
+      int value = (j == 0 ? *ngram_it : ctxt_cnts_[*ngram_it].first);
       if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
         // assert(discounts_.size() > this_ctxt.size());
         // assert(disc_ctxt_cnts_.size() > context_it->second);
-        write_vec[write_offset++] = (value-discounts_[this_ctxt.size()][min(value,3)])/disc_ctxt_cnts_[context_it->second] * base_prob;
+        write_vec[write_offset++] = (value-discounts_[ngram_len_ - j - 1][min(value,3)])/disc_ctxt_cnts_[*context_it] * base_prob;
         // if(write_vec[write_offset-1] > 1.001) {
         //   cerr << "this_ctxt: " << this_ctxt << endl;
         //   cerr << "value_absmkn: (" << value << "-" << discounts_[this_ctxt.size()][min(value,3)] << ")/" << disc_ctxt_cnts_[context_it->second] << " * " << base_prob << endl;
@@ -255,19 +280,15 @@ void DistNgram::calc_word_dists(const Sentence & ngram,
         // }
       } else {
         // cerr << "value_lin: " << value << "/" << (float)ctxt_cnts_[context_it->second].second * base_prob << endl;
-        write_vec[write_offset++] = value/(float)ctxt_cnts_[context_it->second].second * base_prob;
+        write_vec[write_offset++] = value/(float)ctxt_cnts_[*context_it].second * base_prob;
       }
     }
-    if(j != 0) {
-      this_ngram.insert(this_ngram.begin(), ngram[ngram.size()-ctxt_pos_[j-1]-1]);
-      this_ctxt.insert(this_ctxt.begin(), ngram[ngram.size()-ctxt_pos_[j-1]-1]);
-    }
   }
   // Convert into heuristics if necessary
   if(heuristics_) {
     if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
       vector<float> ctxts((ctxt_pos_.size()+1)*4);
-      calc_ctxt_feats(this_ctxt, &ctxts[0]);
+      calc_ctxt_feats(Sentence(this_ngram, this_ngram + ngram_len_ - 1), &ctxts[0]);
       float val = 0.f;
       float left = 1.0;
       for(int i = temp_vec.size() - 1; i >= 0; i--) {
@@ -308,14 +329,19 @@ void DistNgram::calc_all_word_dists(const Sentence & ctxt_ngram,
   vector<float> temp_vec(heuristics_?data_len:0);
   float *write_ptr = (heuristics_?&temp_vec[0]:&trg_dense[dense_offset]);
   memset(write_ptr, 0, data_len*sizeof(float));
-  // Loop through all the contexts
-  Sentence this_ngram(1, 0), this_ctxt;
-  for(int j = ctxt_pos_.size(); j >= 0; j--) {
-    auto context_it = mapping_.find(this_ctxt);
+  // Loop through all the contexts, each of which is a suffix of the longest
+  Sentence ngram_buf(ngram_len);
+  WordId * this_ngram = ngram_buf.data();
+  this_ngram[ngram_len-1] = 0;
+  for(size_t j = 1; j < ngram_len; j++)
+    this_ngram[j-1] = ctxt_ngram[ctxt_ngram.size()-ctxt_pos_[j-1]];
+  int j;
+  for(j = ctxt_pos_.size(); j >= 0; j--) {
+    const int * context_it = table_.Find(this_ngram + j, ngram_len - j - 1);
     int offset = ctxt_pos_.size()-j;
     // If the context is not found, overwrite the remainder with uniform
     // probabilities and terminate
-    if(context_it == mapping_.end()) {
+    if(context_it == nullptr) {
       float *beg = write_ptr;
       for(int wid = 0; wid < vocab_size; wid++, beg += ngram_len)
         for(int oid = offset; oid < ngram_len; oid++)
@@ -324,12 +350,12 @@ void DistNgram::calc_all_word_dists(const Sentence & ctxt_ngram,
     }
     // TODO: This would be much better as prefix search
     for(int wid = 0; wid < vocab_size; wid++) {
-      *this_ngram.rbegin() = wid;
-      auto ngram_it = mapping_.find(this_ngram);
-      if(ngram_it != mapping_.end()) {
-        int value = (j == 0 ? ngram_it->second : ctxt_cnts_[ngram_it->second].first);
+      this_ngram[ngram_len-1] = wid;
+      const int * ngram_it = table_.Find(this_ngram + j, ngram_len - j);
+      if(ngram_it != nullptr) {
+        int value = (j == 0 ? *ngram_it : ctxt_cnts_[*ngram_it].first);
         if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
-          write_ptr[wid*ngram_len+offset] = (value-discounts_[this_ctxt.size()][min(value,3)])/disc_ctxt_cnts_[context_it->second];
+          write_ptr[wid*ngram_len+offset] = (value-discounts_[ngram_len - j - 1][min(value,3)])/disc_ctxt_cnts_[*context_it];
           // if(write_ptr[wid*ngram_len+offset] > 1.001) {
           //   cerr << "this_ctxt: " << this_ctxt << endl;
           //   cerr << "value_absmkn: (" << value << "-" << discounts_[this_ctxt.size()][min(value,3)] << ")/" << disc_ctxt_cnts_[context_it->second] << endl;
@@ -337,20 +363,16 @@ void DistNgram::calc_all_word_dists(const Sentence & ctxt_ngram,
           // }
         } else {
           // cerr << "value_lin: " << value << "/" << (float)ctxt_cnts_[context_it->second].second << endl;
-          write_ptr[wid*ngram_len+offset] = value/(float)ctxt_cnts_[context_it->second].second;
+          write_ptr[wid*ngram_len+offset] = value/(float)ctxt_cnts_[*context_it].second;
         }
       }
     }
-    if(j != 0) {
-      this_ngram.insert(this_ngram.begin(), ctxt_ngram[ctxt_ngram.size()-ctxt_pos_[j-1]]);
-      this_ctxt.insert(this_ctxt.begin(), ctxt_ngram[ctxt_ngram.size()-ctxt_pos_[j-1]]);
-    }
   }
   // Convert into heuristics if necessary
   if(heuristics_) {
     if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
       vector<float> ctxts((ctxt_pos_.size()+1)*4);
-      calc_ctxt_feats(this_ctxt, &ctxts[0]);
+      calc_ctxt_feats(Sentence(this_ngram + max(j, 0), this_ngram + ngram_len - 1), &ctxts[0]);
       memset(&trg_dense[dense_offset], 0, vocab_size*sizeof(float));
       float left = 1.0;
       for(int i = temp_vec.size() - 1; i >= 0; i--) {
@@ -386,14 +408,16 @@ void DistNgram::write(DictPtr dict, std::ostream & out) const {
       out << discount[1] << ' ' << discount[2] << ' ' << discount[3] << '\n';
     out << '\n';
   }
-  out << "mapping " << mapping_.size() << ' ' << ctxt_cnts_.size() << '\n';
-  for(auto & map_elem : mapping_) {
-    out << PrintWords(*dict, map_elem.first) << '\t';
-    if(map_elem.first.size() == ngram_len_) {
-      out << map_elem.second;
+  out << "mapping " << table_.GetSize() << ' ' << ctxt_cnts_.size() << '\n';
+  for(size_t i = 0; i < table_.GetSize(); i++) {
+    Sentence ngram = table_.GetNgram(i);
+    int value = table_.GetValue(i);
+    out << PrintWords(*dict, ngram) << '\t';
+    if(ngram.size() == ngram_len_) {
+      out << value;
     } else {
-      out << ctxt_cnts_[map_elem.second].first << ' ' << ctxt_cnts_[map_elem.second].second << ' ' << ctxt_cnts_[map_elem.second].third;
-      if(disc_ctxt_cnts_.size() != 0) out << ' ' << disc_ctxt_cnts_[map_elem.second];
+      out << ctxt_cnts_[value].first << ' ' << ctxt_cnts_[value].second << ' ' << ctxt_cnts_[value].third;
+      if(disc_ctxt_cnts_.size() != 0) out << ' ' << disc_ctxt_cnts_[value];
     }
     out << '\n';
   }
@@ -432,7 +456,7 @@ void DistNgram::read(DictPtr dict, std::istream & in) {
     getline_or_die(in, line);
     istringstream iss(line); iss >> strid >> size >> size2;
     if(strid != "mapping") THROW_ERROR("Bad format of mapping: " << line << endl);
-    mapping_.reserve(size*1.1);
+    table_ = NgramTable(ngram_len_);
     ctxt_cnts_.reserve(size2);
     if(smoothing_ != SMOOTH_LIN) disc_ctxt_cnts_.reserve(size2);
     for(int i = 0; i < size; i++) {
@@ -443,12 +467,12 @@ void DistNgram::read(DictPtr dict, std::istream & in) {
       Sentence ngram = ParseWords(*dict, words, false);
       for(pos1 = 0; pos1 < (int)words.size() && (ngram[pos1] != 1 || words[pos1] == "<unk>"); pos1++);
       if(pos1 != words.size()) continue;
-      if(mapping_.find(ngram) != mapping_.end())
+      if(table_.Find(ngram) != nullptr)
         THROW_ERROR("Found duplicate entry for ngram " << ngram << " at: " << line << endl);
       if(ngram.size() == ngram_len_) {
-        mapping_[ngram] = stoi(strs[1]);
+        table_.Insert(ngram, stoi(strs[1]));
       } else {
-        mapping_[ngram] = ctxt_cnts_.size();
+        table_.Insert(ngram, ctxt_cnts_.size());
         istringstream iss(strs[1]);
         iss >> cnt1 >> cnt2 >> cnt3; ctxt_cnts_.push_back(DistNgramCounts(cnt1,cnt2,cnt3));
         if(smoothing_ != SMOOTH_LIN) { iss >> cnt4; disc_ctxt_cnts_.push_back(cnt4); }
@@ -457,3 +481,163 @@ void DistNgram::read(DictPtr dict, std::istream & in) {
     getline_expected(in, "");
   }
 }
+
+// The binary format starts with the magic string "LAMTRAMN", a version
+// number, and a text header with the signature and vocabulary. It is
+// followed by the discounts, the context counts, the discounted context
+// counts, and the n-gram table, each aligned to 64 bytes.
+static const char kNgramMagic[8] = {'L','A','M','T','R','A','M','N'};
+static const uint32_t kNgramVersion = 1;
+static const uint64_t kNgramAlign = 64;
+static const int kNgramSections = 4;
+
+inline uint64_t AlignNgramOffset(uint64_t offset) {
+  return (offset + kNgramAlign - 1) / kNgramAlign * kNgramAlign;
+}
+
+template <class T>
+inline void WriteNgramValue(string & out, T val) {
+  out.append((const char*)&val, sizeof(T));
+}
+
+template <class T>
+inline T ReadNgramValue(const char * data, size_t data_size, size_t & pos) {
+  if(pos + sizeof(T) > data_size) THROW_ERROR("Premature end of binary n-gram file");
+  T val;
+  memcpy(&val, data + pos, sizeof(T));
+  pos += sizeof(T);
+  return val;
+}
+
+void DistNgram::write_binary(DictPtr dict, const std::string & file) const {
+  ostringstream header;
+  header << get_sig() << '\n';
+  WriteDict(*dict, header);
+  // Gather the sections, the discounts being only the three used values of each order
+  vector<float> discounts;
+  for(auto & discount : discounts_)
+    discounts.insert(discounts.end(), discount.begin()+1, discount.end());
+  vector<string> sections(kNgramSections);
+  sections[0].assign((const char*)discounts.data(), discounts.size() * sizeof(float));
+  for(auto & cnt : ctxt_cnts_) {
+    WriteNgramValue<int32_t>(sections[1], cnt.first);
+    WriteNgramValue<int32_t>(sections[1], cnt.second);
+    WriteNgramValue<int32_t>(sections[1], cnt.third);
+  }
+  sections[2].assign((const char*)disc_ctxt_cnts_.data(), disc_ctxt_cnts_.size() * sizeof(float));
+  table_.Write(sections[3]);
+  // Write the magic string, header, and section locations, then the sections
+  string out(kNgramMagic, sizeof(kNgramMagic));
+  WriteNgramValue<uint32_t>(out, kNgramVersion);
+  WriteNgramValue<uint64_t>(out, header.str().size());
+  out += header.str();
+  uint64_t offset = AlignNgramOffset(out.size() + kNgramSections * 2 * sizeof(uint64_t));
+  for(auto & section : sections) {
+    WriteNgramValue<uint64_t>(out, offset);
+    WriteNgramValue<uint64_t>(out, section.size());
+    offset = AlignNgramOffset(offset + section.size());
+  }
+  for(auto & section : sections) {
+    out.resize(AlignNgramOffset(out.size()), '\0');
+    out += section;
+  }
+  ofstream file_out(file, ios::binary);
+  if(!file_out) THROW_ERROR("Could not open output file: " << file);
+  file_out.write(out.data(), out.size());
+  if(!file_out) THROW_ERROR("Failed writing binary n-gram file: " << file);
+}
+
+bool DistNgram::is_binary(const std::string & file) {
+  ifstream in(file, ios::binary);
+  char magic[sizeof(kNgramMagic)];
+  return in.read(magic, sizeof(magic)) && memcmp(magic, kNgramMagic, sizeof(magic)) == 0;
+}
+
+DistNgram* DistNgram::read_binary(DictPtr dict, const std::string & file) {
+  int fd = open(file.c_str(), O_RDONLY);
+  if(fd == -1) THROW_ERROR("Could not open n-gram file " << file);
+  struct stat st;
+  if(fstat(fd, &st) == -1) { close(fd); THROW_ERROR("Could not get the size of n-gram file " << file); }
+  size_t data_size = st.st_size;
+  void * mapped = mmap(nullptr, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapped == MAP_FAILED) THROW_ERROR("Could not map n-gram file " << file);
+  char * data = (char*)mapped;
+  // Read the magic string, header, and section locations
+  if(data_size < sizeof(kNgramMagic) || memcmp(data, kNgramMagic, sizeof(kNgramMagic)) != 0) {
+    munmap(mapped, data_size);
+    THROW_ERROR("Not a binary n-gram file: " << file);
+  }
+  std::unique_ptr<DistNgram> ret;
+  std::unique_ptr<dynet::Dict> file_dict;
+  vector<uint64_t> offsets(kNgramSections), sizes(kNgramSections);
+  try {
+    size_t pos = sizeof(kNgramMagic);
+    uint32_t version = ReadNgramValue<uint32_t>(data, data_size, pos);
+    if(version != kNgramVersion)
+      THROW_ERROR("Expecting binary n-gram version " << kNgramVersion << " but got " << version << " in " << file);
+    uint64_t header_size = ReadNgramValue<uint64_t>(data, data_size, pos);
+    if(pos + header_size > data_size) THROW_ERROR("Premature end of binary n-gram file");
+    istringstream header(string(data + pos, header_size));
+    pos += header_size;
+    string sig;
+    getline(header, sig);
+    ret.reset(new DistNgram(sig));
+    file_dict.reset(ReadDict(header));
+    for(int i = 0; i < kNgramSections; i++) {
+      offsets[i] = ReadNgramValue<uint64_t>(data, data_size, pos);
+      sizes[i] = ReadNgramValue<uint64_t>(data, data_size, pos);
+      if(offsets[i] % sizeof(int32_t) != 0 || offsets[i] + sizes[i] > data_size)
+        THROW_ERROR("Bad location for section " << i << " in " << file);
+    }
+  } catch(...) {
+    munmap(mapped, data_size);
+    throw;
+  }
+  ret->mapped_data_ = data;
+  ret->mapped_size_ = data_size;
+  // Copy the counts, which are small compared to the table
+  const float * discounts = (const float*)(data + offsets[0]);
+  if(ret->smoothing_ != SMOOTH_LIN) {
+    if(sizes[0] != ret->ngram_len_ * 3 * sizeof(float)) THROW_ERROR("Bad size of discounts in " << file);
+    ret->discounts_.resize(ret->ngram_len_, vector<float>(4));
+    for(size_t i = 0; i < ret->ngram_len_; i++)
+      for(int j = 1; j < 4; j++)
+        ret->discounts_[i][j] = *(discounts++);
+  }
+  const int32_t * cnts = (const int32_t*)(data + offsets[1]);
+  ret->ctxt_cnts_.resize(sizes[1] / (3 * sizeof(int32_t)));
+  for(auto & cnt : ret->ctxt_cnts_) {
+    cnt.first = cnts[0]; cnt.second = cnts[1]; cnt.third = cnts[2];
+    cnts += 3;
+  }
+  const float * disc_cnts = (const float*)(data + offsets[2]);
+  ret->disc_ctxt_cnts_.assign(disc_cnts, disc_cnts + sizes[2] / sizeof(float));
+  // Use the table in place if the ids are the same, and otherwise convert
+  // them, skipping n-grams with unknown words like the text format
+  ret->table_.Map(data + offsets[3], sizes[3]);
+  if(ret->table_.GetMaxLen() != ret->ngram_len_) THROW_ERROR("Bad n-gram length in " << file);
+  if(file_dict->get_words() != dict->get_words()) {
+    const vector<string> & words = file_dict->get_words();
+    vector<WordId> ids(words.size());
+    for(size_t i = 0; i < words.size(); i++) {
+      ids[i] = dict->convert(words[i]);
+      if(ids[i] == 1 && words[i] != "<unk>") ids[i] = -1;
+    }
+    NgramTable table(ret->ngram_len_);
+    for(size_t i = 0; i < ret->table_.GetSize(); i++) {
+      Sentence ngram = ret->table_.GetNgram(i);
+      size_t pos1;
+      for(pos1 = 0; pos1 < ngram.size() && ngram[pos1] >= 0 && ngram[pos1] < (int)ids.size() && ids[ngram[pos1]] != -1; pos1++)
+        ngram[pos1] = ids[ngram[pos1]];
+      if(pos1 != ngram.size()) continue;
+      if(table.Find(ngram) != nullptr)
+        THROW_ERROR("Found duplicate entry for ngram " << ngram << " in " << file);
+      table.Insert(ngram, ret->table_.GetValue(i));
+    }
+    ret->table_ = table;
+    munmap(ret->mapped_data_, ret->mapped_size_);
+    ret->mapped_data_ = nullptr;
+  }
+  return ret.release();
+}
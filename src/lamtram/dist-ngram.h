@@ -6,6 +6,7 @@
 #include <unordered_set>
 #include <lamtram/sentence.h>
 #include <lamtram/dist-base.h>
+#include <lamtram/ngram-table.h>
 #include <lamtram/hashes.h>
 
 namespace lamtram {
@@ -31,7 +32,7 @@ public:
   // 3) lin/wb/mkn: where "lin" means linear, "wb" means witten bell, and "mkn"
   //    means modified kneser ney
   DistNgram(const std::string & sig);
-  virtual ~DistNgram() { }
+  virtual ~DistNgram();
 
   // Get the signature of this class that uniquely identifies it for loading
   // at test time. In other words, the signature can collapse any information
@@ -72,6 +73,13 @@ public:
   virtual void write(DictPtr dict, std::ostream & str) const override;
   virtual void read(DictPtr dict, std::istream & str) override;
 
+  // Write the model to a binary file, or map one into memory. The n-gram
+  // table is used in place if the file was written with the same vocabulary,
+  // and otherwise converted to the ids of dict while loading.
+  virtual void write_binary(DictPtr dict, const std::string & file) const override;
+  static bool is_binary(const std::string & file);
+  static DistNgram* read_binary(DictPtr dict, const std::string & file);
+
   // Create the context
   int get_ctxt_id(const Sentence & ngram);
   int get_tmp_ctxt_id(const Sentence & ngram);
@@ -98,8 +106,14 @@ protected:
   //   - One to ctxt_cnts_[b].ctxt_true and ctxt_cnts_[bc]
 
   // A mapping from either counts or positions in the count array, depending
-  // on whether the n-gram is the longest allowed.
+  // on whether the n-gram is the longest allowed. This is only used while
+  // collecting the stats, and moved into table_ once they are finalized.
   std::unordered_map<Sentence, int> mapping_, tmp_mapping_;
+  // The same mapping in a compact table, which all lookups use
+  NgramTable table_;
+  // The binary file that table_ is mapped from, if any
+  char * mapped_data_;
+  size_t mapped_size_;
   // Counts for word context, etc
   std::vector<DistNgramCounts> ctxt_cnts_;
   // Discounted counts
@@ -26,6 +26,7 @@ int DistTrain::main(int argc, char** argv) {
     ("train_file", po::value<string>()->default_value(""), "Training file")
     ("model_out", po::value<string>()->default_value(""), "File to write the model to")
     ("sig", po::value<string>()->default_value("ngram_lin_1_2_3"), "Signature for the language model")
+    ("binary_out", po::value<bool>()->default_value(false), "Write the model in a binary format that can be mapped into memory (n-gram models only)")
     ("verbose", po::value<int>()->default_value(0), "How much verbose output to print")
     ;
   boost::program_options::variables_map vm_;
@@ -37,9 +38,13 @@ int DistTrain::main(int argc, char** argv) {
   }
 
   // Open output file
-  ofstream model_out(vm_["model_out"].as<string>());
-  if(!model_out)
-    THROW_ERROR("Could not write to output file: " << vm_["model_out"].as<string>());
+  bool binary_out = vm_["binary_out"].as<bool>();
+  ofstream model_out;
+  if(!binary_out) {
+    model_out.open(vm_["model_out"].as<string>());
+    if(!model_out)
+      THROW_ERROR("Could not write to output file: " << vm_["model_out"].as<string>());
+  }
 
   GlobalVars::verbose = vm_["verbose"].as<int>();
 
@@ -70,8 +75,12 @@ int DistTrain::main(int argc, char** argv) {
   dist->finalize_stats();
 
   // Write the model
-  model_out << dist->get_sig() << endl;
-  dist->write(dict, model_out);
+  if(binary_out) {
+    dist->write_binary(dict, vm_["model_out"].as<string>());
+  } else {
+    model_out << dist->get_sig() << endl;
+    dist->write(dict, model_out);
+  }
 
   return 0;
 }
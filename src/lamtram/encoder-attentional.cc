@@ -1,13 +1,17 @@
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/macros.h>
 #include <lamtram/builder-factory.h>
+#include <lamtram/mlp-attention.h>
 #include <dynet/model.h>
 #include <dynet/nodes.h>
 #include <dynet/rnn.h>
 #include <dynet/dict.h>
+#include <dynet/globals.h>
+#include <dynet/devices.h>
 #include <boost/range/irange.hpp>
 #include <boost/algorithm/string.hpp>
 #include <ctime>
+#include <cfloat>
 #include <fstream>
 
 using namespace std;
@@ -28,7 +32,7 @@ ExternAttentional::ExternAttentional(const std::vector<LinearEncoderPtr> & encod
                    const DictPtr & vocab_src, const DictPtr & vocab_trg,
                    ParameterCollection & mod)
     : ExternCalculator(0), encoders_(encoders),
-      attention_type_(attention_type), attention_hist_(attention_hist), hidden_size_(0), state_size_(state_size), lex_type_(lex_type) {
+      attention_type_(attention_type), attention_hist_(attention_hist), hidden_size_(0), state_size_(state_size), window_(0), lex_type_(lex_type) {
 
   for(auto & enc : encoders)
     context_size_ += enc->GetNumNodes();
@@ -37,8 +41,14 @@ ExternAttentional::ExternAttentional(const std::vector<LinearEncoderPtr> & encod
     // No parameters for dot product
   } else if(attention_type_ == "bilin") {
     p_ehid_h_W_ = mod.add_parameters({(unsigned int)state_size_, (unsigned int)context_size_});
-  } else if(attention_type_.substr(0,4) == "mlp:") {
-    hidden_size_ = stoi(attention_type_.substr(4));
+  } else if(attention_type_.substr(0,4) == "mlp:" || attention_type_.substr(0,6) == "local:") {
+    // Local attention scores a window of window_ positions on each side with an MLP
+    if(attention_type_[0] == 'l') {
+      window_ = stoi(attention_type_.substr(6));
+      if(window_ <= 0) THROW_ERROR("The window of local attention must be positive: " << attention_type);
+    } else {
+      hidden_size_ = stoi(attention_type_.substr(4));
+    }
     if(hidden_size_ == 0) hidden_size_ = GlobalVars::layer_size;
     p_ehid_h_W_ = mod.add_parameters({(unsigned int)hidden_size_, (unsigned int)context_size_});
     p_ehid_state_W_ = mod.add_parameters({(unsigned int)hidden_size_, (unsigned int)state_size_});
@@ -200,6 +210,14 @@ void ExternAttentional::InitializeSentence(
     i_lexicon_ = input(cg, {(unsigned int)lex_size_, (unsigned int)sent_len_}, lex_ids, lex_data, lex_alpha_);
   }
 
+  // Remember the values in case sentences are selected later
+  src_lens_.assign(1, sent_src.size());
+  curr_lens_ = src_lens_;
+  i_h_all_ = i_h_;
+  i_ehid_hpart_all_ = i_ehid_hpart_;
+  i_lexicon_all_ = i_lexicon_;
+  i_src_mask_ = Expression();
+
 }
 
 void ExternAttentional::InitializeSentence(
@@ -227,6 +245,15 @@ void ExternAttentional::InitializeSentence(
   }
   i_h_ = concatenate_cols(hs_comb);
   i_h_last_ = *hs_comb.rbegin();
+  // The encoders give each sentence the states it has when encoded alone, so
+  // shorter sentences start from the state after their own end
+  vector<Expression> lasts(sent_src.size());
+  bool padded = false;
+  for(size_t j = 0; j < sent_src.size(); ++j) {
+    padded = padded || (int)sent_src[j].size() + 1 < sent_len_;
+    lasts[j] = pick_batch_elem(hs_comb[min((int)sent_src[j].size(), sent_len_ - 1)], j);
+  }
+  if(padded) i_h_last_ = concatenate_to_batch(lasts);
 
   // Create an identity with shape
   if(hidden_size_) {
@@ -262,6 +289,39 @@ void ExternAttentional::InitializeSentence(
     i_lexicon_ = input(cg, Dim({(unsigned int)lex_size_, (unsigned int)sent_len_}, (unsigned int)sent_src.size()), lex_ids, lex_data, lex_alpha_);
   }
 
+  // Remember the values in case sentences are selected later
+  src_lens_.resize(sent_src.size());
+  for(size_t j = 0; j < sent_src.size(); ++j)
+    src_lens_[j] = sent_src[j].size();
+  curr_lens_ = src_lens_;
+  i_h_all_ = i_h_;
+  i_ehid_hpart_all_ = i_ehid_hpart_;
+  i_lexicon_all_ = i_lexicon_;
+  i_src_mask_ = Expression();
+
+}
+
+void ExternAttentional::SelectSentences(const std::vector<unsigned> & ids, ComputationGraph & cg) {
+  // A single sentence is simply broadcast over the batch
+  if(src_lens_.size() == 1) return;
+  i_h_ = pick_batch_elems(i_h_all_, ids);
+  i_ehid_hpart_ = pick_batch_elems(i_ehid_hpart_all_, ids);
+  if(i_lexicon_all_.pg != nullptr)
+    i_lexicon_ = pick_batch_elems(i_lexicon_all_, ids);
+  curr_lens_.resize(ids.size());
+  for(size_t i = 0; i < ids.size(); ++i)
+    curr_lens_[i] = src_lens_[ids[i]];
+  // Mask out the padding after the end of each sentence so shorter sentences
+  // attend to the same positions they would if decoded on their own
+  vector<float> mask(ids.size() * sent_len_, 0.f);
+  bool has_mask = false;
+  for(size_t i = 0; i < ids.size(); ++i) {
+    for(int j = src_lens_[ids[i]] + 1; j < sent_len_; ++j) {
+      mask[i * sent_len_ + j] = -FLT_MAX;
+      has_mask = true;
+    }
+  }
+  i_src_mask_ = (has_mask ? input(cg, Dim({(unsigned int)sent_len_}, (unsigned int)ids.size()), mask) : Expression());
 }
 
 Expression ExternAttentional::GetEmptyContext(ComputationGraph & cg) const {
@@ -270,6 +330,7 @@ Expression ExternAttentional::GetEmptyContext(ComputationGraph & cg) const {
 
 // Create a variable encoding the context
 Expression ExternAttentional::CreateContext(
+    int loc,
     const std::vector<Expression> & state_in,
     const Expression & align_sum_in,
     bool train,
@@ -278,47 +339,103 @@ Expression ExternAttentional::CreateContext(
     Expression & align_sum_out) const {
   if(&cg != curr_graph_)
     THROW_ERROR("Initialized computation graph and passed comptuation graph don't match."); 
+  // Local attention only looks at the source positions within window_ of the
+  // target position, clipped to the end of each sentence. The batch scores
+  // the positions of all the windows together, and masks out those that are
+  // outside of each element's own window, which also covers the padding.
+  Expression i_h = i_h_, i_ehid_hpart = i_ehid_hpart_, i_sent_len = i_sent_len_, i_src_mask = i_src_mask_, i_align_sum = align_sum_in;
+  int win_start = 0, win_end = sent_len_;
+  if(window_ > 0) {
+    vector<int> starts(curr_lens_.size()), ends(curr_lens_.size());
+    win_start = sent_len_; win_end = 0;
+    for(size_t b = 0; b < curr_lens_.size(); ++b) {
+      int center = min(loc, curr_lens_[b]);
+      starts[b] = max(0, center - window_);
+      ends[b] = min(min(sent_len_, curr_lens_[b] + 1), center + window_ + 1);
+      win_start = min(win_start, starts[b]);
+      win_end = max(win_end, ends[b]);
+    }
+    int win_len = win_end - win_start;
+    vector<float> mask(curr_lens_.size() * win_len, 0.f);
+    bool has_mask = false;
+    for(size_t b = 0; b < curr_lens_.size(); ++b) {
+      for(int j = win_start; j < win_end; ++j) {
+        if(j < starts[b] || j >= ends[b]) {
+          mask[b * win_len + j - win_start] = -FLT_MAX;
+          has_mask = true;
+        }
+      }
+    }
+    i_src_mask = (has_mask ? input(cg, Dim({(unsigned int)win_len}, (unsigned int)curr_lens_.size()), mask) : Expression());
+    if(win_len < sent_len_) {
+      vector<unsigned> cols(win_len);
+      for(int j = win_start; j < win_end; j++) cols[j - win_start] = j;
+      i_h = select_cols(i_h_, cols);
+      i_ehid_hpart = select_cols(i_ehid_hpart_, cols);
+      i_sent_len = input(cg, {1, (unsigned int)cols.size()}, vector<float>(cols.size(), 1.f));
+      if(i_align_sum.pg != nullptr) i_align_sum = pick_range(align_sum_in, win_start, win_end);
+    }
+  }
   Expression i_ehid, i_e;
   // MLP
   if(hidden_size_) {
-    if(state_in.size()) {
-      // i_ehid_state_W_ is {hidden_size, state_size}, state_in is {state_size, 1}
-      Expression i_ehid_spart = i_ehid_state_W_ * *state_in.rbegin();
-      i_ehid = affine_transform({i_ehid_hpart_, i_ehid_spart, i_sent_len_});
+    if(state_in.size() && !train && default_device->type == DeviceType::CPU) {
+      // When decoding, score all source positions for the whole batch of
+      // states in a single node that doesn't store the {hidden_size, sent_len}
+      // sum and tanh. The backward pass has to recalculate the tanh, which is
+      // slower than keeping it, so training uses the separate nodes.
+      i_e = mlp_attention_scores(i_ehid_hpart, i_ehid_state_W_ * *state_in.rbegin(), i_e_ehid_W_);
     } else {
-      i_ehid = i_ehid_hpart_;
+      if(state_in.size()) {
+        // i_ehid_state_W_ is {hidden_size, state_size}, state_in is {state_size, 1}
+        Expression i_ehid_spart = i_ehid_state_W_ * *state_in.rbegin();
+        i_ehid = affine_transform({i_ehid_hpart, i_ehid_spart, i_sent_len});
+      } else {
+        i_ehid = i_ehid_hpart;
+      }
+      // Run through nonlinearity
+      Expression i_ehid_out = tanh({i_ehid});
+      // i_e_ehid_W_ is {1, hidden_size}, i_ehid_out is {hidden_size, sent_len}
+      i_e = transpose(i_e_ehid_W_ * i_ehid_out);
     }
-    // Run through nonlinearity
-    Expression i_ehid_out = tanh({i_ehid});
-    // i_e_ehid_W_ is {1, hidden_size}, i_ehid_out is {hidden_size, sent_len}
-    i_e = transpose(i_e_ehid_W_ * i_ehid_out);
   // Bilinear/dot product
   } else {
     assert(state_in.size() > 0);
-    i_e = i_ehid_hpart_ * (*state_in.rbegin());
+    i_e = i_ehid_hpart * (*state_in.rbegin());
   }
+  if(i_src_mask.pg != nullptr)
+    i_e = i_e + i_src_mask;
   Expression i_alpha;
   // Calculate the softmax, adding the previous sum if necessary
-  if(align_sum_in.pg != nullptr) {
-    i_alpha = softmax(i_e + align_sum_in * i_align_sum_W_);
+  if(i_align_sum.pg != nullptr) {
+    i_alpha = softmax(i_e + i_align_sum * i_align_sum_W_);
     // // DEBUG
     // Tensor align_sum_tens = align_sum_in.value();
     // vector<float> align_sum_val = as_vector(align_sum_in.value());
   } else {
     i_alpha = softmax(i_e);
   }
+  // The alignments outside of the window are zero
+  Expression i_alpha_full = i_alpha;
+  if(win_end - win_start < sent_len_) {
+    vector<Expression> parts;
+    if(win_start > 0) parts.push_back(zeroes(cg, {(unsigned int)win_start}));
+    parts.push_back(i_alpha);
+    if(win_end < sent_len_) parts.push_back(zeroes(cg, {(unsigned int)(sent_len_ - win_end)}));
+    i_alpha_full = concatenate(parts);
+  }
   // Save the alignments and print if necessary
-  align_out.push_back(i_alpha);
+  align_out.push_back(i_alpha_full);
   if(GlobalVars::verbose >= 2) {
-    vector<float> softmax = as_vector(cg.incremental_forward(i_alpha));
+    vector<float> softmax = as_vector(cg.incremental_forward(i_alpha_full));
     cerr << "Alignments: " << softmax << endl;
   }
   // Update the sum if necessary
   if(attention_hist_ == "sum") {
-    align_sum_out = (align_sum_in.pg != nullptr ? align_sum_in + i_alpha : i_alpha);
+    align_sum_out = (align_sum_in.pg != nullptr ? align_sum_in + i_alpha_full : i_alpha_full);
   }
-  // i_h_ is {input_size, sent_len}, i_alpha is {sent_len, 1}
-  return i_h_ * i_alpha; 
+  // i_h is {input_size, sent_len}, i_alpha is {sent_len, 1}
+  return i_h * i_alpha; 
 }
 
 EncoderAttentional::EncoderAttentional(
@@ -37,9 +37,12 @@ public:
     virtual void InitializeSentence(const Sentence & sent, bool train, dynet::ComputationGraph & cg) override;
     virtual void InitializeSentence(const std::vector<Sentence> & sent, bool train, dynet::ComputationGraph & cg) override;
 
-    // Create a variable encoding the context
+    // Select which of the initialized sentences each batch element attends to
+    virtual void SelectSentences(const std::vector<unsigned> & ids, dynet::ComputationGraph & cg) override;
+
+    // Create a variable encoding the context when predicting the target word at loc
     virtual dynet::Expression CreateContext(
-        // const Sentence & sent, int loc,
+        int loc,
         const std::vector<dynet::Expression> & state_in,
         const dynet::Expression & align_sum_in,
         bool train,
@@ -55,10 +58,12 @@ public:
     virtual dynet::Expression GetEmptyContext(dynet::ComputationGraph & cg) const override;
 
     int GetHiddenSize() const { return hidden_size_; }
+    int GetWindow() const { return window_; }
     int GetStateSize() const { return state_size_; }
     int GetContextSize() const { return context_size_; }
 
     dynet::Expression GetState() { return i_h_last_; }
+    const MultipleIdMappingPtr & GetLexMapping() const { return lex_mapping_; }
 
     // Reading/writing functions
     static ExternAttentional* Read(std::istream & in, const DictPtr & vocab_src, const DictPtr & vocab_trg, dynet::ParameterCollection & model);
@@ -73,6 +78,8 @@ protected:
     std::vector<LinearEncoderPtr> encoders_;
     std::string attention_type_, attention_hist_;
     int hidden_size_, state_size_;
+    // The number of positions on each side that local attention looks at, or zero
+    int window_;
 
     // Lexical type
     std::string lex_type_, lex_file_;
@@ -98,6 +105,12 @@ protected:
     dynet::Expression i_ehid_hpart_;
     dynet::Expression i_sent_len_;
     dynet::Expression i_lexicon_;
+    dynet::Expression i_src_mask_;
+
+    // The values for all initialized sentences, before selection
+    dynet::Expression i_h_all_;
+    dynet::Expression i_ehid_hpart_all_;
+    dynet::Expression i_lexicon_all_;
 
 private:
     // A pointer to the current computation graph.
@@ -109,6 +122,9 @@ private:
     std::vector<dynet::real> sent_values_;
 
     int sent_len_;
+    std::vector<int> src_lens_;
+    // The source length of each batch element after selection
+    std::vector<int> curr_lens_;
 
 };
 
@@ -1,8 +1,12 @@
 #include <lamtram/ensemble-decoder.h>
 #include <lamtram/macros.h>
 #include <dynet/nodes.h>
+#include <dynet/globals.h>
 #include <boost/range/irange.hpp>
 #include <cfloat>
+#include <algorithm>
+#include <map>
+#include <random>
 
 using namespace lamtram;
 using namespace std;
@@ -10,7 +14,9 @@ using namespace dynet;
 
 
 EnsembleDecoder::EnsembleDecoder(const vector<EncoderDecoderPtr> & encdecs, const vector<EncoderAttentionalPtr> & encatts, const vector<NeuralLMPtr> & lms)
-      : encdecs_(encdecs), encatts_(encatts), word_pen_(0.f), unk_pen_(1.f), size_limit_(2000), beam_size_(1), ensemble_operation_("sum") {
+      : encdecs_(encdecs), encatts_(encatts), word_pen_(0.f), unk_pen_(1.f), size_limit_(2000), beam_size_(1),
+        prune_abs_(0.f), prune_rel_(0.f), max_cands_per_parent_(0), size_ratio_(0.f), size_const_(0),
+        shortlist_lex_(0), shortlist_freq_(0), ensemble_operation_("sum") {
   if(encdecs.size() + encatts.size() + lms.size() == 0)
     THROW_ERROR("Cannot decode with no models!");
   for(auto & ed : encdecs) {
@@ -29,7 +35,8 @@ EnsembleDecoder::EnsembleDecoder(const vector<EncoderDecoderPtr> & encdecs, cons
   unk_log_prob_ = -log(lms_[0]->GetVocabSize());
 }
 
-vector<vector<Expression> > EnsembleDecoder::GetInitialStates(const Sentence & sent_src, ComputationGraph & cg) {
+template <class SentData>
+vector<vector<Expression> > EnsembleDecoder::GetInitialStates(const SentData & sent_src, ComputationGraph & cg) {
   vector<vector<Expression> > last_state(encdecs_.size() + encatts_.size() + lms_.size());
   int id = 0;
   for(auto & tm : encdecs_)
@@ -39,6 +46,11 @@ vector<vector<Expression> > EnsembleDecoder::GetInitialStates(const Sentence & s
   return last_state;
 }
 
+template
+vector<vector<Expression> > EnsembleDecoder::GetInitialStates<Sentence>(const Sentence & sent_src, ComputationGraph & cg);
+template
+vector<vector<Expression> > EnsembleDecoder::GetInitialStates<vector<Sentence> >(const vector<Sentence> & sent_src, ComputationGraph & cg);
+
 Expression EnsembleDecoder::EnsembleProbs(const std::vector<Expression> & in, ComputationGraph & cg) {
   if(in.size() == 1) return in[0];
   return average(in);
@@ -211,12 +223,326 @@ void EnsembleDecoder::CalcSentLL<Sentence,LLStats,vector<float> >(const Sentence
 template
 void EnsembleDecoder::CalcSentLL<vector<Sentence>,vector<LLStats>,vector<vector<float> > >(const Sentence & sent_src, const vector<Sentence> & sent_trg, vector<LLStats> & ll, vector<vector<float> > & wordll);
 
+void EnsembleDecoder::CalcNbestLL(const vector<Sentence> & sents_src, const vector<Sentence> & sents_trg, const vector<unsigned> & src_ids, int max_words, vector<LLStats> & ll, vector<vector<float> > & wordll) {
+  assert(sents_trg.size() == src_ids.size());
+  assert(sents_trg.size() == ll.size());
+  assert(sents_trg.size() == wordll.size());
+  // First initialize states and encode all of the sources
+  ComputationGraph cg;
+  for(auto & tm : encdecs_) tm->NewGraph(cg);
+  for(auto & tm : encatts_) tm->NewGraph(cg);
+  for(auto & lm : lms_) lm->NewGraph(cg);
+  int num_srcs = sents_src.size();
+  vector<vector<Expression> > init_state = (num_srcs == 1 ?
+                                            GetInitialStates(sents_src[0], cg) :
+                                            GetInitialStates(sents_src, cg));
+  // Calculate the encodings now, so they are kept when each chunk is reverted below
+  for(auto & states : init_state)
+    for(auto & state : states)
+      cg.incremental_forward(state);
+  // Score the targets in chunks
+  for(size_t start = 0, end; start < sents_trg.size(); start = end) {
+    int chunk_words = sents_trg[start].size();
+    for(end = start + 1; end < sents_trg.size() && chunk_words + (int)sents_trg[end].size() <= max_words; ++end)
+      chunk_words += sents_trg[end].size();
+    vector<Sentence> chunk_trg(sents_trg.begin() + start, sents_trg.begin() + end);
+    vector<unsigned> chunk_ids(src_ids.begin() + start, src_ids.begin() + end);
+    cg.checkpoint();
+    for(auto & lm : lms_) lm->NewGraph(cg);
+    for(auto & ext : externs_)
+      if(ext.get() != nullptr)
+        ext->SelectSentences(chunk_ids, cg);
+    vector<vector<Expression> > last_state(init_state.size()), next_state(lms_.size());
+    for(size_t j = 0; j < init_state.size(); j++)
+      for(auto & state : init_state[j])
+        last_state[j].push_back(num_srcs == 1 ? state : pick_batch_elems(state, chunk_ids));
+    vector<Expression> last_extern(lms_.size()), next_extern(lms_.size()), align_sums(lms_.size());
+    // Go through and collect the values
+    vector<Expression> errs, aligns;
+    int max_len = MaxLen(chunk_trg);
+    for(int t : boost::irange(0, max_len)) {
+      // The first sentence of the chunk isn't always the longest
+      if(t < (int)chunk_trg[0].size())
+        GlobalVars::curr_word = GetWord(chunk_trg, t);
+      // Perform the forward step on all models
+      vector<Expression> i_sms;
+      for(int j : boost::irange(0, (int)lms_.size()))
+        i_sms.push_back(lms_[j]->Forward(chunk_trg, t, externs_[j].get(), ensemble_operation_ == "logsum", last_state[j], last_extern[j], align_sums[j], next_state[j], next_extern[j], align_sums[j], cg, aligns));
+      // Ensemble the probabilities and calculate the likelihood
+      Expression i_logprob;
+      if(ensemble_operation_ == "sum") {
+        i_logprob = EnsembleSingleProb(i_sms, chunk_trg, t, cg);
+        i_logprob = log({i_logprob});
+      } else if(ensemble_operation_ == "logsum") {
+        i_logprob = EnsembleSingleLogProb(i_sms, chunk_trg, t, cg);
+      } else {
+        THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+      }
+      errs.push_back(i_logprob);
+      last_state = next_state;
+      last_extern = next_extern;
+    }
+    Expression err = sum(errs);
+    cg.incremental_forward(err);
+    vector<LLStats> chunk_ll(ll.begin() + start, ll.begin() + end);
+    vector<vector<float> > chunk_wordll(end - start);
+    AddLik(chunk_trg, err, errs, chunk_ll, chunk_wordll);
+    for(size_t i = start; i < end; i++) {
+      ll[i] = chunk_ll[i - start];
+      wordll[i].insert(wordll[i].end(), chunk_wordll[i - start].begin(), chunk_wordll[i - start].end());
+    }
+    cg.revert();
+  }
+}
+
+// A prefix of the target sentences in a trie, which points back to the prefix it extends
+struct TrieNode {
+  TrieNode(int parent, WordId word, int sent) : parent(parent), word(word), sent(sent), has_children(false) { }
+  int parent;
+  WordId word;
+  // A sentence that starts with this prefix, which provides the history for the models
+  int sent;
+  bool has_children;
+};
+
+void EnsembleDecoder::CalcTrieLL(const Sentence & sent_src, const vector<Sentence> & sents_trg, vector<LLStats> & ll, vector<vector<float> > & wordll) {
+  assert(sents_trg.size() == ll.size());
+  assert(sents_trg.size() == wordll.size());
+  // Build the trie, keeping the nodes of each length together
+  vector<TrieNode> nodes(1, TrieNode(-1, -1, 0));
+  vector<vector<int> > levels(1, vector<int>(1, 0));
+  map<pair<int,WordId>,int> children;
+  vector<vector<int> > sent_nodes(sents_trg.size());
+  for(size_t i = 0; i < sents_trg.size(); i++) {
+    int node = 0;
+    for(size_t t = 0; t < sents_trg[i].size(); t++) {
+      nodes[node].has_children = true;
+      auto it = children.find(make_pair(node, sents_trg[i][t]));
+      if(it == children.end()) {
+        it = children.insert(make_pair(make_pair(node, sents_trg[i][t]), (int)nodes.size())).first;
+        nodes.push_back(TrieNode(node, sents_trg[i][t], i));
+        if(levels.size() <= t+1) levels.resize(t+2);
+        levels[t+1].push_back(it->second);
+      }
+      node = it->second;
+      sent_nodes[i].push_back(node);
+    }
+  }
+  // Initialize states and do encoding as necessary
+  ComputationGraph cg;
+  for(auto & tm : encdecs_) tm->NewGraph(cg);
+  for(auto & tm : encatts_) tm->NewGraph(cg);
+  for(auto & lm : lms_) lm->NewGraph(cg);
+  vector<vector<Expression> > last_state = GetInitialStates(sent_src, cg), next_state(lms_.size());
+  vector<Expression> last_extern(lms_.size()), next_extern(lms_.size()), last_sum(lms_.size()), next_sum(lms_.size());
+  // Expand all prefixes of the same length as a single batch
+  vector<unsigned> batch_pos(nodes.size()), parent_pos, edge_pos, edge_words;
+  vector<Expression> level_lls, aligns;
+  vector<Sentence> sents;
+  for(size_t t = 0; t + 1 < levels.size(); t++) {
+    sents.resize(0); parent_pos.resize(0);
+    unsigned batch_size = 0;
+    for(int node : levels[t]) {
+      if(!nodes[node].has_children) continue;
+      batch_pos[node] = batch_size++;
+      sents.push_back(sents_trg[nodes[node].sent]);
+      if(t > 0) parent_pos.push_back(batch_pos[nodes[node].parent]);
+    }
+    // Each prefix continues from the state of the prefix it extends
+    if(t > 0) {
+      for(size_t j = 0; j < lms_.size(); j++) {
+        last_state[j].resize(next_state[j].size());
+        for(size_t k = 0; k < next_state[j].size(); k++)
+          last_state[j][k] = pick_batch_elems(next_state[j][k], parent_pos);
+        last_extern[j] = (next_extern[j].pg != nullptr ? pick_batch_elems(next_extern[j], parent_pos) : Expression());
+        last_sum[j] = (next_sum[j].pg != nullptr ? pick_batch_elems(next_sum[j], parent_pos) : Expression());
+      }
+    }
+    vector<Expression> i_sms;
+    for(int j : boost::irange(0, (int)lms_.size()))
+      i_sms.push_back(lms_[j]->Forward(sents, t, externs_[j].get(), ensemble_operation_ == "logsum", last_state[j], last_extern[j], last_sum[j], next_state[j], next_extern[j], next_sum[j], cg, aligns));
+    // Pick the likelihood of each word that extends a prefix
+    edge_pos.resize(0); edge_words.resize(0);
+    for(int node : levels[t+1]) {
+      edge_pos.push_back(batch_pos[nodes[node].parent]);
+      edge_words.push_back(nodes[node].word);
+    }
+    if(ensemble_operation_ == "sum") {
+      vector<Expression> i_probs(i_sms.size());
+      for(size_t j = 0; j < i_sms.size(); j++)
+        i_probs[j] = pick(pick_batch_elems(i_sms[j], edge_pos), edge_words);
+      level_lls.push_back(log(i_probs.size() == 1 ? i_probs[0] : average(i_probs)));
+    } else if(ensemble_operation_ == "logsum") {
+      level_lls.push_back(pick(pick_batch_elems(EnsembleLogProbs(i_sms, cg), edge_pos), edge_words));
+    } else {
+      THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+    }
+  }
+  if(level_lls.size() == 0) return;
+  cg.incremental_forward(level_lls.back());
+  // Every sentence adds up the likelihoods along its path
+  vector<float> node_lls(nodes.size());
+  for(size_t t = 0; t < level_lls.size(); t++) {
+    vector<float> lls = as_vector(level_lls[t].value());
+    for(size_t e = 0; e < lls.size(); e++)
+      node_lls[levels[t+1][e]] = lls[e];
+  }
+  for(size_t i = 0; i < sents_trg.size(); i++) {
+    for(size_t t = 0; t < sents_trg[i].size(); t++) {
+      ll[i].loss_ -= node_lls[sent_nodes[i][t]];
+      if(sents_trg[i][t] == unk_id_)
+        ++ll[i].unk_;
+      wordll[i].push_back(node_lls[sent_nodes[i][t]]);
+    }
+    ll[i].words_ += sents_trg[i].size();
+  }
+}
+
 EnsembleDecoderHypPtr EnsembleDecoder::Generate(const Sentence & sent_src) {
   auto nbest = GenerateNbest(sent_src, 1);
   return (nbest.size() > 0 ? nbest[0] : EnsembleDecoderHypPtr());
 }
 
+// Pack the states of several hypotheses into a single batched expression
+inline Expression BatchExprs(const vector<Expression> & exprs) {
+  if(exprs.size() == 0 || exprs[0].pg == nullptr) return Expression();
+  return (exprs.size() == 1 ? exprs[0] : concatenate_to_batch(exprs));
+}
+
+// Pick a single hypothesis' expression out of a batched expression
+inline Expression UnbatchExpr(const Expression & expr, int batch_size, int id) {
+  if(expr.pg == nullptr || batch_size == 1) return expr;
+  return pick_batch_elem(expr, id);
+}
+
+// Order candidates by score, breaking ties in favor of earlier hypotheses and words
+typedef tuple<float,int,int,int> BeamCandidate;
+struct BetterCandidate {
+  inline bool operator() (const BeamCandidate & lhs, const BeamCandidate & rhs) const {
+    if(std::get<0>(lhs) != std::get<0>(rhs)) return std::get<0>(lhs) > std::get<0>(rhs);
+    if(std::get<1>(lhs) != std::get<1>(rhs)) return std::get<1>(lhs) < std::get<1>(rhs);
+    return std::get<2>(lhs) < std::get<2>(rhs);
+  }
+};
+struct BetterWord {
+  inline bool operator() (const pair<float,int> & lhs, const pair<float,int> & rhs) const {
+    return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+  }
+};
+
+// Find the k best words in a single pass over the vocabulary, adding the word
+// penalty as we go. The current k best are kept in a heap with the worst at
+// the front, so most words only cost a single comparison.
+inline void FindTopK(const float* scores, int vocab_size, int k, float word_pen, vector<pair<float,int> > & heap) {
+  heap.clear();
+  heap.push_back(make_pair(scores[0], 0));
+  for(int wid = 1; wid < vocab_size; wid++) {
+    float score = scores[wid] + word_pen;
+    if((int)heap.size() < k) {
+      heap.push_back(make_pair(score, wid));
+      push_heap(heap.begin(), heap.end(), BetterWord());
+    } else if(score > heap.front().first) {
+      pop_heap(heap.begin(), heap.end(), BetterWord());
+      heap.back() = make_pair(score, wid);
+      push_heap(heap.begin(), heap.end(), BetterWord());
+    }
+  }
+}
+
 std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbest(const Sentence & sent_src, int nbest_size) {
+  return GenerateNbest(vector<Sentence>(1, sent_src), nbest_size)[0];
+}
+
+// Add the best lex_size translations of each source word in the mapping
+inline void AddLexCandidates(const MultipleIdMapping & mapping, const vector<Sentence> & sents_src, int lex_size, vector<unsigned> & words) {
+  vector<pair<WordId,float> > cands;
+  for(auto & sent_src : sents_src) {
+    for(WordId src : sent_src) {
+      auto it = mapping.find(src);
+      if(it == mapping.end()) continue;
+      cands = it->second;
+      int num = min(lex_size, (int)cands.size());
+      partial_sort(cands.begin(), cands.begin() + num, cands.end(),
+                   [](const pair<WordId,float> & a, const pair<WordId,float> & b) { return a.second > b.second; });
+      for(int i = 0; i < num; i++)
+        words.push_back(cands[i].first);
+    }
+  }
+}
+
+bool EnsembleDecoder::CreateShortlist(const vector<Sentence> & sents_src, vector<unsigned> & shortlist) {
+  // The most frequent words do not depend on the sentence, so only find them once
+  if(freq_words_.size() == 0 && shortlist_freq_ > 0)
+    for(auto & lm : lms_)
+      lm->GetSoftmax().GetFrequentWords(shortlist_freq_, freq_words_);
+  // Sentence end is always included, and comes first after sorting as the search expects
+  shortlist = freq_words_;
+  shortlist.push_back(0);
+  if(unk_id_ >= 0) shortlist.push_back(unk_id_);
+  if(shortlist_lex_ > 0) {
+    for(auto & encatt : encatts_)
+      if(encatt->GetExternAttentionalPtr()->GetLexMapping().get() != nullptr)
+        AddLexCandidates(*encatt->GetExternAttentionalPtr()->GetLexMapping(), sents_src, shortlist_lex_, shortlist);
+    if(shortlist_mapping_.get() != nullptr)
+      AddLexCandidates(*shortlist_mapping_, sents_src, shortlist_lex_, shortlist);
+  }
+  sort(shortlist.begin(), shortlist.end());
+  shortlist.erase(unique(shortlist.begin(), shortlist.end()), shortlist.end());
+  for(auto & lm : lms_) {
+    if(!lm->GetSoftmax().SetShortlist(shortlist)) {
+      for(auto & lm2 : lms_) lm2->GetSoftmax().SetShortlist(vector<unsigned>());
+      shortlist.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+// A node in the search graph, which only points back to the hypothesis it
+// extends. Full sentences are only built for finished hypotheses.
+struct BeamNode {
+  BeamNode(int parent, WordId word, WordId align, float score) : parent(parent), word(word), align(align), score(score) { }
+  int parent;
+  WordId word, align;
+  float score;
+};
+
+// The decoder states after one step, shared by all hypotheses that extend the same parent
+struct BeamState {
+  vector<vector<Expression> > states;
+  vector<Expression> externs, sums;
+};
+typedef shared_ptr<BeamState> BeamStatePtr;
+
+// A hypothesis that is still on the beam
+struct BeamHyp {
+  BeamHyp(int node, const BeamStatePtr & state) : node(node), state(state) { }
+  int node;
+  BeamStatePtr state;
+};
+
+// Write the last words of a hypothesis into the end of sent, which is
+// sent_len words long. Only the words within the history are needed to
+// expand a hypothesis, so the rest are not filled in.
+inline void FillHistory(const vector<BeamNode> & nodes, int node, int history, int sent_len, Sentence & sent) {
+  sent.resize(sent_len);
+  for(int t = sent_len-1; t >= max(0, sent_len-history); t--, node = nodes[node].parent)
+    sent[t] = nodes[node].word;
+}
+
+// Follow the back-pointers to create the full sentence and alignment
+inline EnsembleDecoderHypPtr MaterializeHyp(const vector<BeamNode> & nodes, int node, int num_models) {
+  Sentence sent, align;
+  for(int n = node; nodes[n].parent >= 0; n = nodes[n].parent) {
+    sent.push_back(nodes[n].word);
+    align.push_back(nodes[n].align);
+  }
+  reverse(sent.begin(), sent.end());
+  reverse(align.begin(), align.end());
+  return EnsembleDecoderHypPtr(new EnsembleDecoderHyp(nodes[node].score, vector<vector<Expression> >(num_models), vector<Expression>(num_models), vector<Expression>(num_models), sent, align));
+}
+
+std::vector<std::vector<EnsembleDecoderHypPtr> > EnsembleDecoder::GenerateNbest(const std::vector<Sentence> & sents_src, int nbest_size) {
 
   // First initialize states
   ComputationGraph cg;
@@ -224,96 +550,302 @@ std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbest(const Sentence
   for(auto & tm : encatts_) tm->NewGraph(cg);
   for(auto & lm : lms_) lm->NewGraph(cg);
 
-  // The n-best hypotheses
-  vector<EnsembleDecoderHypPtr> nbest;
+  // The n-best hypotheses for each sentence
+  int num_sents = sents_src.size();
+  vector<vector<EnsembleDecoderHypPtr> > nbests(num_sents);
 
-  // Create the initial hypothesis
-  vector<vector<vector<Expression> > > last_states(beam_size_, vector<vector<Expression> >(lms_.size()));
-  vector<vector<Expression> > last_externs(beam_size_, vector<Expression>(lms_.size()));
-  vector<vector<Expression> > last_sums(beam_size_, vector<Expression>(lms_.size()));
-  vector<EnsembleDecoderHypPtr> curr_beam(1, 
-      EnsembleDecoderHypPtr(new EnsembleDecoderHyp(
-          0.0, GetInitialStates(sent_src, cg), last_externs[0], last_sums[0], Sentence(), Sentence())));
-  int bid;
-  Expression empty_idx;
+  // Encode all the sentences together, and create the initial hypotheses
+  vector<vector<Expression> > init_states = (num_sents == 1 ?
+                                             GetInitialStates(sents_src[0], cg) :
+                                             GetInitialStates(sents_src, cg));
+  vector<BeamNode> nodes;
+  vector<vector<BeamHyp> > curr_beams(num_sents);
+  for(int s = 0; s < num_sents; s++) {
+    BeamStatePtr state(new BeamState);
+    state->states.resize(init_states.size());
+    for(size_t j = 0; j < init_states.size(); j++)
+      for(auto & init_state : init_states[j])
+        state->states[j].push_back(UnbatchExpr(init_state, num_sents, s));
+    state->externs.resize(lms_.size());
+    state->sums.resize(lms_.size());
+    curr_beams[s].push_back(BeamHyp(nodes.size(), state));
+    nodes.push_back(BeamNode(-1, -1, -1, 0.f));
+  }
+  // Find the length limit for each sentence
+  vector<int> size_limits(num_sents, size_limit_);
+  if(size_ratio_ != 0.f && encdecs_.size() + encatts_.size() > 0)
+    for(int s = 0; s < num_sents; s++)
+      size_limits[s] = max(0, min(size_limit_, (int)(size_ratio_ * sents_src[s].size()) + size_const_));
+  int max_size_limit = *max_element(size_limits.begin(), size_limits.end());
+  // Only score the candidate words for these sentences if using a shortlist
+  vector<unsigned> shortlist;
+  if(shortlist_lex_ > 0 || shortlist_freq_ > 0)
+    CreateShortlist(sents_src, shortlist);
+  int vocab_size = (shortlist.size() ? shortlist.size() : lms_[0]->GetVocabSize());
+  int unk_pos = unk_id_;
+  if(shortlist.size() && unk_id_ >= 0)
+    unk_pos = lower_bound(shortlist.begin(), shortlist.end(), (unsigned)unk_id_) - shortlist.begin();
+  int num_cands = (max_cands_per_parent_ > 0 ? min(beam_size_, max_cands_per_parent_) : beam_size_);
+  int history = 0;
+  for(auto & lm : lms_)
+    history = max(history, lm->GetHistoryLength());
+  vector<pair<float,int> > top_words;
+  vector<Sentence> sents;
 
   // Perform decoding
-  for(int sent_len = 0; sent_len <= size_limit_; sent_len++) {
-    // This vector will hold the best IDs
-    vector<tuple<float,int,int,int> > next_beam_id(beam_size_+1, tuple<float,int,int,int>(-DBL_MAX,-1,-1,-1));
-    // Go through all the hypothesis IDs
-    for(int hypid = 0; hypid < (int)curr_beam.size(); hypid++) {
-      EnsembleDecoderHypPtr curr_hyp = curr_beam[hypid];
-      const Sentence & sent = curr_beam[hypid]->GetSentence();
-      if(sent_len != 0 && *sent.rbegin() == 0) continue;
-      // Perform the forward step on all models
-      vector<Expression> i_softmaxes, i_aligns;
-      for(int j : boost::irange(0, (int)lms_.size()))
-        i_softmaxes.push_back( lms_[j]->Forward(sent, sent_len, externs_[j].get(), ensemble_operation_ == "logsum", curr_hyp->GetStates()[j], curr_hyp->GetExterns()[j], curr_hyp->GetSums()[j], last_states[hypid][j], last_externs[hypid][j], last_sums[hypid][j], cg, i_aligns) );
-      // Ensemble and calculate the likelihood
-      Expression i_softmax, i_logprob;
-      if(ensemble_operation_ == "sum") {
-        i_softmax = EnsembleProbs(i_softmaxes, cg);
-        i_logprob = log({i_softmax});
-      } else if(ensemble_operation_ == "logsum") {
-        i_logprob = EnsembleLogProbs(i_softmaxes, cg);
-      } else {
-        THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+  for(int sent_len = 0; sent_len <= max_size_limit; sent_len++) {
+    // Find all the hypotheses that have not finished yet, these will be
+    // expanded together as a single batch over all sentences
+    vector<pair<int,int> > live_ids;
+    vector<unsigned> live_srcs;
+    for(int s = 0; s < num_sents; s++) {
+      for(int hypid = 0; hypid < (int)curr_beams[s].size(); hypid++) {
+        if(sent_len == 0 || nodes[curr_beams[s][hypid].node].word != 0) {
+          live_ids.push_back(make_pair(s, hypid));
+          live_srcs.push_back(s);
+        }
       }
-      // Add the word/unk penalty
-      vector<float> softmax = as_vector(cg.incremental_forward(i_logprob));
-      if(word_pen_ != 0.f) {
-        for(size_t i = 1; i < softmax.size(); i++)
-          softmax[i] += word_pen_;
+    }
+    if(live_ids.size() == 0)
+      return nbests;
+    int batch_size = live_ids.size();
+    vector<BeamHyp*> live_hyps(batch_size);
+    sents.resize(batch_size);
+    for(int b = 0; b < batch_size; b++) {
+      live_hyps[b] = &curr_beams[live_ids[b].first][live_ids[b].second];
+      FillHistory(nodes, live_hyps[b]->node, history, sent_len, sents[b]);
+    }
+    // Let the attention know which sentence each hypothesis belongs to
+    for(auto & ext : externs_)
+      if(ext.get() != nullptr)
+        ext->SelectSentences(live_srcs, cg);
+    // Perform the forward step on all models
+    vector<vector<Expression> > next_states(lms_.size());
+    vector<Expression> next_externs(lms_.size()), next_sums(lms_.size());
+    vector<Expression> i_softmaxes, i_aligns;
+    for(int j : boost::irange(0, (int)lms_.size())) {
+      vector<Expression> batch_state(live_hyps[0]->state->states[j].size()), exprs(batch_size);
+      for(size_t k = 0; k < batch_state.size(); k++) {
+        for(int b = 0; b < batch_size; b++)
+          exprs[b] = live_hyps[b]->state->states[j][k];
+        batch_state[k] = BatchExprs(exprs);
       }
-      if(unk_id_ >= 0) softmax[unk_id_] += unk_pen_ * unk_log_prob_;
+      for(int b = 0; b < batch_size; b++)
+        exprs[b] = live_hyps[b]->state->externs[j];
+      Expression batch_extern = BatchExprs(exprs);
+      for(int b = 0; b < batch_size; b++)
+        exprs[b] = live_hyps[b]->state->sums[j];
+      Expression batch_sum = BatchExprs(exprs);
+      i_softmaxes.push_back( lms_[j]->Forward(sents, sent_len, externs_[j].get(), ensemble_operation_ == "logsum", batch_state, batch_extern, batch_sum, next_states[j], next_externs[j], next_sums[j], cg, i_aligns) );
+    }
+    // Ensemble and calculate the likelihood
+    Expression i_softmax, i_logprob;
+    if(ensemble_operation_ == "sum") {
+      i_softmax = EnsembleProbs(i_softmaxes, cg);
+      i_logprob = log({i_softmax});
+    } else if(ensemble_operation_ == "logsum") {
+      i_logprob = EnsembleLogProbs(i_softmaxes, cg);
+    } else {
+      THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+    }
+    // Stack the alignments under the probabilities so we only need to
+    // move a single tensor from the device for the whole beam
+    Expression i_result = i_logprob;
+    if(i_aligns.size() != 0)
+      i_result = concatenate({i_logprob, sum(i_aligns)});
+    vector<float> result = as_vector(cg.incremental_forward(i_result));
+    int result_size = result.size() / batch_size;
+    int align_size = result_size - vocab_size;
+    // These vectors will hold the candidates for each sentence
+    vector<vector<BeamCandidate> > next_beam_ids(num_sents);
+    for(int b = 0; b < batch_size; b++) {
+      float* softmax = &result[b * result_size];
+      float curr_score = nodes[live_hyps[b]->node].score;
+      // Add the unk penalty, the word penalty is added while finding the best words
+      if(unk_id_ >= 0) softmax[unk_pos] += unk_pen_ * unk_log_prob_;
       // Find the best aligned source, if any alignments exists
       WordId best_align = -1;
-      if(i_aligns.size() != 0) {
-        Expression ens_align = sum(i_aligns);
-        vector<float> align = as_vector(cg.incremental_forward(ens_align));
+      if(align_size > 0) {
+        float* align = softmax + vocab_size;
         best_align = 0;
-        for(size_t aid = 0; aid < align.size(); aid++)
+        for(int aid = 0; aid < align_size; aid++)
           if(align[aid] > align[best_align])
             best_align = aid;
       }
-      // Find the best IDs
-      for(int wid = 0; wid < (int)softmax.size(); wid++) {
-        float my_score = curr_hyp->GetScore() + softmax[wid];
-        for(bid = beam_size_; bid > 0 && my_score > std::get<0>(next_beam_id[bid-1]); bid--)
-          next_beam_id[bid] = next_beam_id[bid-1];
-        next_beam_id[bid] = tuple<float,int,int,int>(my_score,hypid,wid,best_align);
+      // Find the best IDs for this hypothesis, only these can make it into the beam
+      FindTopK(softmax, vocab_size, num_cands, word_pen_, top_words);
+      vector<BeamCandidate> & next_beam_id = next_beam_ids[live_ids[b].first];
+      for(auto & word : top_words)
+        next_beam_id.push_back(BeamCandidate(curr_score + word.first, b, (shortlist.size() ? shortlist[word.second] : word.second), best_align));
+    }
+    for(auto & next_beam_id : next_beam_ids) {
+      if((int)next_beam_id.size() > beam_size_) {
+        partial_sort(next_beam_id.begin(), next_beam_id.begin() + beam_size_, next_beam_id.end(), BetterCandidate());
+        next_beam_id.resize(beam_size_);
+      } else {
+        sort(next_beam_id.begin(), next_beam_id.end(), BetterCandidate());
+      }
+      // Remove the candidates that are too far from the best one
+      if(next_beam_id.size() > 1 && (prune_abs_ > 0.f || prune_rel_ > 0.f)) {
+        float best_score = std::get<0>(next_beam_id[0]), thresh = -FLT_MAX;
+        if(prune_abs_ > 0.f) thresh = max(thresh, best_score - prune_abs_);
+        if(prune_rel_ > 0.f) thresh = max(thresh, best_score + log(prune_rel_));
+        size_t keep = 1;
+        while(keep < next_beam_id.size() && std::get<0>(next_beam_id[keep]) >= thresh) keep++;
+        next_beam_id.resize(keep);
       }
     }
-    // Create the new hypotheses
-    vector<EnsembleDecoderHypPtr> next_beam;
-    for(int i = 0; i < beam_size_; i++) {
-      float score = std::get<0>(next_beam_id[i]);
-      int hypid = std::get<1>(next_beam_id[i]);
-      int wid = std::get<2>(next_beam_id[i]);
-      int aid = std::get<3>(next_beam_id[i]);
-      // cerr << "Adding " << wid << " @ beam " << i << ": score=" << std::get<0>(next_beam_id[i]) - curr_beam[hypid]->GetScore() << endl;
-      if(hypid == -1) break;
-      Sentence next_sent = curr_beam[hypid]->GetSentence();
-      next_sent.push_back(wid);
-      Sentence next_align = curr_beam[hypid]->GetAlignment();
-      next_align.push_back(aid);
-      EnsembleDecoderHypPtr hyp(new EnsembleDecoderHyp(score, last_states[hypid], last_externs[hypid], last_sums[hypid], next_sent, next_align));
-      if(wid == 0 || sent_len == size_limit_) 
-        nbest.push_back(hyp);
-      next_beam.push_back(hyp);
+    // Split the batched states back into one set per expanded hypothesis
+    vector<BeamStatePtr> hyp_states(batch_size);
+    vector<vector<BeamHyp> > next_beams(num_sents);
+    for(int s = 0; s < num_sents; s++) {
+      const vector<BeamCandidate> & next_beam_id = next_beam_ids[s];
+      vector<EnsembleDecoderHypPtr> & nbest = nbests[s];
+      vector<BeamHyp> & next_beam = next_beams[s];
+      if(next_beam_id.size() == 0)
+        continue;
+      // Create the new hypotheses
+      for(size_t i = 0; i < next_beam_id.size(); i++) {
+        float score = std::get<0>(next_beam_id[i]);
+        int b = std::get<1>(next_beam_id[i]);
+        int wid = std::get<2>(next_beam_id[i]);
+        int aid = std::get<3>(next_beam_id[i]);
+        if(hyp_states[b].get() == nullptr) {
+          hyp_states[b].reset(new BeamState);
+          hyp_states[b]->states.resize(lms_.size());
+          hyp_states[b]->externs.resize(lms_.size());
+          hyp_states[b]->sums.resize(lms_.size());
+          for(int j : boost::irange(0, (int)lms_.size())) {
+            for(auto & state : next_states[j])
+              hyp_states[b]->states[j].push_back(UnbatchExpr(state, batch_size, b));
+            hyp_states[b]->externs[j] = UnbatchExpr(next_externs[j], batch_size, b);
+            hyp_states[b]->sums[j] = UnbatchExpr(next_sums[j], batch_size, b);
+          }
+        }
+        next_beam.push_back(BeamHyp(nodes.size(), hyp_states[b]));
+        nodes.push_back(BeamNode(live_hyps[b]->node, wid, aid, score));
+        if(wid == 0 || sent_len == size_limits[s]) 
+          nbest.push_back(MaterializeHyp(nodes, next_beam.back().node, lms_.size()));
+      }
+      // Check if we're done with search for this sentence, and if so drop it from the batch
+      if(nbest.size() != 0) {
+        sort(nbest.begin(), nbest.end());
+        if(nbest.size() > nbest_size)
+          nbest.resize(nbest_size);
+        if(nbest.size() == nbest_size && (next_beam.size() == 0 || (*nbest.rbegin())->GetScore() >= nodes[next_beam[0].node].score))
+          next_beam.clear();
+      }
+      if(sent_len == size_limits[s])
+        next_beam.clear();
     }
-    curr_beam = next_beam;
-    // Check if we're done with search
-    if(nbest.size() != 0) {
-      sort(nbest.begin(), nbest.end());
-      if(nbest.size() > nbest_size)
-        nbest.resize(nbest_size);
-      if(nbest.size() == nbest_size && (next_beam.size() == 0 || (*nbest.rbegin())->GetScore() >= next_beam[0]->GetScore()))
-        return nbest;
+    curr_beams.swap(next_beams);
+  }
+  if(max_size_limit == size_limit_)
+    cerr << "WARNING: Generated sentence size exceeded " << size_limit_ << ". Truncating." << endl;
+  return nbests;
+}
+
+// Draw a word from the log probabilities divided by the temperature, only
+// considering the top_k most likely words if top_k is non-zero
+inline int SampleWord(const float* log_probs, int vocab_size, float temperature, int top_k, vector<pair<float,int> > & cands) {
+  if(top_k > 0 && top_k < vocab_size) {
+    FindTopK(log_probs, vocab_size, top_k, 0.f, cands);
+  } else {
+    cands.resize(vocab_size);
+    for(int wid = 0; wid < vocab_size; wid++)
+      cands[wid] = make_pair(log_probs[wid], wid);
+  }
+  float max_score = -FLT_MAX, sum = 0.f;
+  for(auto & cand : cands)
+    max_score = max(max_score, cand.first);
+  for(auto & cand : cands) {
+    cand.first = exp((cand.first - max_score) / temperature);
+    sum += cand.first;
+  }
+  std::uniform_real_distribution<float> dist(0.f, sum);
+  float r = dist(*rndeng);
+  for(auto & cand : cands) {
+    r -= cand.first;
+    if(r < 0) return cand.second;
+  }
+  return cands.back().second;
+}
+
+std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::Sample(const Sentence & sent_src, int num_samples, float temperature, int top_k) {
+  // Initialize states and do encoding as necessary
+  ComputationGraph cg;
+  for(auto & tm : encdecs_) tm->NewGraph(cg);
+  for(auto & tm : encatts_) tm->NewGraph(cg);
+  for(auto & lm : lms_) lm->NewGraph(cg);
+  vector<vector<Expression> > last_state = GetInitialStates(sent_src, cg), next_state(lms_.size());
+  vector<Expression> last_extern(lms_.size()), next_extern(lms_.size()), last_sum(lms_.size()), next_sum(lms_.size());
+  int size_limit = size_limit_;
+  if(size_ratio_ != 0.f && encdecs_.size() + encatts_.size() > 0)
+    size_limit = max(0, min(size_limit_, (int)(size_ratio_ * sent_src.size()) + size_const_));
+  int vocab_size = lms_[0]->GetVocabSize();
+  // The batch only holds the samples that haven't ended yet, ids maps each
+  // element of the batch to its sample
+  vector<Sentence> samples(num_samples), aligns(num_samples), sents;
+  vector<float> scores(num_samples, 0.f);
+  vector<unsigned> ids(num_samples), keep;
+  for(int i = 0; i < num_samples; i++) ids[i] = i;
+  vector<pair<float,int> > cands;
+  for(int t = 0; t <= size_limit && ids.size() > 0; t++) {
+    sents.resize(ids.size());
+    for(size_t b = 0; b < ids.size(); b++)
+      sents[b] = samples[ids[b]];
+    // Perform the forward step on all models
+    vector<Expression> i_sms, i_aligns;
+    for(int j : boost::irange(0, (int)lms_.size()))
+      i_sms.push_back(lms_[j]->Forward(sents, t, externs_[j].get(), ensemble_operation_ == "logsum", last_state[j], last_extern[j], last_sum[j], next_state[j], next_extern[j], next_sum[j], cg, i_aligns));
+    Expression i_logprob;
+    if(ensemble_operation_ == "sum") {
+      i_logprob = log({EnsembleProbs(i_sms, cg)});
+    } else if(ensemble_operation_ == "logsum") {
+      i_logprob = EnsembleLogProbs(i_sms, cg);
+    } else {
+      THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
     }
+    Expression i_result = i_logprob;
+    if(i_aligns.size() != 0)
+      i_result = concatenate({i_logprob, sum(i_aligns)});
+    vector<float> result = as_vector(cg.incremental_forward(i_result));
+    int result_size = result.size() / ids.size();
+    int align_size = result_size - vocab_size;
+    // Draw the next word of each sample and find the ones that continue
+    keep.resize(0);
+    for(size_t b = 0; b < ids.size(); b++) {
+      const float* log_probs = &result[b * result_size];
+      int wid = SampleWord(log_probs, vocab_size, temperature, top_k, cands);
+      WordId best_align = -1;
+      if(align_size > 0) {
+        const float* align = log_probs + vocab_size;
+        best_align = 0;
+        for(int aid = 0; aid < align_size; aid++)
+          if(align[aid] > align[best_align])
+            best_align = aid;
+      }
+      samples[ids[b]].push_back(wid);
+      aligns[ids[b]].push_back(best_align);
+      scores[ids[b]] += log_probs[wid];
+      if(wid != 0 && t < size_limit)
+        keep.push_back(b);
+    }
+    // Remove the finished samples from the batch
+    if(keep.size() == 0) break;
+    for(size_t j = 0; j < lms_.size(); j++) {
+      last_state[j].resize(next_state[j].size());
+      for(size_t k = 0; k < next_state[j].size(); k++)
+        last_state[j][k] = (keep.size() == ids.size() ? next_state[j][k] : pick_batch_elems(next_state[j][k], keep));
+      last_extern[j] = ((keep.size() == ids.size() || next_extern[j].pg == nullptr) ? next_extern[j] : pick_batch_elems(next_extern[j], keep));
+      last_sum[j] = ((keep.size() == ids.size() || next_sum[j].pg == nullptr) ? next_sum[j] : pick_batch_elems(next_sum[j], keep));
+    }
+    for(size_t b = 0; b < keep.size(); b++)
+      ids[b] = ids[keep[b]];
+    ids.resize(keep.size());
   }
-  cerr << "WARNING: Generated sentence size exceeded " << size_limit_ << ". Truncating." << endl;
-  return nbest;
-  // return vector<EnsembleDecoderHypPtr>(0);
+  vector<EnsembleDecoderHypPtr> ret;
+  for(int i = 0; i < num_samples; i++)
+    ret.push_back(EnsembleDecoderHypPtr(new EnsembleDecoderHyp(scores[i], vector<vector<Expression> >(lms_.size()), vector<Expression>(lms_.size()), vector<Expression>(lms_.size()), samples[i], aligns[i])));
+  return ret;
 }
@@ -52,10 +52,30 @@ public:
     template <class OutSent, class OutLL, class OutWords>
     void CalcSentLL(const Sentence & sent_src, const OutSent & sent_trg, OutLL & ll, OutWords & words);
 
+    // Calculate the likelihood of many target sentences, where the i-th target is a
+    // translation of sents_src[src_ids[i]]. Each source is encoded only once, and the
+    // targets are scored together in batches of at most max_words words.
+    void CalcNbestLL(const std::vector<Sentence> & sents_src, const std::vector<Sentence> & sents_trg, const std::vector<unsigned> & src_ids, int max_words, std::vector<LLStats> & ll, std::vector<std::vector<float> > & wordll);
+
+    // Calculate the likelihood of target sentences that all have the same source
+    // (or none). The targets are put in a prefix trie, so the states of prefixes
+    // that several targets share are only calculated once.
+    void CalcTrieLL(const Sentence & sent_src, const std::vector<Sentence> & sents_trg, std::vector<LLStats> & ll, std::vector<std::vector<float> > & wordll);
+
     EnsembleDecoderHypPtr Generate(const Sentence & sent_src);
     std::vector<EnsembleDecoderHypPtr> GenerateNbest(const Sentence & sent_src, int nbest);
-
-    std::vector<std::vector<dynet::Expression> > GetInitialStates(const Sentence & sent_src, dynet::ComputationGraph & cg);
+    // Generate n-best lists for several sentences, decoding them together in a single batch
+    std::vector<std::vector<EnsembleDecoderHypPtr> > GenerateNbest(const std::vector<Sentence> & sents_src, int nbest);
+
+    // Draw num_samples samples for a sentence, expanding the ones that have not
+    // ended yet together as a single batch. Words are drawn from the ensemble's
+    // distribution with the log probabilities divided by temperature, and only
+    // from the top_k most likely words if top_k is non-zero. The score of each
+    // sample is its log probability under the ensemble.
+    std::vector<EnsembleDecoderHypPtr> Sample(const Sentence & sent_src, int num_samples, float temperature = 1.f, int top_k = 0);
+
+    template <class SentData>
+    std::vector<std::vector<dynet::Expression> > GetInitialStates(const SentData & sent_src, dynet::ComputationGraph & cg);
     
     template <class Sent, class Stat, class WordLik>
     void AddLik(const Sent & sent, const dynet::Expression & expr, const std::vector<dynet::Expression> & exprs, Stat & ll, WordLik & wordll);
@@ -82,6 +102,27 @@ public:
     int GetSizeLimit() const { return size_limit_; }
     void SetSizeLimit(int size_limit) { size_limit_ = size_limit; }
 
+    // Pruning of the beam, where zero disables each option
+    float GetPruneAbs() const { return prune_abs_; }
+    float GetPruneRel() const { return prune_rel_; }
+    int GetMaxCandsPerParent() const { return max_cands_per_parent_; }
+    void SetPruneAbs(float prune_abs) { prune_abs_ = prune_abs; }
+    void SetPruneRel(float prune_rel) { prune_rel_ = prune_rel; }
+    void SetMaxCandsPerParent(int max_cands) { max_cands_per_parent_ = max_cands; }
+
+    // Only score a shortlist of words when generating, made up of the lex_size best translations
+    // of each source word and the freq_size most frequent words. Translations come from the
+    // models' lexicons, and from lex_mapping if it is given.
+    void SetShortlist(int lex_size, int freq_size, const MultipleIdMappingPtr & lex_mapping = MultipleIdMappingPtr()) {
+      shortlist_lex_ = lex_size; shortlist_freq_ = freq_size; shortlist_mapping_ = lex_mapping; freq_words_.clear();
+    }
+
+    // Limit the output length to size_ratio * source length + size_const, if size_ratio is non-zero
+    float GetSizeRatio() const { return size_ratio_; }
+    int GetSizeConst() const { return size_const_; }
+    void SetSizeRatio(float size_ratio) { size_ratio_ = size_ratio; }
+    void SetSizeConst(int size_const) { size_const_ = size_const; }
+
 protected:
     std::vector<EncoderDecoderPtr> encdecs_;
     std::vector<EncoderAttentionalPtr> encatts_;
@@ -92,6 +133,19 @@ protected:
     int unk_id_;
     int size_limit_;
     int beam_size_;
+    // Prune hypotheses whose log probability is more than prune_abs_ below the best,
+    // or whose probability is less than prune_rel_ times the best
+    float prune_abs_, prune_rel_;
+    int max_cands_per_parent_;
+    float size_ratio_;
+    int size_const_;
+    int shortlist_lex_, shortlist_freq_;
+    MultipleIdMappingPtr shortlist_mapping_;
+    std::vector<unsigned> freq_words_;
+
+    // Create the shortlist for the sentences and set it in all the models,
+    // returns false if some model cannot use a shortlist
+    bool CreateShortlist(const std::vector<Sentence> & sents_src, std::vector<unsigned> & shortlist);
     std::string ensemble_operation_;
 
 };
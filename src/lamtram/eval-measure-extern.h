@@ -39,6 +39,9 @@ public:
     virtual EvalStatsPtr ReadStats(
                 const std::string & file);
 
+    // There is only one child process to talk to
+    virtual bool IsThreadSafe() const { return false; }
+
 protected:
 
     // Target vocabulary to generate sys/ref strings
@@ -65,6 +65,12 @@ public:
     virtual EvalStatsPtr ReadStats(
                 const std::string & file);
 
+    virtual bool IsThreadSafe() const {
+        for(auto & measure : measures_)
+            if(!measure->IsThreadSafe()) return false;
+        return true;
+    }
+
 protected:
     std::vector<std::shared_ptr<EvalMeasure> > measures_;
     std::vector<float> coeffs_;
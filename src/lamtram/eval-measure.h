@@ -120,6 +120,9 @@ public:
     // Clear the cache
     virtual void ClearCache() { }
 
+    // Whether CalculateStats() can be called from several threads at once
+    virtual bool IsThreadSafe() const { return true; }
+
 protected:
 
     // Which factore to calculate over
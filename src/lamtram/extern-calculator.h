@@ -20,9 +20,13 @@ public:
     virtual void InitializeSentence(const Sentence & sent, bool train, dynet::ComputationGraph & cg) { }
     virtual void InitializeSentence(const std::vector<Sentence> & sent, bool train, dynet::ComputationGraph & cg) { }
 
-    // Create a variable encoding the context
+    // When several sentences were initialized at once, select which sentence
+    // each element of the batches passed to CreateContext corresponds to
+    virtual void SelectSentences(const std::vector<unsigned> & ids, dynet::ComputationGraph & cg) { }
+
+    // Create a variable encoding the context when predicting the target word at loc
     virtual dynet::Expression CreateContext(
-        // const Sentence & sent, int loc,
+        int loc,
         const std::vector<dynet::Expression> & state_in,
         const dynet::Expression & align_sum_in,
         bool train,
@@ -0,0 +1,8 @@
+#include <lamtram/lamtram-prep.h>
+
+using namespace lamtram;
+
+int main(int argc, char** argv) {
+    LamtramPrep prep;
+    return prep.main(argc, argv);
+}
@@ -0,0 +1,119 @@
+#include <lamtram/lamtram-prep.h>
+#include <lamtram/binary-corpus.h>
+#include <lamtram/binary-model.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/macros.h>
+#include <lamtram/string-util.h>
+#include <dynet/dict.h>
+#include <boost/program_options.hpp>
+#include <boost/lexical_cast.hpp>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+namespace po = boost::program_options;
+
+bool LamtramPrep::LineReader::ReadLine(std::string & line) {
+  while(file_id_ < files_.size()) {
+    if(!in_.is_open()) {
+      in_.open(files_[file_id_].c_str());
+      if(!in_) THROW_ERROR("Could not find training file: " << files_[file_id_]);
+      line_no_ = 0;
+    }
+    if(getline(in_, line)) {
+      line_no_++;
+      return true;
+    }
+    in_.close();
+    in_.clear();
+    file_id_++;
+  }
+  return false;
+}
+
+int LamtramPrep::main(int argc, char** argv) {
+  po::options_description desc("*** lamtram-prep (by Graham Neubig) ***");
+  desc.add_options()
+    ("help", "Produce help message")
+    ("train_trg", po::value<string>()->default_value(""), "Training target files, possibly separated by pipes")
+    ("train_src", po::value<string>()->default_value(""), "Training source files, possibly separated by pipes")
+    ("train_weights", po::value<string>()->default_value(""), "Training instance weights, possibly separated by pipes")
+    ("train_kickout_keep", po::value<string>()->default_value(""), "Instance-level keep rates for kickout, possibly separated by pipes")
+    ("model_in", po::value<string>()->default_value(""), "Use the vocabularies of this model, for continuing training")
+    ("corpus_out", po::value<string>()->default_value(""), "File to write the binary corpus to")
+    ("wildcards", po::value<string>()->default_value(""), "Wildcards to be used in loading training files")
+    ;
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 1;
+  }
+
+  vector<string> wildcards = Tokenize(vm["wildcards"].as<string>(), "|");
+  vector<string> files_trg, files_src, files_weights, files_kickout_keep;
+  if(vm["train_trg"].as<string>() != "") files_trg = TokenizeWildcarded(vm["train_trg"].as<string>(), wildcards, "|");
+  if(vm["train_src"].as<string>() != "") files_src = TokenizeWildcarded(vm["train_src"].as<string>(), wildcards, "|");
+  if(vm["train_weights"].as<string>() != "") files_weights = TokenizeWildcarded(vm["train_weights"].as<string>(), wildcards, "|");
+  if(vm["train_kickout_keep"].as<string>() != "") files_kickout_keep = TokenizeWildcarded(vm["train_kickout_keep"].as<string>(), wildcards, "|");
+  string corpus_out = vm["corpus_out"].as<string>();
+  if(!files_trg.size() || !files_src.size())
+    THROW_ERROR("Must specify training files with --train_src and --train_trg");
+  if(!corpus_out.size())
+    THROW_ERROR("Must specify an output file with --corpus_out");
+
+  // Get the vocabularies, either new ones or from the model
+  DictPtr vocab_src, vocab_trg;
+  string model_in = vm["model_in"].as<string>();
+  if(model_in.size()) {
+    string header;
+    if(BinaryModelFile::IsBinaryModel(model_in)) {
+      header = BinaryModelFile(model_in).GetHeader();
+    } else {
+      ifstream in(model_in);
+      if(!in) THROW_ERROR("Could not open model file " << model_in);
+      header.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    }
+    istringstream in(header);
+    vocab_src.reset(ReadDict(in));
+    vocab_trg.reset(ReadDict(in));
+  } else {
+    vocab_src.reset(CreateNewDict());
+    vocab_trg.reset(CreateNewDict());
+  }
+
+  // Convert the sentences, writing each one out as it is read
+  LineReader in_trg(files_trg), in_src(files_src), in_weights(files_weights), in_kickout_keep(files_kickout_keep);
+  BinaryCorpusWriter writer(corpus_out, files_weights.size() != 0, files_kickout_keep.size() != 0);
+  string line_trg, line_src, line;
+  size_t num_sents = 0;
+  while(in_trg.ReadLine(line_trg)) {
+    Sentence trg = ParseWords(*vocab_trg, line_trg, true);
+    if(trg.size() == 1)
+      THROW_ERROR("Empty line found in " << in_trg.GetFile() << " at " << in_trg.GetLineNo());
+    if(!in_src.ReadLine(line_src))
+      THROW_ERROR("The source files are shorter than the target files");
+    Sentence src = ParseWords(*vocab_src, line_src, false);
+    if(src.size() == 0)
+      THROW_ERROR("Empty line found in " << in_src.GetFile() << " at " << in_src.GetLineNo());
+    float weight = 1.f, kickout_keep = 1.f;
+    if(files_weights.size()) {
+      if(!in_weights.ReadLine(line)) THROW_ERROR("The weights files are shorter than the target files");
+      weight = boost::lexical_cast<float>(line);
+    }
+    if(files_kickout_keep.size()) {
+      if(!in_kickout_keep.ReadLine(line)) THROW_ERROR("The kickout files are shorter than the target files");
+      kickout_keep = boost::lexical_cast<float>(line);
+    }
+    writer.AddSentence(src, trg, weight, kickout_keep);
+    num_sents++;
+  }
+  if(in_src.ReadLine(line_src))
+    THROW_ERROR("The source files are longer than the target files");
+  writer.Finish(*vocab_src, *vocab_trg);
+  cerr << "Wrote " << num_sents << " sentences to " << corpus_out << " (source vocab " << vocab_src->size() << ", target vocab " << vocab_trg->size() << ")" << endl;
+
+  return 0;
+}
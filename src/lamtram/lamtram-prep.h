@@ -0,0 +1,36 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// Converts training files into a binary corpus that lamtram-train can map
+// into memory instead of reading and tokenizing the text every time
+class LamtramPrep {
+
+public:
+  LamtramPrep() { }
+
+  int main(int argc, char** argv);
+
+protected:
+
+  // Read lines from several files as if they were concatenated
+  class LineReader {
+  public:
+    LineReader(const std::vector<std::string> & files) : files_(files), file_id_(0), line_no_(0) { }
+    bool ReadLine(std::string & line);
+    const std::string & GetFile() const { return files_[file_id_]; }
+    int GetLineNo() const { return line_no_; }
+  protected:
+    std::vector<std::string> files_;
+    size_t file_id_;
+    int line_no_;
+    std::ifstream in_;
+  };
+
+};
+
+}
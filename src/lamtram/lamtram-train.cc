@@ -11,9 +11,15 @@
 #include <lamtram/loss-stats.h>
 #include <lamtram/eval-measure.h>
 #include <lamtram/eval-measure-loader.h>
+#include <lamtram/streaming-corpus.h>
+#include <lamtram/binary-corpus.h>
+#include <lamtram/data-parallel.h>
+#include <lamtram/background-task.h>
+#include <lamtram/checkpoint.h>
 #include <dynet/dynet.h>
 #include <dynet/dict.h>
 #include <dynet/globals.h>
+#include <dynet/devices.h>
 #include <dynet/training.h>
 #include <dynet/tensor.h>
 #include <dynet/io.h>
@@ -22,7 +28,10 @@
 #include <boost/algorithm/string.hpp>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <climits>
+#include <thread>
 
 using namespace std;
 using namespace lamtram;
@@ -34,16 +43,21 @@ int LamtramTrain::main(int argc, char** argv) {
   desc.add_options()
     ("help", "Produce help message")
     ("train_trg", po::value<string>()->default_value(""), "Training files, possibly separated by pipes")
+    ("train_corpus", po::value<string>()->default_value(""), "A binary corpus created by lamtram-prep, used instead of train_src, train_trg, train_weights, and train_kickout_keep")
     ("dev_trg", po::value<string>()->default_value(""), "Development files")
     ("train_src", po::value<string>()->default_value(""), "Training source files for TMs, possibly separated by pipes")
     ("dev_src", po::value<string>()->default_value(""), "Development source file for TMs")
+    ("dev_background", po::value<bool>()->default_value(false), "Evaluate on the dev set in a background process on a snapshot of the model while training continues, acting on the result at the next evaluation (CPU only)")
+    ("dev_minibatch_size", po::value<int>()->default_value(1), "Number of words per mini-batch when evaluating on the dev set")
     ("model_out", po::value<string>()->default_value(""), "File to write the model to")
     ("model_type", po::value<string>()->default_value("nlm"), "ParameterCollection type (Neural LM nlm, Encoder Decoder encdec, Attentional ParameterCollection encatt, or Encoder Classifier enccls)")
     ("layer_size", po::value<int>()->default_value(512), "The default size of all hidden layers (word rep, hidden state, mlp attention, mlp softmax) if not specified otherwise")
     ("attention_feed", po::value<bool>()->default_value(true), "Whether to perform the input feeding of Luong et al.")
     ("attention_hist", po::value<string>()->default_value("none"), "How to pass information about the attention into the score function (none/sum)")
     ("attention_lex", po::value<string>()->default_value("none"), "Use a lexicon (e.g. \"prior:file=/path/to/file:alpha=0.001\")")
-    ("attention_type", po::value<string>()->default_value("mlp:0"), "Type of attention score (mlp:NUM/bilin/dot)")
+    ("attention_type", po::value<string>()->default_value("mlp:0"), "Type of attention score (mlp:NUM/bilin/dot, or local:W to only score an MLP over W source words on each side of the target position)")
+    ("checkpoint", po::value<string>()->default_value(""), "Periodically save the full training state to this file")
+    ("checkpoint_every", po::value<int>()->default_value(0), "Save a checkpoint every this many sentences (0 for only at each evaluation)")
     ("cls_layers", po::value<string>()->default_value(""), "Descriptor for classifier layers, nodes1:nodes2:...")
     ("context", po::value<int>()->default_value(2), "Amount of context information to use")
     ("dropout", po::value<float>()->default_value(0.0), "Dropout rate during training")
@@ -55,21 +69,29 @@ int LamtramTrain::main(int argc, char** argv) {
     ("layers", po::value<string>()->default_value("lstm:0:1"), "Descriptor for hidden layers, type:num_units:num_layers")
     ("learning_criterion", po::value<string>()->default_value("ml"), "The criterion to use for learning (ml/minrisk)")
     ("learning_rate", po::value<float>()->default_value(0.001), "Learning rate")
+    ("minibatch_budget", po::value<string>()->default_value("longest"), "How minibatch_size is counted (longest: sentences times the longest source plus target length, padded: source and target tokens including padding)")
     ("minibatch_size", po::value<int>()->default_value(1), "Number of words per mini-batch")
     ("minrisk_dedup", po::value<bool>()->default_value(true), "Whether to deduplicate samples for min risk training")
     ("minrisk_include_ref", po::value<bool>()->default_value(false), "Whether to include the reference in every sample for min risk training")
     ("minrisk_max_len", po::value<int>()->default_value(200), "Limit on the max length of sentences")
+    ("minrisk_minibatch", po::value<int>()->default_value(1), "Number of sentences per update for min risk training")
     ("minrisk_num_samples", po::value<int>()->default_value(50), "The number of samples to perform for minimum risk training")
     ("minrisk_scaling", po::value<float>()->default_value(0.005), "The scaling factor for min risk training")
+    ("minrisk_threads", po::value<int>()->default_value(1), "Number of threads for scoring samples with the evaluation measure in min risk training")
     ("model_in", po::value<string>()->default_value(""), "If resuming training, read the model in")
+    ("model_format", po::value<string>()->default_value("text"), "The format to write the model in (text/binary), binary models are a single file that loads without parsing")
     ("rate_decay", po::value<float>()->default_value(0.5), "Learning rate decay when dev perplexity gets worse")
     ("rate_thresh",  po::value<float>()->default_value(1e-5), "Threshold for the learning rate")
+    ("resume", po::value<bool>()->default_value(false), "Continue training from the checkpoint file if it exists")
     ("scheduled_samp", po::value<float>()->default_value(0.f), "If set to 1 or more, perform scheduled sampling where the selected value is the number of iterations after which the sampling value reaches 0.5")
     ("seed", po::value<int>()->default_value(0), "Random seed (default 0 -> changes every time)")
     ("softmax", po::value<string>()->default_value("multilayer:0:full"), "The type of softmax to use (full/hinge/hier/mod/multilayer) see softmax_factory.h for details")
+    ("stream_window", po::value<int>()->default_value(0), "Read the training corpus in windows of this many sentences instead of loading it all into memory (encdec/encatt with ml only, 0 to disable)")
     ("train_weights", po::value<string>()->default_value(""), "Training instance weights for TMs, possibly separated by pipes")
     ("train_kickout_keep", po::value<string>()->default_value(""), "Instance-level keep rates for kickout (TMs only), possibly separated by pipes")
     ("trainer", po::value<string>()->default_value("adam"), "Training algorithm (sgd/momentum/adagrad/adadelta)")
+    ("train_async", po::value<bool>()->default_value(false), "With train_procs, update shared parameters asynchronously instead of summing the gradients of each step (Hogwild)")
+    ("train_procs", po::value<int>()->default_value(1), "Number of processes for data-parallel training on the CPU, each step trains on this many minibatches (nlm, or encdec/encatt with ml)")
     ("verbose", po::value<int>()->default_value(0), "How much verbose output to print")
     ("wildcards", po::value<string>()->default_value(""), "Wildcards to be used in loading training files")
     ("wordrep", po::value<int>()->default_value(0), "Size of the word representations (0 to match layer_size)")
@@ -107,7 +129,8 @@ int LamtramTrain::main(int argc, char** argv) {
   try { train_files_trg_ = TokenizeWildcarded(vm_["train_trg"].as<string>(), wildcards_, "|"); } catch(std::exception & e) { }
   try { dev_file_trg_ = vm_["dev_trg"].as<string>(); } catch(std::exception & e) { }
   try { model_out_file_ = vm_["model_out"].as<string>(); } catch(std::exception & e) { }
-  if(!train_files_trg_.size())
+  string train_corpus_file = vm_["train_corpus"].as<string>();
+  if(!train_files_trg_.size() && !train_corpus_file.size())
     THROW_ERROR("Must specify a training file with --train_trg");
   if(!model_out_file_.size())
     THROW_ERROR("Must specify a model output file with --model_out");
@@ -125,8 +148,13 @@ int LamtramTrain::main(int argc, char** argv) {
     if (train_kickout_keep_string != "")
       train_files_kickout_keep_ = TokenizeWildcarded(train_kickout_keep_string, wildcards_, "|");
   } catch(std::exception & e) { }
-  if(use_src && ((!train_files_src_.size()) || (dev_file_trg_.size() && !dev_file_src_.size())))
+  if(use_src && ((!train_files_src_.size() && !train_corpus_file.size()) || (dev_file_trg_.size() && !dev_file_src_.size())))
     THROW_ERROR("The specified model requires a source file to train, specify source files using train_src.");
+  if(train_corpus_file.size()) {
+    if(train_files_trg_.size() || train_files_src_.size() || train_files_weights_.size() || train_files_kickout_keep_.size())
+      THROW_ERROR("A binary corpus already contains the training data, so train_src, train_trg, train_weights, and train_kickout_keep can't be used with it");
+    train_corpus_.reset(new BinaryCorpus(train_corpus_file));
+  }
 
   // Save some variables
   rate_decay_ = vm_["rate_decay"].as<float>();
@@ -134,11 +162,52 @@ int LamtramTrain::main(int argc, char** argv) {
   epochs_ = vm_["epochs"].as<int>();
   context_ = vm_["context"].as<int>();
   model_in_file_ = vm_["model_in"].as<string>();
+  if(vm_["model_format"].as<string>() != "text" && vm_["model_format"].as<string>() != "binary")
+    THROW_ERROR("model_format must be text or binary, but got " << vm_["model_format"].as<string>());
+  model_binary_ = (vm_["model_format"].as<string>() == "binary");
   model_out_file_ = vm_["model_out"].as<string>();
   eval_every_ = vm_["eval_every"].as<int>();
   softmax_sig_ = vm_["softmax"].as<string>();
   scheduled_samp_ = vm_["scheduled_samp"].as<float>();
   dropout_ = vm_["dropout"].as<float>();
+  stream_window_ = vm_["stream_window"].as<int>();
+  if(vm_["minibatch_budget"].as<string>() != "longest" && vm_["minibatch_budget"].as<string>() != "padded")
+    THROW_ERROR("minibatch_budget must be longest or padded, but got " << vm_["minibatch_budget"].as<string>());
+  padded_budget_ = (vm_["minibatch_budget"].as<string>() == "padded");
+  if(stream_window_ > 0 && ((model_type != "encdec" && model_type != "encatt") || vm_["learning_criterion"].as<string>() != "ml"))
+    THROW_ERROR("Streaming the training corpus is only supported for encdec and encatt models with the ml criterion");
+  if(train_corpus_.get() != nullptr && ((model_type != "encdec" && model_type != "encatt") || vm_["learning_criterion"].as<string>() != "ml"))
+    THROW_ERROR("Binary corpora are only supported for encdec and encatt models with the ml criterion");
+  if(train_corpus_.get() != nullptr && stream_window_ > 0)
+    THROW_ERROR("Binary corpora are already mapped into memory and can't be streamed");
+  train_procs_ = vm_["train_procs"].as<int>();
+  if(train_procs_ < 1)
+    THROW_ERROR("train_procs must be at least 1, but got " << train_procs_);
+  if(train_procs_ > 1 && model_type != "nlm" && ((model_type != "encdec" && model_type != "encatt") || vm_["learning_criterion"].as<string>() != "ml"))
+    THROW_ERROR("Data-parallel training is only supported for nlm models, and encdec and encatt models with the ml criterion");
+  if(train_procs_ > 1 && stream_window_ > 0)
+    THROW_ERROR("Data-parallel training can't be combined with streaming the training corpus");
+  dev_background_ = vm_["dev_background"].as<bool>();
+  if(dev_background_ && train_procs_ > 1)
+    THROW_ERROR("Background dev evaluation can't be combined with data-parallel training");
+  if(dev_background_ && default_device->type != DeviceType::CPU)
+    THROW_ERROR("Background dev evaluation is only supported on the CPU");
+  dev_minibatch_size_ = vm_["dev_minibatch_size"].as<int>();
+  checkpoint_file_ = vm_["checkpoint"].as<string>();
+  checkpoint_every_ = vm_["checkpoint_every"].as<int>();
+  resume_ = vm_["resume"].as<bool>();
+  if(resume_ && !checkpoint_file_.size())
+    THROW_ERROR("Must specify the --checkpoint file to resume from");
+  if(checkpoint_file_.size()) {
+    if((model_type == "encdec" || model_type == "encatt") && vm_["learning_criterion"].as<string>() != "ml")
+      THROW_ERROR("Checkpoints are only supported with the ml criterion");
+    if(stream_window_ > 0 || train_procs_ > 1 || dev_background_ || train_files_kickout_keep_.size())
+      THROW_ERROR("Checkpoints can't be combined with streaming, data-parallel training, background dev evaluation, or kickout");
+  }
+  if(resume_ && !ifstream(checkpoint_file_)) {
+    cerr << "No checkpoint at " << checkpoint_file_ << ", starting from the beginning" << endl;
+    resume_ = false;
+  }
 
   // Perform appropriate training
   if(model_type == "nlm")           TrainLM();
@@ -180,11 +249,50 @@ struct SingleLength
   const vector<Sentence> & vec;
 };
 
-inline size_t CalcSize(const Sentence & src, const Sentence & trg) {
-  return src.size()+trg.size();
+// The number of tokens in an output, where a label counts as one
+inline size_t OutputLength(const Sentence & trg) {
+  return trg.size();
 }
-inline size_t CalcSize(const Sentence & src, int trg) {
-  return src.size()+1;
+inline size_t OutputLength(int trg) {
+  return 1;
+}
+
+void LamtramTrain::SplitMinibatches(const std::vector<size_t> & ids,
+                                    size_t max_size,
+                                    bool padded_budget,
+                                    const std::function<std::pair<size_t,size_t>(size_t)> & length,
+                                    std::vector<std::vector<size_t> > & minibatch_ids) {
+  minibatch_ids.clear();
+  std::vector<size_t> next;
+  size_t max_src = 0, max_trg = 0, max_len = 0;
+  size_t padded_tokens = 0, tokens = 0;
+  for(size_t id : ids) {
+    std::pair<size_t,size_t> len = length(id);
+    tokens += len.first + len.second;
+    if(padded_budget && next.size() && (next.size()+1) * (max(max_src, len.first) + max(max_trg, len.second)) > max_size) {
+      padded_tokens += next.size() * (max_src + max_trg);
+      minibatch_ids.push_back(next);
+      next.clear();
+      max_src = max_trg = max_len = 0;
+    }
+    next.push_back(id);
+    max_src = max(max_src, len.first);
+    max_trg = max(max_trg, len.second);
+    max_len = max(max_len, len.first + len.second);
+    if(!padded_budget && (next.size()+1) * max_len > max_size) {
+      padded_tokens += next.size() * (max_src + max_trg);
+      minibatch_ids.push_back(next);
+      next.clear();
+      max_src = max_trg = max_len = 0;
+    }
+  }
+  if(next.size()) {
+    padded_tokens += next.size() * (max_src + max_trg);
+    minibatch_ids.push_back(next);
+  }
+  if(max_size > 1 && padded_tokens > 0)
+    cerr << "*** Minibatches: " << minibatch_ids.size() << " with " << padded_tokens << " tokens including padding, "
+         << 100.0 * (padded_tokens - tokens) / padded_tokens << "% padding" << endl;
 }
 
 template <class OutputType>
@@ -194,6 +302,7 @@ inline size_t CreateMinibatches(const std::vector<Sentence> & train_src,
                               const std::vector<float> & train_weights,
                               const std::vector<float> & train_kickout_keep,
                               size_t max_size,
+                              bool padded_budget,
                               std::vector<std::vector<Sentence> > & train_src_minibatch,
                               std::vector<std::vector<OutputType> > & train_trg_minibatch,
                               std::vector<std::vector<OutputType> > & train_cache_minibatch,
@@ -207,87 +316,161 @@ inline size_t CreateMinibatches(const std::vector<Sentence> & train_src,
   std::iota(train_ids.begin(), train_ids.end(), 0);
   if(max_size > 1)
     sort(train_ids.begin(), train_ids.end(), DoubleLength<OutputType>(train_src, train_trg));
-  std::vector<Sentence> train_src_next;
-  std::vector<OutputType> train_trg_next, train_cache_next;
-  std::vector<float> train_weights_next;
-  size_t max_len = 0;
-  size_t kicked = 0;
-  for(size_t i = 0; i < train_ids.size(); i++) {
-    // Apply kickout: skip sentence if rand [0,1] above keep rate
-    if(train_kickout_keep.size()) {
-      if(rand01() > train_kickout_keep[train_ids[i]]) {
-        ++kicked;
-        continue;
-      }
-    }
-    max_len = max(max_len, CalcSize(train_src[train_ids[i]], train_trg[train_ids[i]]));
-    train_src_next.push_back(train_src[train_ids[i]]);
-    train_trg_next.push_back(train_trg[train_ids[i]]);
-    if(train_cache.size())
-      train_cache_next.push_back(train_cache[train_ids[i]]);
-    if(train_weights.size())
-      train_weights_next.push_back(train_weights[train_ids[i]]);
-    if((train_trg_next.size()+1) * max_len > max_size) {
-      train_src_minibatch.push_back(train_src_next);
-      train_src_next.clear();
-      train_trg_minibatch.push_back(train_trg_next);
-      train_trg_next.clear();
-      if(train_cache.size()) {
-        train_cache_minibatch.push_back(train_cache_next);
-        train_cache_next.clear();
-      }
-      if(train_weights.size()) {
-        train_weights_minibatch.push_back(train_weights_next);
-        train_weights_next.clear();
-      }
-      max_len = 0;
+  // Apply kickout: skip sentence if rand [0,1] above keep rate
+  std::vector<size_t> kept_ids;
+  for(size_t id : train_ids)
+    if(!train_kickout_keep.size() || rand01() <= train_kickout_keep[id])
+      kept_ids.push_back(id);
+  std::vector<std::vector<size_t> > minibatch_ids;
+  LamtramTrain::SplitMinibatches(kept_ids, max_size, padded_budget,
+                                 [&](size_t id) { return std::make_pair(train_src[id].size(), OutputLength(train_trg[id])); },
+                                 minibatch_ids);
+  for(auto & ids : minibatch_ids) {
+    train_src_minibatch.push_back(std::vector<Sentence>());
+    train_trg_minibatch.push_back(std::vector<OutputType>());
+    if(train_cache.size()) train_cache_minibatch.push_back(std::vector<OutputType>());
+    if(train_weights.size()) train_weights_minibatch.push_back(std::vector<float>());
+    for(size_t id : ids) {
+      train_src_minibatch.back().push_back(train_src[id]);
+      train_trg_minibatch.back().push_back(train_trg[id]);
+      if(train_cache.size()) train_cache_minibatch.back().push_back(train_cache[id]);
+      if(train_weights.size()) train_weights_minibatch.back().push_back(train_weights[id]);
     }
   }
-  if(train_trg_next.size()) {
-    train_src_minibatch.push_back(train_src_next);
-    train_trg_minibatch.push_back(train_trg_next);
-  }
-  if(train_cache_next.size()) train_cache_minibatch.push_back(train_cache_next);
-  if(train_weights_next.size()) train_weights_minibatch.push_back(train_weights_next);
   // Create a sentence list for this minibatch
   train_ids_minibatch.resize(train_src_minibatch.size());
   std::iota(train_ids_minibatch.begin(), train_ids_minibatch.end(), 0);
   // Return total size (sentences)
-  if(train_kickout_keep.size()) {
-    cerr << "*** Kickout: " << train_ids.size() - kicked << " of " << train_ids.size() << " instances retained" << endl;
-    return train_ids.size() - kicked;
+  if(train_kickout_keep.size())
+    cerr << "*** Kickout: " << kept_ids.size() << " of " << train_ids.size() << " instances retained" << endl;
+  return kept_ids.size();
+}
+
+// Read the next window of a streamed corpus and split it into minibatches,
+// returning false once the end of the corpus has been reached
+inline bool CreateStreamMinibatches(StreamingCorpus & stream,
+                                    size_t max_size,
+                                    bool padded_budget,
+                                    std::vector<std::vector<Sentence> > & train_src_minibatch,
+                                    std::vector<std::vector<Sentence> > & train_trg_minibatch,
+                                    std::vector<std::vector<Sentence> > & train_cache_minibatch,
+                                    std::vector<std::vector<float> > & train_weights_minibatch,
+                                    std::vector<size_t> & train_ids_minibatch) {
+  StreamingWindow window;
+  if(!stream.NextWindow(window)) return false;
+  std::vector<Sentence> empty_cache;
+  CreateMinibatches(window.src,
+                    window.trg,
+                    empty_cache,
+                    window.weights,
+                    window.kickout_keep,
+                    max_size,
+                    padded_budget,
+                    train_src_minibatch,
+                    train_trg_minibatch,
+                    train_cache_minibatch,
+                    train_weights_minibatch,
+                    train_ids_minibatch);
+  return true;
+}
+inline bool CreateStreamMinibatches(StreamingCorpus & stream,
+                                    size_t max_size,
+                                    bool padded_budget,
+                                    std::vector<std::vector<Sentence> > & train_src_minibatch,
+                                    std::vector<std::vector<int> > & train_trg_minibatch,
+                                    std::vector<std::vector<int> > & train_cache_minibatch,
+                                    std::vector<std::vector<float> > & train_weights_minibatch,
+                                    std::vector<size_t> & train_ids_minibatch) {
+  THROW_ERROR("Streaming the training corpus is not supported for classifiers");
+}
+
+// Create minibatches of sentence ids from a binary corpus in the same way as
+// above, so the sentences themselves are only read when they are used
+inline size_t CreateCorpusMinibatches(const BinaryCorpus & corpus,
+                                      size_t max_size,
+                                      bool padded_budget,
+                                      std::vector<std::vector<size_t> > & train_corpus_minibatch,
+                                      std::vector<size_t> & train_ids_minibatch) {
+  std::vector<size_t> train_ids(corpus.GetNumSents());
+  std::iota(train_ids.begin(), train_ids.end(), 0);
+  if(max_size > 1) {
+    sort(train_ids.begin(), train_ids.end(), [&](size_t i1, size_t i2) {
+      if(corpus.GetSrcLength(i2) != corpus.GetSrcLength(i1)) return (corpus.GetSrcLength(i2) < corpus.GetSrcLength(i1));
+      return (corpus.GetTrgLength(i2) < corpus.GetTrgLength(i1));
+    });
+  }
+  // Apply kickout: skip sentence if rand [0,1] above keep rate
+  std::vector<size_t> kept_ids;
+  for(size_t id : train_ids)
+    if(!corpus.HasKickoutKeep() || rand01() <= corpus.GetKickoutKeep(id))
+      kept_ids.push_back(id);
+  LamtramTrain::SplitMinibatches(kept_ids, max_size, padded_budget,
+                                 [&](size_t id) { return std::make_pair(corpus.GetSrcLength(id), corpus.GetTrgLength(id)); },
+                                 train_corpus_minibatch);
+  train_ids_minibatch.resize(train_corpus_minibatch.size());
+  std::iota(train_ids_minibatch.begin(), train_ids_minibatch.end(), 0);
+  if(corpus.HasKickoutKeep())
+    cerr << "*** Kickout: " << kept_ids.size() << " of " << train_ids.size() << " instances retained" << endl;
+  return kept_ids.size();
+}
+
+// Copy the sentences of one minibatch out of a binary corpus
+inline void ReadCorpusMinibatch(const BinaryCorpus & corpus,
+                                const std::vector<size_t> & ids,
+                                std::vector<Sentence> & src,
+                                std::vector<Sentence> & trg,
+                                std::vector<float> & weights) {
+  src.resize(ids.size());
+  trg.resize(ids.size());
+  weights.clear();
+  for(size_t i = 0; i < ids.size(); i++) {
+    corpus.GetSrc(ids[i], src[i]);
+    corpus.GetTrg(ids[i], trg[i]);
+    if(corpus.HasWeights()) weights.push_back(corpus.GetWeight(ids[i]));
   }
-  return train_ids.size();
+}
+inline void ReadCorpusMinibatch(const BinaryCorpus & corpus,
+                                const std::vector<size_t> & ids,
+                                std::vector<Sentence> & src,
+                                std::vector<int> & trg,
+                                std::vector<float> & weights) {
+  THROW_ERROR("Binary corpora are not supported for classifiers");
+}
+
+// Sum the statistics of all data-parallel training processes
+inline LLStats SumStats(DataParallel * parallel, const LLStats & stats) {
+  LLStats ret(stats);
+  ret.correct_ = stats.correct_;
+  if(parallel != nullptr) {
+    vector<double> vals = {(double)stats.words_, (double)stats.unk_, (double)stats.correct_, (double)stats.loss_};
+    parallel->SumValues(vals);
+    ret.words_ = vals[0]; ret.unk_ = vals[1]; ret.correct_ = vals[2]; ret.loss_ = vals[3];
+  }
+  return ret;
 }
 
 inline void CreateMinibatches(const std::vector<Sentence> & train_trg,
                               const std::vector<Sentence> & train_cache,
                               int max_size,
+                              bool padded_budget,
                               std::vector<std::vector<Sentence> > & train_trg_minibatch,
                               std::vector<std::vector<Sentence> > & train_cache_minibatch) {
-  std::vector<int> train_ids(train_trg.size());
+  std::vector<size_t> train_ids(train_trg.size());
   std::iota(train_ids.begin(), train_ids.end(), 0);
   if(max_size > 1)
     sort(train_ids.begin(), train_ids.end(), SingleLength(train_trg));
-  std::vector<Sentence> train_trg_next, train_cache_next;
-  size_t first_size = 0;
-  for(size_t i = 0; i < train_ids.size(); i++) {
-    if(train_trg_next.size() == 0)
-      first_size = train_trg[train_ids[i]].size();
-    train_trg_next.push_back(train_trg[train_ids[i]]);
-    if(train_cache.size())
-      train_cache_next.push_back(train_cache[train_ids[i]]);
-    if((train_trg_next.size()+1) * first_size > max_size) {
-      train_trg_minibatch.push_back(train_trg_next);
-      train_trg_next.clear();
-      if(train_cache.size()) {
-        train_cache_minibatch.push_back(train_cache_next);
-        train_cache_next.clear();
-      }
+  std::vector<std::vector<size_t> > minibatch_ids;
+  LamtramTrain::SplitMinibatches(train_ids, max_size, padded_budget,
+                                 [&](size_t id) { return std::make_pair((size_t)0, train_trg[id].size()); },
+                                 minibatch_ids);
+  for(auto & ids : minibatch_ids) {
+    train_trg_minibatch.push_back(std::vector<Sentence>());
+    if(train_cache.size()) train_cache_minibatch.push_back(std::vector<Sentence>());
+    for(size_t id : ids) {
+      train_trg_minibatch.back().push_back(train_trg[id]);
+      if(train_cache.size()) train_cache_minibatch.back().push_back(train_cache[id]);
     }
   }
-  if(train_trg_next.size())   train_trg_minibatch.push_back(train_trg_next);
-  if(train_cache_next.size()) train_cache_minibatch.push_back(train_cache_next);
 }
 
 void LamtramTrain::TrainLM() {
@@ -297,9 +480,7 @@ void LamtramTrain::TrainLM() {
   std::shared_ptr<ParameterCollection> model;
   std::shared_ptr<NeuralLM> nlm;
   if(model_in_file_.size()) {
-    nlm.reset(ModelUtils::LoadMonolingualModel<NeuralLM>(model_in_file_, model, vocab_trg));
-    TextFileLoader loader(model_in_file_ + ".data");
-    loader.populate(*model);
+    nlm.reset(ModelUtils::LoadMonolingualModelAndParams<NeuralLM>(model_in_file_, model, vocab_trg));
   } else {
     vocab_trg.reset(CreateNewDict());
     model.reset(new ParameterCollection);
@@ -334,9 +515,9 @@ void LamtramTrain::TrainLM() {
   // Create minibatches
   vector<vector<Sentence> > train_trg_minibatch, train_cache_minibatch, dev_trg_minibatch, dev_cache_minibatch;
   vector<Sentence> empty_minibatch;
-  CreateMinibatches(train_trg, train_cache, vm_["minibatch_size"].as<int>(), train_trg_minibatch, train_cache_minibatch);
+  CreateMinibatches(train_trg, train_cache, vm_["minibatch_size"].as<int>(), padded_budget_, train_trg_minibatch, train_cache_minibatch);
   // CreateMinibatches(dev_trg, empty_minibatch, vm_["minibatch_size"].as<int>(), dev_trg_minibatch, dev_cache_minibatch);
-  CreateMinibatches(dev_trg, empty_minibatch, 1, dev_trg_minibatch, dev_cache_minibatch);
+  CreateMinibatches(dev_trg, empty_minibatch, dev_minibatch_size_, padded_budget_, dev_trg_minibatch, dev_cache_minibatch);
   
   // TODO: Learning rate
   float learning_rate = vm_["learning_rate"].as<float>();
@@ -344,25 +525,89 @@ void LamtramTrain::TrainLM() {
   // Create a sentence list and random generator
   std::vector<int> train_ids(train_trg_minibatch.size());
   std::iota(train_ids.begin(), train_ids.end(), 0);
+  // Fork the data-parallel processes, which each take one minibatch of every step
+  DataParallelPtr parallel;
+  if(train_procs_ > 1)
+    parallel.reset(new DataParallel(train_procs_, vm_["train_async"].as<bool>(), *model));
+  int rank = (parallel.get() != nullptr ? parallel->GetRank() : 0);
   // Perform the training
   std::vector<Expression> empty_hist;
   float last_loss = 1e99, best_loss = 1e99;
   bool is_likelihood = (softmax_sig_ != "hinge");
   bool do_dev = dev_trg.size() != 0;
+  bool background_dev = do_dev && dev_background_;
   int loc = 0, sent_loc = 0, last_print = 0;
   float epoch_frac = 0.f, samp_prob = 0.f;
   int epoch = 0;
+  // Evaluate on the dev set, each data-parallel process taking part of it
+  auto eval_dev = [&](LLStats & dev_ll) {
+    Timer time;
+    nlm->SetDropout(0.f);
+    for(int i = rank; i < (int)dev_trg_minibatch.size(); i += train_procs_) {
+      ComputationGraph cg;
+      nlm->NewGraph(cg);
+      Expression loss_exp = nlm->BuildSentGraph(dev_trg_minibatch[i], empty_minibatch, nullptr, NULL, empty_hist, 0.f, false, cg, dev_ll);
+      dev_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+    }
+    dev_ll = SumStats(parallel.get(), dev_ll);
+    float elapsed = time.Elapsed();
+    if(rank == 0)
+      cerr << "Epoch " << epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << dev_ll.words_/elapsed << " w/s)" << endl;
+  };
+  auto write_model = [&]() {
+    cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
+    // Write the model (TODO: move this to a separate file?)
+    ostringstream out;
+    WriteDict(*vocab_trg, out);
+    // vocab_trg->Write(out);
+    nlm->Write(out);
+    ModelUtils::WriteModel(model_out_file_, out.str(), *model, model_binary_);
+  };
+  BackgroundTask dev_task;
   std::shuffle(train_ids.begin(), train_ids.end(), *rndeng);
+  if(parallel.get() != nullptr) parallel->SplitRandom();
+  // Continue from a checkpoint, replacing the state set up above
+  TrainingState state;
+  int start_sent_loc = 0, num_evals = 0, sents_since_checkpoint = 0;
+  bool resume_stats = false;
+  if(resume_) {
+    Checkpoint::Read(checkpoint_file_, state, *model, *trainer);
+    if(state.order.size() != train_ids.size())
+      THROW_ERROR("The checkpoint has " << state.order.size() << " minibatches, but the training data has " << train_ids.size());
+    train_ids.assign(state.order.begin(), state.order.end());
+    epoch = state.epoch; loc = state.loc; sent_loc = state.sent_loc; last_print = sent_loc / 100;
+    start_sent_loc = state.curr_sent_loc; num_evals = state.num_evals;
+    epoch_frac = state.epoch_frac; learning_rate = state.learning_rate;
+    last_loss = state.last_loss; best_loss = state.best_loss;
+    resume_stats = true;
+    cerr << "*** Resuming from " << checkpoint_file_ << " at epoch " << epoch+1 << " sent " << sent_loc << endl;
+  }
+  auto write_checkpoint = [&](int curr_sent_loc, const LLStats & train_ll) {
+    state.epoch = epoch; state.loc = loc; state.sent_loc = sent_loc;
+    state.curr_sent_loc = curr_sent_loc; state.num_evals = num_evals;
+    state.epoch_frac = epoch_frac; state.learning_rate = learning_rate;
+    state.last_loss = last_loss; state.best_loss = best_loss;
+    state.words = train_ll.words_; state.unk = train_ll.unk_; state.correct = train_ll.correct_; state.loss = train_ll.loss_;
+    state.order.assign(train_ids.begin(), train_ids.end());
+    Checkpoint::Write(checkpoint_file_, state, *model, *trainer);
+    sents_since_checkpoint = 0;
+  };
   while(true) {
     // Start the training
     LLStats train_ll(nlm->GetVocabSize()), dev_ll(nlm->GetVocabSize());
     train_ll.is_likelihood_ = is_likelihood; dev_ll.is_likelihood_ = is_likelihood;
+    if(resume_stats) {
+      train_ll.words_ = state.words; train_ll.unk_ = state.unk; train_ll.correct_ = state.correct; train_ll.loss_ = state.loss;
+      resume_stats = false;
+    }
     Timer time;
     nlm->SetDropout(dropout_);
-    for(int curr_sent_loc = 0; curr_sent_loc < eval_every_; ) {
-      if(loc == (int)train_ids.size()) {
-        // Shuffle the access order
+    for(int curr_sent_loc = start_sent_loc; curr_sent_loc < eval_every_; ) {
+      if(loc >= (int)train_ids.size()) {
+        // Shuffle the access order, in the same way for all processes
+        if(parallel.get() != nullptr) parallel->SyncRandom();
         std::shuffle(train_ids.begin(), train_ids.end(), *rndeng);
+        if(parallel.get() != nullptr) parallel->SplitRandom();
         loc = 0;
         sent_loc = 0;
         last_print = 0;
@@ -373,64 +618,91 @@ void LamtramTrain::TrainLM() {
         float val = (epoch_frac-scheduled_samp_)/scheduled_samp_;
         samp_prob = 1/(1+exp(val));
       }
-      ComputationGraph cg;
-      nlm->NewGraph(cg);
-      Expression loss_exp = nlm->BuildSentGraph(train_trg_minibatch[train_ids[loc]], (train_cache_minibatch.size() ? train_cache_minibatch[train_ids[loc]] : empty_minibatch), nullptr, NULL, empty_hist, samp_prob, true, cg, train_ll);
-      sent_loc += train_trg_minibatch[train_ids[loc]].size();
-      curr_sent_loc += train_trg_minibatch[train_ids[loc]].size();
-      epoch_frac += 1.f/train_ids.size();
-      // cg.PrintGraphviz();
-      train_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-      cg.backward(loss_exp);
-      trainer->update();
-      ++loc;
+      // With data-parallel training, a step is one minibatch for each process
+      int step_size = min(train_procs_, (int)train_ids.size() - loc);
+      for(int i = 0; i < step_size; i++) {
+        sent_loc += train_trg_minibatch[train_ids[loc+i]].size();
+        curr_sent_loc += train_trg_minibatch[train_ids[loc+i]].size();
+        sents_since_checkpoint += train_trg_minibatch[train_ids[loc+i]].size();
+      }
+      if(rank < step_size) {
+        ComputationGraph cg;
+        nlm->NewGraph(cg);
+        int mb_id = train_ids[loc+rank];
+        Expression loss_exp = nlm->BuildSentGraph(train_trg_minibatch[mb_id], (train_cache_minibatch.size() ? train_cache_minibatch[mb_id] : empty_minibatch), nullptr, NULL, empty_hist, samp_prob, true, cg, train_ll);
+        // cg.PrintGraphviz();
+        train_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+        cg.backward(loss_exp);
+      }
+      epoch_frac += (float)step_size/train_ids.size();
+      // Asynchronous processes without a minibatch have nothing to update
+      if(parallel.get() == nullptr)
+        trainer->update();
+      else if(rank < step_size || !parallel->IsAsync())
+        parallel->Update(*trainer);
+      loc += step_size;
       if(sent_loc / 100 != last_print || curr_sent_loc >= eval_every_ || epochs_ == epoch) {
         last_print = sent_loc / 100;
         float elapsed = time.Elapsed();
-        cerr << "Epoch " << epoch+1 << " sent " << sent_loc << ": " << train_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << train_ll.words_/elapsed << " w/s)" << endl;
+        // Asynchronous processes don't wait for each other, so only show the first one
+        LLStats print_ll = (parallel.get() != nullptr && parallel->IsAsync() ? train_ll : SumStats(parallel.get(), train_ll));
+        if(rank == 0)
+          cerr << "Epoch " << epoch+1 << " sent " << sent_loc << ": " << print_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << print_ll.words_/elapsed << " w/s)" << endl;
         if(epochs_ == epoch) break;
       }
+      if(checkpoint_every_ > 0 && sents_since_checkpoint >= checkpoint_every_)
+        write_checkpoint(curr_sent_loc, train_ll);
     }
-    // Measure development perplexity
-    if(do_dev) {
-      time = Timer();
-      nlm->SetDropout(0.f);
-      for(auto & sent : dev_trg_minibatch) {
-        ComputationGraph cg;
-        nlm->NewGraph(cg);
-        Expression loss_exp = nlm->BuildSentGraph(sent, empty_minibatch, nullptr, NULL, empty_hist, 0.f, false, cg, dev_ll);
-        dev_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-      }
-      float elapsed = time.Elapsed();
-      cerr << "Epoch " << epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << dev_ll.words_/elapsed << " w/s)" << endl;
+    start_sent_loc = 0;
+    // Measure development perplexity, or get the result of the last evaluation
+    // in the background, which is acted on one evaluation late
+    bool have_dev = do_dev;
+    if(background_dev) {
+      have_dev = dev_task.IsRunning();
+      if(have_dev) dev_ll.loss_ = dev_task.Wait()[0];
+    } else if(do_dev) {
+      eval_dev(dev_ll);
     }
     // Adjust the learning rate
     trainer->update_epoch();
+    ++num_evals;
     // trainer->status(); cerr << endl;
     // Check the learning rate
     if(last_loss != last_loss)
       THROW_ERROR("Likelihood is not a number, dying...");
-    float my_loss = do_dev ? dev_ll.loss_ : train_ll.loss_;
-    if(my_loss > last_loss) {
-      learning_rate *= rate_decay_;
+    if(have_dev || !do_dev) {
+      // All data-parallel processes make the same decisions from the summed loss
+      float my_loss = do_dev ? dev_ll.loss_ : SumStats(parallel.get(), train_ll).loss_;
+      if(my_loss > last_loss) {
+        learning_rate *= rate_decay_;
+      }
+      last_loss = my_loss;
+      if(best_loss > my_loss) {
+        // The background evaluation has already written its snapshot
+        if(rank == 0 && !background_dev)
+          write_model();
+        // Asynchronous processes must not change the parameters while they are written
+        if(parallel.get() != nullptr && parallel->IsAsync()) parallel->Barrier();
+        best_loss = my_loss;
+      }
     }
-    last_loss = my_loss;
-    if(best_loss > my_loss) {
-      // Open the output stream
-      ofstream out(model_out_file_.c_str());
-      if(!out) THROW_ERROR("Could not open output file: " << model_out_file_);
-      cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
-      // Write the model (TODO: move this to a separate file?)
-      WriteDict(*vocab_trg, out);
-      // vocab_trg->Write(out);
-      nlm->Write(out);
-      TextFileSaver saver(model_out_file_ + ".data");
-      saver.save(*model);
-      best_loss = my_loss;
+    // Start evaluating the current parameters while training continues
+    if(background_dev) {
+      float last_best = best_loss;
+      dev_task.Start([&]() {
+        LLStats bg_ll(nlm->GetVocabSize());
+        bg_ll.is_likelihood_ = is_likelihood;
+        eval_dev(bg_ll);
+        if(last_best > bg_ll.loss_)
+          write_model();
+        return vector<double>(1, bg_ll.loss_);
+      });
     }
     // If the rate is less than the threshold
     if(learning_rate < rate_thresh_)
       break;
+    if(checkpoint_file_.size())
+      write_checkpoint(0, LLStats(nlm->GetVocabSize()));
   }
 }
 
@@ -442,37 +714,50 @@ void LamtramTrain::TrainEncDec() {
   std::shared_ptr<EncoderDecoder> encdec;
   NeuralLMPtr decoder;
   if(model_in_file_.size()) {
-    encdec.reset(ModelUtils::LoadBilingualModel<EncoderDecoder>(model_in_file_, model, vocab_src, vocab_trg));
-    TextFileLoader loader(model_in_file_ + ".data");
-    loader.populate(*model);
+    encdec.reset(ModelUtils::LoadBilingualModelAndParams<EncoderDecoder>(model_in_file_, model, vocab_src, vocab_trg));
     decoder = encdec->GetDecoderPtr();
   } else {
     vocab_src.reset(CreateNewDict());
     vocab_trg.reset(CreateNewDict());
     model.reset(new ParameterCollection);
   }
+  if(train_corpus_.get() != nullptr) GetCorpusVocab(vocab_src, vocab_trg);
   // if(!trg_sent) vocab_trg = Dict("");
 
   // Read the training files
   vector<Sentence> train_trg, dev_trg, train_src, dev_src, train_cache_ids;
   vector<int> train_trg_ids, train_src_ids;
   vector<float> train_weights, train_kickout_keep;
-  for(size_t i = 0; i < train_files_trg_.size(); i++) {
-    LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
-    train_trg_ids.resize(train_trg.size(), i);
+  if(stream_window_ > 0) {
+    // When streaming, only the vocabulary is read up front
+    if(!vocab_trg->is_frozen()) StreamingCorpus::ReadVocab(train_files_trg_, true, *vocab_trg);
+  } else {
+    for(size_t i = 0; i < train_files_trg_.size(); i++) {
+      LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
+      train_trg_ids.resize(train_trg.size(), i);
+    }
   }
   if(!vocab_trg->is_frozen()) { vocab_trg->freeze(); vocab_trg->set_unk("<unk>"); }
   if(dev_file_trg_.size()) LoadFile(dev_file_trg_, true, *vocab_trg, dev_trg);
-  for(size_t i = 0; i < train_files_src_.size(); i++) {
-    LoadFile(train_files_src_[i], false, *vocab_src, train_src);
-    train_src_ids.resize(train_src.size(), i);
+  if(stream_window_ > 0) {
+    if(!vocab_src->is_frozen()) StreamingCorpus::ReadVocab(train_files_src_, false, *vocab_src);
+  } else {
+    for(size_t i = 0; i < train_files_src_.size(); i++) {
+      LoadFile(train_files_src_[i], false, *vocab_src, train_src);
+      train_src_ids.resize(train_src.size(), i);
+    }
   }
   if(!vocab_src->is_frozen()) { vocab_src->freeze(); vocab_src->set_unk("<unk>"); }
   if(dev_file_src_.size()) LoadFile(dev_file_src_, false, *vocab_src, dev_src);
-  for(size_t i = 0; i < train_files_weights_.size(); i++)
-    LoadWeights(train_files_weights_[i], train_weights);
-  for(size_t i = 0; i < train_files_kickout_keep_.size(); i++)
-    LoadWeights(train_files_kickout_keep_[i], train_kickout_keep);
+  if(stream_window_ > 0) {
+    train_stream_.reset(new StreamingCorpus(train_files_src_, train_files_trg_, train_files_weights_, train_files_kickout_keep_,
+                                            *vocab_src, *vocab_trg, stream_window_));
+  } else {
+    for(size_t i = 0; i < train_files_weights_.size(); i++)
+      LoadWeights(train_files_weights_[i], train_weights);
+    for(size_t i = 0; i < train_files_kickout_keep_.size(); i++)
+      LoadWeights(train_files_kickout_keep_[i], train_kickout_keep);
+  }
 
   // Create the model
   if(model_in_file_.size() == 0) {
@@ -498,8 +783,9 @@ void LamtramTrain::TrainEncDec() {
 
   string crit = vm_["learning_criterion"].as<string>();
   if(crit == "ml") {
-    // If necessary, cache the softmax
-    decoder->GetSoftmax().Cache(train_trg, train_trg_ids, train_cache_ids);
+    // If necessary, cache the softmax (not possible without the whole corpus in memory)
+    if(train_stream_.get() == nullptr && train_corpus_.get() == nullptr)
+      decoder->GetSoftmax().Cache(train_trg, train_trg_ids, train_cache_ids);
     BilingualTraining(train_src,
                       train_trg,
                       train_cache_ids,
@@ -529,36 +815,49 @@ void LamtramTrain::TrainEncAtt() {
   std::shared_ptr<EncoderAttentional> encatt;
   NeuralLMPtr decoder;
   if(model_in_file_.size()) {
-    encatt.reset(ModelUtils::LoadBilingualModel<EncoderAttentional>(model_in_file_, model, vocab_src, vocab_trg));
-    TextFileLoader loader(model_in_file_ + ".data");
-    loader.populate(*model);
+    encatt.reset(ModelUtils::LoadBilingualModelAndParams<EncoderAttentional>(model_in_file_, model, vocab_src, vocab_trg));
     decoder = encatt->GetDecoderPtr();
   } else {
     vocab_src.reset(CreateNewDict());
     vocab_trg.reset(CreateNewDict());
     model.reset(new ParameterCollection);
   }
+  if(train_corpus_.get() != nullptr) GetCorpusVocab(vocab_src, vocab_trg);
 
   // Read the training file
   vector<Sentence> train_trg, dev_trg, train_src, dev_src, train_cache_ids;
   vector<int> train_trg_ids, train_src_ids;
   vector<float> train_weights, train_kickout_keep;
-  for(size_t i = 0; i < train_files_trg_.size(); i++) {
-    LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
-    train_trg_ids.resize(train_trg.size(), i);
+  if(stream_window_ > 0) {
+    // When streaming, only the vocabulary is read up front
+    if(!vocab_trg->is_frozen()) StreamingCorpus::ReadVocab(train_files_trg_, true, *vocab_trg);
+  } else {
+    for(size_t i = 0; i < train_files_trg_.size(); i++) {
+      LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
+      train_trg_ids.resize(train_trg.size(), i);
+    }
   }
   if(!vocab_trg->is_frozen()) { vocab_trg->freeze(); vocab_trg->set_unk("<unk>"); }
   if(dev_file_trg_.size()) LoadFile(dev_file_trg_, true, *vocab_trg, dev_trg);
-  for(size_t i = 0; i < train_files_src_.size(); i++) {
-    LoadFile(train_files_src_[i], false, *vocab_src, train_src);
-    train_src_ids.resize(train_src.size(), i);
+  if(stream_window_ > 0) {
+    if(!vocab_src->is_frozen()) StreamingCorpus::ReadVocab(train_files_src_, false, *vocab_src);
+  } else {
+    for(size_t i = 0; i < train_files_src_.size(); i++) {
+      LoadFile(train_files_src_[i], false, *vocab_src, train_src);
+      train_src_ids.resize(train_src.size(), i);
+    }
   }
   if(!vocab_src->is_frozen()) { vocab_src->freeze(); vocab_src->set_unk("<unk>"); }
   if(dev_file_src_.size()) LoadFile(dev_file_src_, false, *vocab_src, dev_src);
-  for(size_t i = 0; i < train_files_weights_.size(); i++)
-    LoadWeights(train_files_weights_[i], train_weights);
-  for(size_t i = 0; i < train_files_kickout_keep_.size(); i++)
-    LoadWeights(train_files_kickout_keep_[i], train_kickout_keep);
+  if(stream_window_ > 0) {
+    train_stream_.reset(new StreamingCorpus(train_files_src_, train_files_trg_, train_files_weights_, train_files_kickout_keep_,
+                                            *vocab_src, *vocab_trg, stream_window_));
+  } else {
+    for(size_t i = 0; i < train_files_weights_.size(); i++)
+      LoadWeights(train_files_weights_[i], train_weights);
+    for(size_t i = 0; i < train_files_kickout_keep_.size(); i++)
+      LoadWeights(train_files_kickout_keep_[i], train_kickout_keep);
+  }
 
   // Create the model
   if(model_in_file_.size() == 0) {
@@ -583,8 +882,9 @@ void LamtramTrain::TrainEncAtt() {
 
   string crit = vm_["learning_criterion"].as<string>();
   if(crit == "ml") {
-    // If necessary, cache the softmax
-    decoder->GetSoftmax().Cache(train_trg, train_trg_ids, train_cache_ids);
+    // If necessary, cache the softmax (not possible without the whole corpus in memory)
+    if(train_stream_.get() == nullptr && train_corpus_.get() == nullptr)
+      decoder->GetSoftmax().Cache(train_trg, train_trg_ids, train_cache_ids);
     BilingualTraining(train_src,
                       train_trg,
                       train_cache_ids,
@@ -613,9 +913,7 @@ void LamtramTrain::TrainEncCls() {
   std::shared_ptr<ParameterCollection> model;
   std::shared_ptr<EncoderClassifier> enccls;
   if(model_in_file_.size()) {
-    enccls.reset(ModelUtils::LoadBilingualModel<EncoderClassifier>(model_in_file_, model, vocab_src, vocab_trg));
-    TextFileLoader loader(model_in_file_ + ".data");
-    loader.populate(*model);
+    enccls.reset(ModelUtils::LoadBilingualModelAndParams<EncoderClassifier>(model_in_file_, model, vocab_src, vocab_trg));
   } else {
     vocab_src.reset(CreateNewDict());
     vocab_trg.reset(CreateNewDict(false));
@@ -704,31 +1002,59 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
   vector<float> dev_kickout_keep; // For now, use empty vector to indicate no kickout for dev set
   vector<Sentence> empty_minibatch;
   std::vector<OutputType> empty_cache;
+  // With a binary corpus, minibatches are sentence ids that are read into the corpus_ vectors when used
+  vector<vector<size_t> > train_corpus_minibatch;
+  vector<Sentence> corpus_src;
+  vector<OutputType> corpus_trg;
+  vector<float> corpus_weights;
   size_t minibatch_size = vm_["minibatch_size"].as<int>();
-  size_t train_instances = CreateMinibatches(train_src,
-                                             train_trg,
-                                             train_cache,
-                                             train_weights,
-                                             train_kickout_keep,
-                                             minibatch_size,
-                                             train_src_minibatch,
-                                             train_trg_minibatch,
-                                             train_cache_minibatch,
-                                             train_weights_minibatch,
-                                             train_ids_minibatch);
-  if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
+  size_t train_instances = 0;
+  // The size of a streamed corpus isn't known, so evaluate at the end of each pass over it
+  bool eval_each_epoch = (train_stream_.get() != nullptr && vm_["eval_every"].as<int>() == -1);
+  if(train_stream_.get() != nullptr) {
+    if(!CreateStreamMinibatches(*train_stream_, minibatch_size, padded_budget_, train_src_minibatch, train_trg_minibatch,
+                                train_cache_minibatch, train_weights_minibatch, train_ids_minibatch))
+      THROW_ERROR("The training corpus is empty");
+    if(eval_each_epoch) eval_every_ = INT_MAX;
+  } else if(train_corpus_.get() != nullptr) {
+    train_instances = CreateCorpusMinibatches(*train_corpus_, minibatch_size, padded_budget_, train_corpus_minibatch, train_ids_minibatch);
+    if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
+  } else {
+    train_instances = CreateMinibatches(train_src,
+                                        train_trg,
+                                        train_cache,
+                                        train_weights,
+                                        train_kickout_keep,
+                                        minibatch_size,
+                                        padded_budget_,
+                                        train_src_minibatch,
+                                        train_trg_minibatch,
+                                        train_cache_minibatch,
+                                        train_weights_minibatch,
+                                        train_ids_minibatch);
+    if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
+  }
   CreateMinibatches(dev_src,
                     dev_trg,
                     empty_cache,
                     dev_weights,
                     dev_kickout_keep,
-                    1,
+                    dev_minibatch_size_,
+                    padded_budget_,
                     dev_src_minibatch,
                     dev_trg_minibatch,
                     dev_cache_minibatch,
                     dev_weights_minibatch,
                     dev_ids_minibatch);
   TrainerPtr trainer = GetTrainer(vm_["trainer"].as<string>(), vm_["learning_rate"].as<float>(), model);
+  // Fork the data-parallel processes, which each take one minibatch of every step
+  DataParallelPtr parallel;
+  if(train_procs_ > 1)
+    parallel.reset(new DataParallel(train_procs_, vm_["train_async"].as<bool>(), model));
+  int rank = (parallel.get() != nullptr ? parallel->GetRank() : 0);
+  auto minibatch_sents = [&](size_t mb_id) {
+    return (train_corpus_.get() != nullptr ? train_corpus_minibatch[mb_id].size() : train_trg_minibatch[mb_id].size());
+  };
   
   // Learning rate
   float learning_rate = vm_["learning_rate"].as<float>();
@@ -741,152 +1067,291 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
   float last_loss = 1e99, best_loss = 1e99;
   bool is_likelihood = (softmax_sig_ != "hinge");
   bool do_dev = dev_src.size() != 0;
+  bool background_dev = do_dev && dev_background_;
   int loc = 0, epoch = 0, sent_loc = 0, last_print = 0;
   float epoch_frac = 0.f, samp_prob = 0.f;
+  // Evaluate on the dev set, each data-parallel process taking part of it
+  auto eval_dev = [&](LLStats & dev_ll) {
+    Timer time;
+    std::vector<OutputType> empty_cache;
+    encdec.SetDropout(0.f);
+    for(int i = rank; i < (int)dev_src_minibatch.size(); i += train_procs_) {
+      ComputationGraph cg;
+      encdec.NewGraph(cg);
+      // encdec.BuildSentGraph(dev_src[i], dev_trg[i], empty_cache, false, cg, dev_ll);
+      Expression loss_exp = encdec.BuildSentGraph(dev_src_minibatch[i], dev_trg_minibatch[i], empty_cache, nullptr, 0.f, false, cg, dev_ll);
+      dev_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+    }
+    dev_ll = SumStats(parallel.get(), dev_ll);
+    float elapsed = time.Elapsed();
+    if(rank == 0)
+      cerr << "Epoch " << epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << dev_ll.words_/elapsed << " w/s)" << endl;
+  };
+  auto write_model = [&]() {
+    cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
+    // Write the model (TODO: move this to a separate file?)
+    ostringstream out;
+    WriteDict(vocab_src, out);
+    WriteDict(vocab_trg, out);
+    encdec.Write(out);
+    ModelUtils::WriteModel(model_out_file_, out.str(), model, model_binary_);
+  };
+  BackgroundTask dev_task;
   // Shuffle minibatches
   std::shuffle(train_ids_minibatch.begin(), train_ids_minibatch.end(), *rndeng);
+  if(parallel.get() != nullptr) parallel->SplitRandom();
+  // Continue from a checkpoint, replacing the state set up above
+  TrainingState state;
+  int start_sent_loc = 0, num_evals = 0, sents_since_checkpoint = 0;
+  bool resume_stats = false;
+  if(checkpoint_file_.size() && train_corpus_.get() != nullptr && train_corpus_->HasKickoutKeep())
+    THROW_ERROR("Checkpoints can't be combined with kickout");
+  if(resume_) {
+    Checkpoint::Read(checkpoint_file_, state, model, *trainer);
+    if(state.order.size() != train_ids_minibatch.size())
+      THROW_ERROR("The checkpoint has " << state.order.size() << " minibatches, but the training data has " << train_ids_minibatch.size());
+    train_ids_minibatch.assign(state.order.begin(), state.order.end());
+    epoch = state.epoch; loc = state.loc; sent_loc = state.sent_loc; last_print = sent_loc / 100;
+    start_sent_loc = state.curr_sent_loc; num_evals = state.num_evals;
+    evals_since_improvement = state.evals_since_improvement;
+    epoch_frac = state.epoch_frac; learning_rate = state.learning_rate;
+    last_loss = state.last_loss; best_loss = state.best_loss;
+    resume_stats = true;
+    cerr << "*** Resuming from " << checkpoint_file_ << " at epoch " << epoch+1 << " sent " << sent_loc << endl;
+  }
+  auto write_checkpoint = [&](int curr_sent_loc, const LLStats & train_ll) {
+    state.epoch = epoch; state.loc = loc; state.sent_loc = sent_loc;
+    state.curr_sent_loc = curr_sent_loc; state.num_evals = num_evals;
+    state.evals_since_improvement = evals_since_improvement;
+    state.epoch_frac = epoch_frac; state.learning_rate = learning_rate;
+    state.last_loss = last_loss; state.best_loss = best_loss;
+    state.words = train_ll.words_; state.unk = train_ll.unk_; state.correct = train_ll.correct_; state.loss = train_ll.loss_;
+    state.order.assign(train_ids_minibatch.begin(), train_ids_minibatch.end());
+    Checkpoint::Write(checkpoint_file_, state, model, *trainer);
+    sents_since_checkpoint = 0;
+  };
   while(true) {
     // Start the training
     LLStats train_ll(vocab_trg.size()), dev_ll(vocab_trg.size());
     train_ll.is_likelihood_ = is_likelihood; dev_ll.is_likelihood_ = is_likelihood;
+    if(resume_stats) {
+      train_ll.words_ = state.words; train_ll.unk_ = state.unk; train_ll.correct_ = state.correct; train_ll.loss_ = state.loss;
+      resume_stats = false;
+    }
     Timer time;
     encdec.SetDropout(dropout_);
-    for(int curr_sent_loc = 0; curr_sent_loc < eval_every_; ) {
-      if(loc == (int)train_ids_minibatch.size()) {
-        if(train_kickout_keep.size()) {
-          train_instances = CreateMinibatches(train_src,
-                                              train_trg,
-                                              train_cache,
-                                              train_weights,
-                                              train_kickout_keep,
-                                              minibatch_size,
-                                              train_src_minibatch,
-                                              train_trg_minibatch,
-                                              train_cache_minibatch,
-                                              train_weights_minibatch,
-                                              train_ids_minibatch);
-          // Changes each epoch, so check against original param for -1
-          if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
+    for(int curr_sent_loc = start_sent_loc; curr_sent_loc < eval_every_; ) {
+      if(loc >= (int)train_ids_minibatch.size()) {
+        // All processes must shuffle in the same way
+        if(parallel.get() != nullptr) parallel->SyncRandom();
+        // A streamed corpus moves on to its next window, and the epoch ends with the last one
+        if(train_stream_.get() != nullptr && CreateStreamMinibatches(*train_stream_, minibatch_size, padded_budget_, train_src_minibatch, train_trg_minibatch,
+                                                                     train_cache_minibatch, train_weights_minibatch, train_ids_minibatch)) {
+          std::shuffle(train_ids_minibatch.begin(), train_ids_minibatch.end(), *rndeng);
+          loc = 0;
+        } else {
+          if(train_stream_.get() != nullptr) {
+            CreateStreamMinibatches(*train_stream_, minibatch_size, padded_budget_, train_src_minibatch, train_trg_minibatch,
+                                    train_cache_minibatch, train_weights_minibatch, train_ids_minibatch);
+          } else if(train_kickout_keep.size()) {
+            train_instances = CreateMinibatches(train_src,
+                                                train_trg,
+                                                train_cache,
+                                                train_weights,
+                                                train_kickout_keep,
+                                                minibatch_size,
+                                                padded_budget_,
+                                                train_src_minibatch,
+                                                train_trg_minibatch,
+                                                train_cache_minibatch,
+                                                train_weights_minibatch,
+                                                train_ids_minibatch);
+            // Changes each epoch, so check against original param for -1
+            if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
+          } else if(train_corpus_.get() != nullptr && train_corpus_->HasKickoutKeep()) {
+            train_instances = CreateCorpusMinibatches(*train_corpus_, minibatch_size, padded_budget_, train_corpus_minibatch, train_ids_minibatch);
+            if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
+          }
+          // Shuffle the access order
+          std::shuffle(train_ids_minibatch.begin(), train_ids_minibatch.end(), *rndeng);
+          if(parallel.get() != nullptr) parallel->SplitRandom();
+          loc = 0;
+          sent_loc = 0;
+          last_print = 0;
+          ++epoch;
+          if(epoch >= epochs_) return;
+          if(eval_each_epoch) break;
         }
-        // Shuffle the access order
-        std::shuffle(train_ids_minibatch.begin(), train_ids_minibatch.end(), *rndeng);
-        loc = 0;
-        sent_loc = 0;
-        last_print = 0;
-        ++epoch;
-        if(epoch >= epochs_) return;
       }
-      ComputationGraph cg;
-      encdec.NewGraph(cg);
-      // encdec.BuildSentGraph(train_src[train_ids[loc]], train_trg[train_ids[loc]], train_cache[train_ids[loc]], true, cg, train_ll);
       if(scheduled_samp_) {
         float val = (epoch_frac-scheduled_samp_)/scheduled_samp_;
         samp_prob = 1/(1+exp(val));
       }
-      Expression loss_exp = encdec.BuildSentGraph(
-          train_src_minibatch[train_ids_minibatch[loc]],
-          train_trg_minibatch[train_ids_minibatch[loc]],
-          (train_cache_minibatch.size() ? train_cache_minibatch[train_ids_minibatch[loc]] : empty_cache),
-          (train_weights_minibatch.size() ? &train_weights_minibatch[train_ids_minibatch[loc]] : nullptr),
-          samp_prob,
-          true,
-          cg,
-          train_ll);
-      sent_loc += train_trg_minibatch[train_ids_minibatch[loc]].size();
-      curr_sent_loc += train_trg_minibatch[train_ids_minibatch[loc]].size();
-      epoch_frac += 1.f/train_ids_minibatch.size();
-      // cg.PrintGraphviz();
-      train_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-      cg.backward(loss_exp);
-      trainer->update();
-      ++loc;
+      // With data-parallel training, a step is one minibatch for each process, and
+      // a process without one at the end of the epoch just adds zero gradients
+      int step_size = min(train_procs_, (int)train_ids_minibatch.size() - loc);
+      for(int i = 0; i < step_size; i++) {
+        sent_loc += minibatch_sents(train_ids_minibatch[loc+i]);
+        curr_sent_loc += minibatch_sents(train_ids_minibatch[loc+i]);
+        sents_since_checkpoint += minibatch_sents(train_ids_minibatch[loc+i]);
+      }
+      if(rank < step_size) {
+        ComputationGraph cg;
+        encdec.NewGraph(cg);
+        // encdec.BuildSentGraph(train_src[train_ids[loc]], train_trg[train_ids[loc]], train_cache[train_ids[loc]], true, cg, train_ll);
+        size_t mb_id = train_ids_minibatch[loc+rank];
+        if(train_corpus_.get() != nullptr)
+          ReadCorpusMinibatch(*train_corpus_, train_corpus_minibatch[mb_id], corpus_src, corpus_trg, corpus_weights);
+        const vector<Sentence> & mb_src = (train_corpus_.get() != nullptr ? corpus_src : train_src_minibatch[mb_id]);
+        const vector<OutputType> & mb_trg = (train_corpus_.get() != nullptr ? corpus_trg : train_trg_minibatch[mb_id]);
+        const vector<float> * mb_weights = (train_corpus_.get() != nullptr ? (corpus_weights.size() ? &corpus_weights : nullptr) :
+                                            (train_weights_minibatch.size() ? &train_weights_minibatch[mb_id] : nullptr));
+        Expression loss_exp = encdec.BuildSentGraph(
+            mb_src,
+            mb_trg,
+            (train_cache_minibatch.size() ? train_cache_minibatch[mb_id] : empty_cache),
+            mb_weights,
+            samp_prob,
+            true,
+            cg,
+            train_ll);
+        // cg.PrintGraphviz();
+        train_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+        cg.backward(loss_exp);
+      }
+      epoch_frac += (float)step_size/train_ids_minibatch.size();
+      // Asynchronous processes without a minibatch have nothing to update
+      if(parallel.get() == nullptr)
+        trainer->update();
+      else if(rank < step_size || !parallel->IsAsync())
+        parallel->Update(*trainer);
+      loc += step_size;
       if(sent_loc / 100 != last_print || curr_sent_loc >= eval_every_ || epochs_ == epoch) {
         last_print = sent_loc / 100;
         float elapsed = time.Elapsed();
-        cerr << "Epoch " << epoch+1 << " sent " << sent_loc << ": " << train_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << train_ll.words_/elapsed << " w/s)" << endl;
+        // Asynchronous processes don't wait for each other, so only show the first one
+        LLStats print_ll = (parallel.get() != nullptr && parallel->IsAsync() ? train_ll : SumStats(parallel.get(), train_ll));
+        if(rank == 0)
+          cerr << "Epoch " << epoch+1 << " sent " << sent_loc << ": " << print_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << print_ll.words_/elapsed << " w/s)" << endl;
         if(epochs_ == epoch) break;
       }
+      if(checkpoint_every_ > 0 && sents_since_checkpoint >= checkpoint_every_)
+        write_checkpoint(curr_sent_loc, train_ll);
     }
-    // Measure development perplexity
-    if(do_dev) {
-      time = Timer();
-      std::vector<OutputType> empty_cache;
-      encdec.SetDropout(0.f);
-      for(int i : boost::irange(0, (int)dev_src_minibatch.size())) {
-        ComputationGraph cg;
-        encdec.NewGraph(cg);
-        // encdec.BuildSentGraph(dev_src[i], dev_trg[i], empty_cache, false, cg, dev_ll);
-        Expression loss_exp = encdec.BuildSentGraph(dev_src_minibatch[i], dev_trg_minibatch[i], empty_cache, nullptr, 0.f, false, cg, dev_ll);
-        dev_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-      }
-      float elapsed = time.Elapsed();
-      cerr << "Epoch " << epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_rate << ", time=" << elapsed << " (" << dev_ll.words_/elapsed << " w/s)" << endl;
+    start_sent_loc = 0;
+    // Measure development perplexity, or get the result of the last evaluation
+    // in the background, which is acted on one evaluation late
+    bool have_dev = do_dev;
+    if(background_dev) {
+      have_dev = dev_task.IsRunning();
+      if(have_dev) dev_ll.loss_ = dev_task.Wait()[0];
+    } else if(do_dev) {
+      eval_dev(dev_ll);
     }
     // Adjust the learning rate
     trainer->update_epoch();
+    ++num_evals;
     // trainer->status(); cerr << endl;
     // Check the learning rate
     if(last_loss != last_loss)
       THROW_ERROR("Likelihood is not a number, dying...");
-    float my_loss = do_dev ? dev_ll.loss_ : train_ll.loss_;
-    if(my_loss > last_loss)
-      learning_rate *= rate_decay_;
-    last_loss = my_loss;
-    // Open the output stream
-    if(best_loss > my_loss) {
-      ofstream out(model_out_file_.c_str());
-      if(!out) THROW_ERROR("Could not open output file: " << model_out_file_);
-      cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
-      // Write the model (TODO: move this to a separate file?)
-      WriteDict(vocab_src, out);
-      WriteDict(vocab_trg, out);
-      encdec.Write(out);
-      TextFileSaver saver(model_out_file_ + ".data");
-      saver.save(model);
-      best_loss = my_loss;
-      evals_since_improvement = 0;
-    } else {
-      ++evals_since_improvement;
-      if(early_stop != -1 && evals_since_improvement == early_stop) {
-        cerr << "No improvement in " << evals_since_improvement << " evals, stopping early" << endl;
-        break;
+    if(have_dev || !do_dev) {
+      // All data-parallel processes make the same decisions from the summed loss
+      float my_loss = do_dev ? dev_ll.loss_ : SumStats(parallel.get(), train_ll).loss_;
+      if(my_loss > last_loss)
+        learning_rate *= rate_decay_;
+      last_loss = my_loss;
+      // Open the output stream
+      if(best_loss > my_loss) {
+        // The background evaluation has already written its snapshot
+        if(rank == 0 && !background_dev)
+          write_model();
+        // Asynchronous processes must not change the parameters while they are written
+        if(parallel.get() != nullptr && parallel->IsAsync()) parallel->Barrier();
+        best_loss = my_loss;
+        evals_since_improvement = 0;
+      } else {
+        ++evals_since_improvement;
+        if(early_stop != -1 && evals_since_improvement == early_stop) {
+          if(rank == 0)
+            cerr << "No improvement in " << evals_since_improvement << " evals, stopping early" << endl;
+          break;
+        }
       }
     }
+    // Start evaluating the current parameters while training continues
+    if(background_dev) {
+      float last_best = best_loss;
+      dev_task.Start([&]() {
+        LLStats bg_ll(vocab_trg.size());
+        bg_ll.is_likelihood_ = is_likelihood;
+        eval_dev(bg_ll);
+        if(last_best > bg_ll.loss_)
+          write_model();
+        return vector<double>(1, bg_ll.loss_);
+      });
+    }
     // If the rate is less than the threshold
     if(learning_rate < rate_thresh_)
       break;
+    if(checkpoint_file_.size())
+      write_checkpoint(0, LLStats(vocab_trg.size()));
   }
 }
 
-inline Expression CalcRisk(const Sentence & ref,
-                                      const vector<Sentence> & trg_samples,
-                                      Expression trg_log_probs,
-                                      const EvalMeasure & eval,
-                                      float scaling,
-                                      bool dedup,
-                                      ComputationGraph & cg) {
+// Score the samples of each sentence against its reference. Only the first of
+// several identical samples is scored, and the others are masked. The scoring
+// is spread over threads if the measure allows it.
+inline void ScoreSamples(const vector<const Sentence*> & refs,
+                         const vector<vector<Sentence> > & trg_samples,
+                         const EvalMeasure & eval,
+                         int num_threads,
+                         vector<vector<float> > & eval_scores,
+                         vector<vector<float> > & masks) {
+    vector<pair<size_t,size_t> > uniq_ids;
+    eval_scores.resize(refs.size());
+    masks.resize(refs.size());
+    for(size_t i = 0; i < refs.size(); i++) {
+        eval_scores[i].assign(trg_samples[i].size(), 0.f);
+        masks[i].assign(trg_samples[i].size(), 0.f);
+        set<Sentence> sent_dup;
+        for(size_t j = 0; j < trg_samples[i].size(); j++) {
+            if(sent_dup.insert(trg_samples[i][j]).second)
+                uniq_ids.push_back(make_pair(i, j));
+            else
+                masks[i][j] = FLT_MAX;
+        }
+    }
+    auto score_ids = [&](size_t start, size_t step) {
+        for(size_t k = start; k < uniq_ids.size(); k += step) {
+            size_t i = uniq_ids[k].first, j = uniq_ids[k].second;
+            eval_scores[i][j] = eval.CalculateStats(*refs[i], trg_samples[i][j])->ConvertToScore();
+        }
+    };
+    if(num_threads > 1 && eval.IsThreadSafe() && uniq_ids.size() > 1) {
+        vector<std::thread> threads;
+        for(int t = 1; t < num_threads; t++)
+            threads.push_back(std::thread(score_ids, t, num_threads));
+        score_ids(0, num_threads);
+        for(auto & thread : threads)
+            thread.join();
+    } else {
+        score_ids(0, 1);
+    }
+}
+
+inline Expression CalcRisk(const vector<float> & eval_scores,
+                           const vector<float> & mask,
+                           Expression trg_log_probs,
+                           float scaling,
+                           ComputationGraph & cg) {
     // If scaling the distribution do it
     if(scaling != 1.f)
         trg_log_probs = trg_log_probs * scaling;
-    vector<float> trg_log_probs_vec = as_vector(trg_log_probs.value());
-    vector<float> eval_scores(trg_samples.size(), 0.f);
-    set<Sentence> sent_dup;
-    vector<float> mask(trg_samples.size(), 0.f);
-    for(size_t i = 0; i < trg_samples.size(); i++) {
-        auto it = sent_dup.find(trg_samples[i]);
-        if(it != sent_dup.end()) { 
-            mask[i] = FLT_MAX;
-        } else {
-            eval_scores[i] = eval.CalculateStats(ref, trg_samples[i])->ConvertToScore();
-            sent_dup.insert(trg_samples[i]);
-        }
-        // cerr << "i=" << i << ", tlp=" << trg_log_probs_vec[i] << ", eval=" << eval_scores[i] << ", len=" << trg_samples[i].size() << endl;
-    }
-    // cerr << "---------------------" << endl;
-    if(sent_dup.size() != trg_samples.size())
-        trg_log_probs = trg_log_probs + input(cg, Dim({(unsigned int)trg_samples.size()}), mask);
+    if(*max_element(mask.begin(), mask.end()) != 0.f)
+        trg_log_probs = trg_log_probs + input(cg, Dim({(unsigned int)mask.size()}), mask);
     // Calculate expected and return loss
-    return -input(cg, Dim({1, (unsigned int)trg_samples.size()}), eval_scores) * softmax(trg_log_probs);
+    return -input(cg, Dim({1, (unsigned int)eval_scores.size()}), eval_scores) * softmax(trg_log_probs);
 }
 
 // Performs minimimum risk training according to the following paper:
@@ -913,7 +1378,8 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
   int num_samples = vm_["minrisk_num_samples"].as<int>();
   float scaling = vm_["minrisk_scaling"].as<float>();
   bool include_ref = vm_["minrisk_include_ref"].as<bool>();
-  bool dedup = vm_["minrisk_dedup"].as<bool>();
+  int minibatch_size = vm_["minrisk_minibatch"].as<int>();
+  int eval_threads = vm_["minrisk_threads"].as<int>();
 
   // Find the span of the folds
   vector<pair<int,int> > fold_id_spans;
@@ -953,25 +1419,37 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
         ++epoch;
         if(epoch >= epochs_) return;
       }
-      // Create the graph
+      // Create the graph, with samples for a minibatch of sentences
       ComputationGraph cg;
-      encdec.GetDecoderPtr()->GetSoftmax().UpdateFold(train_fold_ids[train_ids[loc]]+1);
       encdec.NewGraph(cg);
-      // Sample sentences
-      std::vector<Sentence> trg_samples;
-      Expression trg_log_probs = encdec.SampleTrgSentences(train_src[train_ids[loc]], 
-                                                                      (include_ref ? &train_trg[train_ids[loc]] : NULL),
-                                                                      num_samples, max_len, true, cg, trg_samples);
-      Expression trg_loss = CalcRisk(train_trg[train_ids[loc]], trg_samples, trg_log_probs, eval, scaling, dedup, cg);
+      vector<const Sentence*> mb_refs;
+      vector<vector<Sentence> > mb_samples;
+      vector<Expression> mb_log_probs;
+      for(int i = 0; i < minibatch_size && loc < (int)train_ids.size(); i++, loc++) {
+        int id = train_ids[loc];
+        encdec.GetDecoderPtr()->GetSoftmax().UpdateFold(train_fold_ids[id]+1);
+        // Sample sentences
+        mb_samples.push_back(vector<Sentence>());
+        mb_log_probs.push_back(encdec.SampleTrgSentences(train_src[id],
+                                                         (include_ref ? &train_trg[id] : NULL),
+                                                         num_samples, max_len, true, cg, mb_samples.back()));
+        mb_refs.push_back(&train_trg[id]);
+      }
+      // Score all the samples at once, then sum the risk of each sentence
+      vector<vector<float> > mb_scores, mb_masks;
+      ScoreSamples(mb_refs, mb_samples, eval, eval_threads, mb_scores, mb_masks);
+      vector<Expression> mb_losses;
+      for(size_t i = 0; i < mb_refs.size(); i++)
+        mb_losses.push_back(CalcRisk(mb_scores[i], mb_masks[i], mb_log_probs[i], scaling, cg));
+      Expression trg_loss = sum(mb_losses);
       // Increment
-      sent_loc++; curr_sent_loc++;
-      epoch_frac += 1.f/train_src.size(); 
+      sent_loc += mb_refs.size(); curr_sent_loc += mb_refs.size();
+      epoch_frac += (float)mb_refs.size()/train_src.size(); 
       train_loss.loss_ += as_scalar(cg.incremental_forward(trg_loss));
-      train_loss.sents_++;
+      train_loss.sents_ += mb_refs.size();
       // cg.PrintGraphviz();
       cg.backward(trg_loss);
       trainer->update();
-      ++loc;
       if(sent_loc / 100 != last_print || curr_sent_loc >= eval_every_ || epochs_ == epoch) {
         last_print = sent_loc / 100;
         float elapsed = time.Elapsed();
@@ -987,11 +1465,13 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
           ComputationGraph cg;
           encdec.NewGraph(cg);
           // Sample sentences
-          std::vector<Sentence> trg_samples;
+          vector<vector<Sentence> > trg_samples(1);
           Expression trg_log_probs = encdec.SampleTrgSentences(dev_src[i], 
                                                                (include_ref ? &dev_trg[i] : NULL),
-                                                               num_samples, max_len, true, cg, trg_samples);
-          Expression loss_exp = CalcRisk(dev_trg[i], trg_samples, trg_log_probs, eval, scaling, dedup, cg);
+                                                               num_samples, max_len, true, cg, trg_samples[0]);
+          vector<vector<float> > eval_scores, masks;
+          ScoreSamples(vector<const Sentence*>(1, &dev_trg[i]), trg_samples, eval, eval_threads, eval_scores, masks);
+          Expression loss_exp = CalcRisk(eval_scores[0], masks[0], trg_log_probs, scaling, cg);
           dev_loss.loss_ += as_scalar(cg.incremental_forward(loss_exp));
           dev_loss.sents_++;
       }
@@ -1010,15 +1490,13 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
     last_loss = my_loss;
     // Open the output stream
     if(best_loss > my_loss) {
-      ofstream out(model_out_file_.c_str());
-      if(!out) THROW_ERROR("Could not open output file: " << model_out_file_);
       cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
       // Write the model (TODO: move this to a separate file?)
+      ostringstream out;
       WriteDict(vocab_src, out);
       WriteDict(vocab_trg, out);
       encdec.Write(out);
-      TextFileSaver saver(model_out_file_ + ".data");
-      saver.save(model);
+      ModelUtils::WriteModel(model_out_file_, out.str(), model, model_binary_);
       best_loss = my_loss;
     }
     // If the rate is less than the threshold
@@ -1027,6 +1505,19 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
   }
 }
 
+void LamtramTrain::GetCorpusVocab(DictPtr & vocab_src, DictPtr & vocab_trg) {
+  DictPtr corpus_src, corpus_trg;
+  train_corpus_->ReadVocab(corpus_src, corpus_trg);
+  if(vocab_src->is_frozen()) {
+    // The words are already ids, so they must mean the same thing as in the model
+    if(corpus_src->get_words() != vocab_src->get_words() || corpus_trg->get_words() != vocab_trg->get_words())
+      THROW_ERROR("The vocabularies of the binary corpus don't match the model, create the corpus with lamtram-prep --model_in");
+  } else {
+    vocab_src = corpus_src;
+    vocab_trg = corpus_trg;
+  }
+}
+
 void LamtramTrain::LoadFile(const std::string filename, bool add_last, Dict & vocab, std::vector<Sentence> & sents) {
   ifstream iftrain(filename.c_str());
   if(!iftrain) THROW_ERROR("Could not find training file: " << filename);
@@ -1061,17 +1552,18 @@ void LamtramTrain::LoadWeights(const std::string filename, std::vector<float> &
 }
 
 LamtramTrain::TrainerPtr LamtramTrain::GetTrainer(const std::string & trainer_id, const float learning_rate, ParameterCollection & model) {
+  // The trainers expose their state so it can be saved in checkpoints
   TrainerPtr trainer;
   if(trainer_id == "sgd") {
-    trainer.reset(new SimpleSGDTrainer(model, learning_rate));
+    trainer.reset(new CheckpointTrainer<SimpleSGDTrainer>(model, learning_rate));
   } else if(trainer_id == "momentum") {
-    trainer.reset(new MomentumSGDTrainer(model, learning_rate));
+    trainer.reset(new CheckpointTrainer<MomentumSGDTrainer>(model, learning_rate));
   } else if(trainer_id == "adagrad") {
-    trainer.reset(new AdagradTrainer(model, learning_rate));
+    trainer.reset(new CheckpointTrainer<AdagradTrainer>(model, learning_rate));
   } else if(trainer_id == "adadelta") {
-    trainer.reset(new AdadeltaTrainer(model, learning_rate));
+    trainer.reset(new CheckpointTrainer<AdadeltaTrainer>(model, learning_rate));
   } else if(trainer_id == "adam") {
-    trainer.reset(new AdamTrainer(model, learning_rate));
+    trainer.reset(new CheckpointTrainer<AdamTrainer>(model, learning_rate));
   } else {
     THROW_ERROR("Illegal trainer variety: " << trainer_id);
   }
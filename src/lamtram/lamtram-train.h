@@ -1,9 +1,14 @@
 #pragma once
 
 #include <lamtram/sentence.h>
+#include <lamtram/dict-utils.h>
 #include <dynet/tensor.h>
 #include <boost/program_options.hpp>
+#include <functional>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace dynet {
 struct Trainer;
@@ -14,6 +19,8 @@ class Dict;
 namespace lamtram {
 
 class EvalMeasure;
+class StreamingCorpus;
+class BinaryCorpus;
 
 
 class LamtramTrain {
@@ -63,6 +70,21 @@ public:
     void LoadLabels(const std::string filename, dynet::Dict & vocab, std::vector<int> & labs);
     void LoadWeights(const std::string filename, std::vector<float> & weights);
 
+    // Use the vocabularies of the binary corpus, or check that they match the ones loaded with a model
+    void GetCorpusVocab(DictPtr & vocab_src, DictPtr & vocab_trg);
+
+    // Split sentence ids that are already sorted by length into minibatches,
+    // where length(id) gives the source and target lengths of a sentence. With
+    // a padded budget, max_size is the number of source and target tokens in a
+    // minibatch including padding, and a minibatch is closed before it would
+    // go over. Otherwise, a minibatch is closed once one more sentence of its
+    // longest source plus target length would not fit.
+    static void SplitMinibatches(const std::vector<size_t> & ids,
+                                 size_t max_size,
+                                 bool padded_budget,
+                                 const std::function<std::pair<size_t,size_t>(size_t)> & length,
+                                 std::vector<std::vector<size_t> > & minibatch_ids);
+
     void LoadBothFiles(
           const std::string filename_src, dynet::Dict & vocab_src, std::vector<Sentence> & sents_src,
           const std::string filename_trg, dynet::Dict & vocab_trg, std::vector<Sentence> & sents_trg);
@@ -73,12 +95,21 @@ protected:
 
     // Variable settings
     dynet::real rate_thresh_, rate_decay_;
-    int epochs_, context_, eval_every_;
+    int epochs_, context_, eval_every_, stream_window_, train_procs_, dev_minibatch_size_;
     float scheduled_samp_, dropout_;
     std::string model_in_file_, model_out_file_;
+    bool model_binary_, padded_budget_, dev_background_;
+    // Periodic checkpoints of the full training state, and whether to resume from them
+    std::string checkpoint_file_;
+    int checkpoint_every_;
+    bool resume_;
     std::vector<std::string> train_files_trg_, train_files_src_, train_files_weights_, train_files_kickout_keep_;
     std::string dev_file_trg_, dev_file_src_;
     std::string softmax_sig_;
+    // If set, bilingual training reads the corpus from here instead of the vectors passed in
+    std::shared_ptr<StreamingCorpus> train_stream_;
+    // If set, bilingual training reads the minibatches from this mapped corpus
+    std::shared_ptr<BinaryCorpus> train_corpus_;
 
     std::vector<std::string> wildcards_;
 
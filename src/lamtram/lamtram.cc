@@ -8,17 +8,25 @@
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/encoder-classifier.h>
 #include <lamtram/model-utils.h>
+#include <lamtram/binary-model.h>
 #include <lamtram/string-util.h>
 #include <lamtram/ensemble-decoder.h>
 #include <lamtram/ensemble-classifier.h>
 #include <lamtram/mapping.h>
+#include <lamtram/worker-pool.h>
+#include <lamtram/request-server.h>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
 #include <dynet/dict.h>
 #include <dynet/io.h>
+#include <dynet/globals.h>
+#include <dynet/devices.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <numeric>
+#include <algorithm>
 
 using namespace std;
 using namespace lamtram;
@@ -77,19 +85,13 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
     shared_ptr<dynet::ParameterCollection> mod_temp;
     // Read in the model
     if(type == "encdec") {
-      EncoderDecoder * tm = ModelUtils::LoadBilingualModel<EncoderDecoder>(file, mod_temp, vocab_src_temp, vocab_trg_temp);
-      dynet::TextFileLoader loader(file + ".data");
-      loader.populate(*mod_temp);
+      EncoderDecoder * tm = ModelUtils::LoadBilingualModelAndParams<EncoderDecoder>(file, mod_temp, vocab_src_temp, vocab_trg_temp);
       encdecs.push_back(shared_ptr<EncoderDecoder>(tm));
     } else if(type == "encatt") {
-      EncoderAttentional * tm = ModelUtils::LoadBilingualModel<EncoderAttentional>(file, mod_temp, vocab_src_temp, vocab_trg_temp);
-      dynet::TextFileLoader loader(file + ".data");
-      loader.populate(*mod_temp);
+      EncoderAttentional * tm = ModelUtils::LoadBilingualModelAndParams<EncoderAttentional>(file, mod_temp, vocab_src_temp, vocab_trg_temp);
       encatts.push_back(shared_ptr<EncoderAttentional>(tm));
     } else if(type == "nlm") {
-      NeuralLM * lm = ModelUtils::LoadMonolingualModel<NeuralLM>(file, mod_temp, vocab_trg_temp);
-      dynet::TextFileLoader loader(file + ".data");
-      loader.populate(*mod_temp);
+      NeuralLM * lm = ModelUtils::LoadMonolingualModelAndParams<NeuralLM>(file, mod_temp, vocab_trg_temp);
       lms.push_back(shared_ptr<NeuralLM>(lm));
     }
     // Sanity check
@@ -103,6 +105,30 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
   }
   int vocab_size = vocab_trg->size();
 
+  // Convert a single model to the binary format
+  if(vm["operation"].as<std::string>() == "convert") {
+    if(models.size() != 1) THROW_ERROR("Can only convert a single model, but got " << models.size());
+    if(vm["model_out"].as<std::string>() == "") THROW_ERROR("Must specify an output file with --model_out");
+    ostringstream out;
+    if(vocab_src.get() != nullptr) WriteDict(*vocab_src, out);
+    WriteDict(*vocab_trg, out);
+    if(encdecs.size()) encdecs[0]->Write(out);
+    else if(encatts.size()) encatts[0]->Write(out);
+    else lms[0]->Write(out);
+    BinaryModelFile::Write(vm["model_out"].as<std::string>(), out.str(), *models[0], vm["quantize"].as<std::string>());
+    return 0;
+  }
+
+  // Score the output words with quantized weights
+  if(vm["quantize"].as<std::string>() != "") {
+    vector<NeuralLMPtr> decoders(lms);
+    for(auto & encdec : encdecs) decoders.push_back(encdec->GetDecoderPtr());
+    for(auto & encatt : encatts) decoders.push_back(encatt->GetDecoderPtr());
+    for(auto & decoder : decoders)
+      if(!decoder->GetSoftmax().Quantize(vm["quantize"].as<std::string>()))
+        THROW_ERROR("Quantization is only supported for full softmax models");
+  }
+
   // Get the mapping table if necessary
   UniqueStringMappingPtr mapping;
   if(vm["map_in"].as<std::string>() != "")
@@ -141,6 +167,19 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
   decoder.SetEnsembleOperation(vm["ensemble_op"].as<string>());
   decoder.SetBeamSize(vm["beam"].as<int>());
   decoder.SetSizeLimit(vm["max_len"].as<int>());
+  decoder.SetSizeRatio(vm["max_len_ratio"].as<float>());
+  decoder.SetSizeConst(vm["max_len_const"].as<int>());
+  decoder.SetPruneAbs(vm["beam_prune_abs"].as<float>());
+  decoder.SetPruneRel(vm["beam_prune_rel"].as<float>());
+  decoder.SetMaxCandsPerParent(vm["beam_max_cands"].as<int>());
+  if(vm["shortlist_lex"].as<int>() > 0 || vm["shortlist_freq"].as<int>() > 0) {
+    MultipleIdMappingPtr shortlist_mapping;
+    if(vm["shortlist_file"].as<string>() != "") {
+      if(vocab_src.get() == nullptr) THROW_ERROR("A shortlist file can only be used with a source sentence");
+      shortlist_mapping.reset(LoadMultipleIdMapping(vm["shortlist_file"].as<string>(), vocab_src, vocab_trg));
+    }
+    decoder.SetShortlist(vm["shortlist_lex"].as<int>(), vm["shortlist_freq"].as<int>(), shortlist_mapping);
+  }
 
   
   // Perform operation
@@ -157,6 +196,31 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
       wpout.reset(new ofstream(wpout_file));
     LLStats corpus_ll(vocab_size);
     Timer time;
+    auto add_sent = [&](const LLStats & sent_ll, const vector<float> & word_lls) {
+      if(GlobalVars::verbose >= 1) { cout << "ll=" << -sent_ll.CalcUnkLoss() << " unk=" << sent_ll.unk_  << endl; }
+      corpus_ll += sent_ll;
+      // Write word probabilities if necessary
+      if(wpout.get()) {
+        if(word_lls.size()) *wpout << -word_lls[0];
+        for(size_t i = 1; i < word_lls.size(); i++) *wpout << ' ' << -word_lls[i];
+        *wpout << endl;
+      }
+    };
+    // With a prefix trie, consecutive sentences with the same source are scored together
+    bool ppl_trie = vm["ppl_trie"].as<bool>();
+    Sentence group_src;
+    vector<Sentence> group_trg;
+    int group_words = 0;
+    auto score_group = [&]() {
+      if(group_trg.size() == 0) return;
+      vector<LLStats> sents_ll(group_trg.size(), LLStats(vocab_size));
+      vector<vector<float> > word_lls(group_trg.size());
+      decoder.CalcTrieLL(group_src, group_trg, sents_ll, word_lls);
+      for(size_t i = 0; i < group_trg.size(); i++)
+        add_sent(sents_ll[i], word_lls[i]);
+      group_trg.resize(0);
+      group_words = 0;
+    };
     while(getline(cin, line)) { 
       // Get the target, and if it exists, source sentences
       if(GlobalVars::verbose >= 2) { cerr << "SentLL trg: " << line << endl; }
@@ -170,105 +234,287 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
       last_id++;
       // If we're inside the range, do it
       if(last_id >= sent_range.first && last_id < sent_range.second) {
-        LLStats sent_ll(vocab_size);
-        vector<float> word_lls;
-        decoder.CalcSentLL<Sentence,LLStats,vector<float> >(sent_src, sent_trg, sent_ll, word_lls);
-        if(GlobalVars::verbose >= 1) { cout << "ll=" << -sent_ll.CalcUnkLoss() << " unk=" << sent_ll.unk_  << endl; }
-        corpus_ll += sent_ll;
-        // Write word probabilities if necessary
-        if(wpout.get()) {
-          if(word_lls.size()) *wpout << -word_lls[0];
-          for(size_t i = 1; i < word_lls.size(); i++) *wpout << ' ' << -word_lls[i];
-          *wpout << endl;
+        if(ppl_trie) {
+          if(group_trg.size() && (sent_src != group_src || group_words + (int)sent_trg.size() > max_minibatch_size))
+            score_group();
+          group_src = sent_src;
+          group_trg.push_back(sent_trg);
+          group_words += sent_trg.size();
+        } else {
+          LLStats sent_ll(vocab_size);
+          vector<float> word_lls;
+          decoder.CalcSentLL<Sentence,LLStats,vector<float> >(sent_src, sent_trg, sent_ll, word_lls);
+          add_sent(sent_ll, word_lls);
         }
       }
     }
+    score_group();
     double elapsed = time.Elapsed();
     cerr << "ppl=" << corpus_ll.CalcPPL() << ", unk=" << corpus_ll.unk_ << ", time=" << elapsed << " (" << corpus_ll.words_/elapsed << " w/s)" << endl;
   } else if(operation == "nbest") {
     Timer time;
-    int all_words = 0, curr_words = 0;
-    std::vector<Sentence> sents_trg;
+    int all_words = 0, group_words = 0;
+    // Hypotheses are grouped by whole sources, so each source is encoded only once
+    vector<Sentence> group_src, group_trg;
+    vector<unsigned> group_ids;
+    auto score_group = [&]() {
+      if(group_trg.size() == 0) return;
+      vector<LLStats> sents_ll(group_trg.size(), LLStats(vocab_size));
+      vector<vector<float> > word_lls(group_trg.size());
+      decoder.CalcNbestLL(group_src, group_trg, group_ids, max_minibatch_size, sents_ll, word_lls);
+      for(auto & sent_ll : sents_ll)
+        cout << "ll=" << -sent_ll.CalcUnkLoss() << " unk=" << sent_ll.unk_  << endl;
+      double elapsed = time.Elapsed();
+      cerr << "sent=" << last_id << ", time=" << elapsed << " (" << all_words/elapsed << " w/s)" << endl;
+      group_src.resize(0); group_trg.resize(0); group_ids.resize(0);
+      group_words = 0;
+    };
     while(getline(cin, line)) { 
       // Get the new sentence
       vector<string> columns = Tokenize(line, " ||| ");
       if(columns.size() < 2) THROW_ERROR("Bad line in n-best:\n" << line);
       int my_id = stoi(columns[0]);
       sent_trg = ParseWords(*vocab_trg, columns[1], true);
-      // If we've finished the current source, print
-      if((my_id != last_id || curr_words+sents_trg.size() > max_minibatch_size) && sents_trg.size() > 0) {
-        vector<LLStats> sents_ll(sents_trg.size(), LLStats(vocab_size));
-        vector<vector<float> > word_lls(sents_trg.size());
-        if(sents_trg.size() > 1)
-          decoder.CalcSentLL<vector<Sentence>,vector<LLStats>,vector<vector<float> > >(sent_src, sents_trg, sents_ll, word_lls);
-        else
-          decoder.CalcSentLL<Sentence,LLStats,vector<float> >(sent_src, sents_trg[0], sents_ll[0], word_lls[0]);
-        for(auto & sent_ll : sents_ll)
-          cout << "ll=" << -sent_ll.CalcUnkLoss() << " unk=" << sent_ll.unk_  << endl;
-        sents_trg.resize(0);
-        curr_words = 0;
-      }
-      // Load the new source word
+      // Load the new source, scoring the current group if it is large enough
       if(my_id != last_id) {
+        if(group_words >= max_minibatch_size)
+          score_group();
         if(!getline(*src_in, line))
           THROW_ERROR("Source and target files don't match");
         sent_src = ParseWords(*vocab_src, line, false);
-        if(do_sent) {
-          double elapsed = time.Elapsed();
-          cerr << "sent=" << last_id << ", time=" << elapsed << " (" << all_words/elapsed << " w/s)" << endl;
-        }
         last_id = my_id;
         do_sent = (last_id >= sent_range.first && last_id < sent_range.second);
+        if(do_sent)
+          group_src.push_back(sent_src);
       }
       // Add to the data
       if(do_sent) {
-        sents_trg.push_back(sent_trg);
+        group_trg.push_back(sent_trg);
+        group_ids.push_back(group_src.size()-1);
         all_words += sent_trg.size();
-        curr_words += sent_trg.size();
+        group_words += sent_trg.size();
       }
     }
-    if(do_sent) {
-      vector<LLStats> sents_ll(sents_trg.size(), LLStats(vocab_size));
-      vector<vector<float> > word_lls(sents_trg.size());
-      decoder.CalcSentLL<vector<Sentence>,vector<LLStats>, vector<vector<float> > >(sent_src, sents_trg, sents_ll, word_lls);
-      for(auto & sent_ll : sents_ll)
-        cout << "ll=" << -sent_ll.CalcUnkLoss() << " unk=" << sent_ll.unk_  << endl;
-      double elapsed = time.Elapsed();
-      cerr << "sent=" << last_id << ", time=" << elapsed << " (" << all_words/elapsed << " w/s)" << endl;
-    }
+    score_group();
   } else if(operation == "gen" || operation == "samp") {
-    if(operation == "samp") THROW_ERROR("Sampling not implemented yet");
-    for(int i = 0; i < sent_range.second; ++i) {
-      if(encdecs.size() + encatts.size() > 0) {
-        if(!getline(*src_in, line)) break;
-        str_src = SplitWords(line);
-        sent_src = ParseWords(*vocab_src, str_src, false);
+    int batch_size = vm["batch_size"].as<int>();
+    if(batch_size < 1) THROW_ERROR("batch_size must be at least one, but got " << batch_size);
+    int num_threads = vm["threads"].as<int>();
+    if(num_threads < 1) THROW_ERROR("threads must be at least one, but got " << num_threads);
+    if(num_threads > 1 && dynet::default_device->type != dynet::DeviceType::CPU)
+      THROW_ERROR("Generating with multiple threads is only supported on the CPU");
+    int samp_size = vm["samp_size"].as<int>(), samp_top_k = vm["samp_top_k"].as<int>();
+    float samp_temp = vm["samp_temp"].as<float>();
+    if(samp_size < 1) THROW_ERROR("samp_size must be at least one, but got " << samp_size);
+    if(samp_temp <= 0.f) THROW_ERROR("samp_temp must be positive, but got " << samp_temp);
+    if(samp_top_k < 0) THROW_ERROR("samp_top_k must not be negative, but got " << samp_top_k);
+    // Each sentence's samples are drawn with a seed based on its id, so they
+    // don't depend on the batches or the number of threads
+    unsigned samp_seed = (*dynet::rndeng)();
+    // Draw samples for a batch of sentences, writing them in n-best format
+    auto sample_batch = [&](const vector<int> & sent_ids, const vector<vector<string> > & strs_src, const vector<Sentence> & sents_src) {
+      ostringstream out;
+      Sentence sent_trg, align;
+      vector<string> str_trg;
+      for(size_t k = 0; k < sent_ids.size(); k++) {
+        dynet::rndeng->seed(samp_seed + sent_ids[k]);
+        for(auto & trg_hyp : decoder.Sample(sents_src[k], samp_size, samp_temp, samp_top_k)) {
+          sent_trg = trg_hyp->GetSentence();
+          align = trg_hyp->GetAlignment();
+          str_trg = ConvertWords(*vocab_trg, sent_trg, false);
+          MapWords(strs_src[k], sent_trg, align, mapping, str_trg);
+          out << sent_ids[k] << " ||| " << PrintWords(str_trg) << " ||| " << trg_hyp->GetScore() << endl;
+        }
       }
-      if(i >= sent_range.first) {
+      return out.str();
+    };
+    // Decode a batch of sentences and return the output in the original order
+    auto decode_batch = [&](const vector<int> & sent_ids, const vector<vector<string> > & strs_src, const vector<Sentence> & sents_src) -> string {
+      if(operation == "samp")
+        return sample_batch(sent_ids, strs_src, sents_src);
+      // Sort the sentences by length and decode them together as a single batch
+      vector<int> order(sent_ids.size());
+      std::iota(order.begin(), order.end(), 0);
+      std::stable_sort(order.begin(), order.end(), [&sents_src](int a, int b) { return sents_src[a].size() > sents_src[b].size(); });
+      vector<Sentence> batch_src(order.size());
+      for(size_t k = 0; k < order.size(); k++)
+        batch_src[k] = sents_src[order[k]];
+      vector<vector<EnsembleDecoderHypPtr> > batch_hyps = decoder.GenerateNbest(batch_src, nbest_size), sents_hyps(order.size());
+      for(size_t k = 0; k < order.size(); k++)
+        sents_hyps[order[k]] = batch_hyps[k];
+      // Print the results in the original order
+      ostringstream out;
+      Sentence sent_trg, align;
+      vector<string> str_trg;
+      for(size_t k = 0; k < sent_ids.size(); k++) {
         if(nbest_size == 1) {
-          EnsembleDecoderHypPtr trg_hyp = decoder.Generate(sent_src);
-          if(trg_hyp.get() == nullptr) {
-            cout << endl;
+          if(sents_hyps[k].size() == 0 || sents_hyps[k][0].get() == nullptr) {
+            out << endl;
           } else {
-            sent_trg = trg_hyp->GetSentence();
-            align = trg_hyp->GetAlignment();
+            sent_trg = sents_hyps[k][0]->GetSentence();
+            align = sents_hyps[k][0]->GetAlignment();
             str_trg = ConvertWords(*vocab_trg, sent_trg, false);
-            MapWords(str_src, sent_trg, align, mapping, str_trg);
-            cout << PrintWords(str_trg) << endl;
+            MapWords(strs_src[k], sent_trg, align, mapping, str_trg);
+            out << PrintWords(str_trg) << endl;
           }
         } else {
-          auto trg_hyps = decoder.GenerateNbest(sent_src, nbest_size);
-          for(auto & trg_hyp : trg_hyps) {
+          for(auto & trg_hyp : sents_hyps[k]) {
             if(trg_hyp.get() != nullptr) {
               sent_trg = trg_hyp->GetSentence();
               align = trg_hyp->GetAlignment();
               str_trg = ConvertWords(*vocab_trg, sent_trg, false);
-              MapWords(str_src, sent_trg, align, mapping, str_trg);
-              cout << i << " ||| " << PrintWords(str_trg) << " ||| " << trg_hyp->GetScore() << endl;
+              MapWords(strs_src[k], sent_trg, align, mapping, str_trg);
+              out << sent_ids[k] << " ||| " << PrintWords(str_trg) << " ||| " << trg_hyp->GetScore() << endl;
             }
           }
         }
       }
+      return out.str();
+    };
+    // With multiple threads, batches are sent to worker processes as lines of "id\tsource"
+    shared_ptr<WorkerPool> workers;
+    if(num_threads > 1) {
+      workers.reset(new WorkerPool(num_threads, [&](const string & item) {
+        vector<int> sent_ids;
+        vector<vector<string> > strs_src;
+        vector<Sentence> sents_src;
+        istringstream in(item);
+        string item_line;
+        while(getline(in, item_line)) {
+          size_t tab = item_line.find('\t');
+          sent_ids.push_back(stoi(item_line.substr(0, tab)));
+          strs_src.push_back(SplitWords(item_line.substr(tab+1)));
+          sents_src.push_back(vocab_src.get() ? ParseWords(*vocab_src, strs_src.back(), false) : Sentence());
+        }
+        return decode_batch(sent_ids, strs_src, sents_src);
+      }));
+    }
+    bool src_done = false;
+    for(int i = 0; i < sent_range.second && !src_done; ) {
+      // Read in the next batch of sentences
+      vector<int> sent_ids;
+      vector<vector<string> > strs_src;
+      vector<Sentence> sents_src;
+      for( ; i < sent_range.second && (int)sent_ids.size() < batch_size; ++i) {
+        if(encdecs.size() + encatts.size() > 0) {
+          if(!getline(*src_in, line)) { src_done = true; break; }
+          str_src = SplitWords(line);
+          sent_src = ParseWords(*vocab_src, str_src, false);
+        }
+        if(i >= sent_range.first) {
+          sent_ids.push_back(i);
+          strs_src.push_back(str_src);
+          sents_src.push_back(sent_src);
+        }
+      }
+      if(sent_ids.size() == 0) continue;
+      if(workers.get() == nullptr) {
+        cout << decode_batch(sent_ids, strs_src, sents_src) << flush;
+      } else {
+        // Write the oldest batch's results before giving its worker more work
+        if(workers->GetNumPending() == workers->GetNumWorkers())
+          cout << workers->Receive() << flush;
+        ostringstream item;
+        for(size_t k = 0; k < sent_ids.size(); k++)
+          item << sent_ids[k] << '\t' << PrintWords(strs_src[k]) << '\n';
+        workers->Send(item.str());
+      }
+    }
+    while(workers.get() != nullptr && workers->GetNumPending() > 0)
+      cout << workers->Receive() << flush;
+  } else if(operation == "serve") {
+    // Requests are lines of "gen ||| src", "nbest ||| src ||| trg" or "ppl ||| src ||| trg",
+    // where the source is left out when only using language models
+    int batch_size = vm["batch_size"].as<int>();
+    if(batch_size < 1) THROW_ERROR("batch_size must be at least one, but got " << batch_size);
+    if(vm["socket"].as<string>() == "" && vm["port"].as<int>() <= 0)
+      THROW_ERROR("Must specify a socket or a port to serve on");
+    bool use_src = (encdecs.size() + encatts.size() > 0);
+    RequestServer server(vm["socket"].as<string>(), vm["port"].as<int>());
+    cerr << "Waiting for requests" << endl;
+    vector<ServerRequest> requests;
+    // Handle a batch of requests, giving a response to each
+    auto handle_requests = [&](vector<ServerRequest> & batch, vector<string> & responses) {
+      responses.assign(batch.size(), "");
+      // Parse the requests, collecting the ones to generate and the ones to score
+      vector<int> gen_ids, score_ids;
+      vector<vector<string> > gen_strs;
+      vector<Sentence> gen_srcs, score_srcs, score_trgs;
+      vector<unsigned> score_src_ids;
+      for(size_t k = 0; k < batch.size(); k++) {
+        string & request = batch[k].line;
+        boost::trim(request);
+        vector<string> columns = Tokenize(request, " ||| ");
+        if(columns.size() == 0 || (columns[0] != "gen" && columns[0] != "nbest" && columns[0] != "ppl")) {
+          responses[k] = "error ||| Request must start with gen, nbest or ppl";
+          continue;
+        }
+        size_t num_columns = (columns[0] == "gen" ? 1 : 2) + (use_src ? 1 : 0);
+        if(columns.size() != num_columns) {
+          responses[k] = "error ||| Expecting " + to_string(num_columns) + " fields for " + columns[0];
+          continue;
+        }
+        str_src = (use_src ? SplitWords(columns[1]) : vector<string>());
+        sent_src = (use_src ? ParseWords(*vocab_src, str_src, false) : Sentence());
+        if(columns[0] == "gen") {
+          gen_ids.push_back(k);
+          gen_strs.push_back(str_src);
+          gen_srcs.push_back(sent_src);
+        } else {
+          score_ids.push_back(k);
+          score_src_ids.push_back(score_srcs.size());
+          score_srcs.push_back(sent_src);
+          score_trgs.push_back(ParseWords(*vocab_trg, *columns.rbegin(), true));
+        }
+      }
+      // Generate translations for all the gen batch together
+      if(gen_ids.size() > 0) {
+        vector<vector<EnsembleDecoderHypPtr> > gen_hyps = decoder.GenerateNbest(gen_srcs, 1);
+        for(size_t k = 0; k < gen_ids.size(); k++) {
+          if(gen_hyps[k].size() == 0 || gen_hyps[k][0].get() == nullptr) continue;
+          sent_trg = gen_hyps[k][0]->GetSentence();
+          align = gen_hyps[k][0]->GetAlignment();
+          str_trg = ConvertWords(*vocab_trg, sent_trg, false);
+          MapWords(gen_strs[k], sent_trg, align, mapping, str_trg);
+          responses[gen_ids[k]] = PrintWords(str_trg);
+        }
+      }
+      // Score all the nbest and ppl batch together
+      if(score_ids.size() > 0) {
+        vector<LLStats> sents_ll(score_ids.size(), LLStats(vocab_size));
+        vector<vector<float> > word_lls(score_ids.size());
+        decoder.CalcNbestLL(score_srcs, score_trgs, score_src_ids, max_minibatch_size, sents_ll, word_lls);
+        for(size_t k = 0; k < score_ids.size(); k++) {
+          ostringstream out;
+          out << "ll=" << -sents_ll[k].CalcUnkLoss() << " unk=" << sents_ll[k].unk_;
+          if(batch[score_ids[k]].line.substr(0, 3) == "ppl") out << " words=" << sents_ll[k].words_;
+          responses[score_ids[k]] = out.str();
+        }
+      }
+    };
+    while(true) {
+      server.GetRequests(batch_size, requests);
+      vector<string> responses;
+      // A request that fails only gets an error itself, so retry the others alone
+      try {
+        handle_requests(requests, responses);
+      } catch(std::exception &) {
+        responses.resize(requests.size());
+        for(size_t k = 0; k < requests.size(); k++) {
+          vector<ServerRequest> single(1, requests[k]);
+          vector<string> single_response;
+          try {
+            handle_requests(single, single_response);
+            responses[k] = single_response[0];
+          } catch(std::exception & e) {
+            string message = e.what();
+            std::replace(message.begin(), message.end(), '\n', ' ');
+            responses[k] = "error ||| " + message;
+          }
+        }
+      }
+      for(size_t k = 0; k < requests.size(); k++)
+        server.Respond(requests[k].client, responses[k]);
     }
   } else {
     THROW_ERROR("Illegal operation " << operation);
@@ -298,9 +544,7 @@ int Lamtram::ClassifierOperation(const boost::program_options::variables_map & v
     DictPtr vocab_src_temp, vocab_trg_temp;
     shared_ptr<dynet::ParameterCollection> mod_temp;
     // Read in the model
-    EncoderClassifier * tm = ModelUtils::LoadBilingualModel<EncoderClassifier>(file, mod_temp, vocab_src_temp, vocab_trg_temp);
-    dynet::TextFileLoader loader(file + ".data");
-    loader.populate(*mod_temp);
+    EncoderClassifier * tm = ModelUtils::LoadBilingualModelAndParams<EncoderClassifier>(file, mod_temp, vocab_src_temp, vocab_trg_temp);
     encclss.push_back(shared_ptr<EncoderClassifier>(tm));
     // Sanity check
     if(vocab_trg.get() && vocab_trg_temp->get_words() != vocab_trg->get_words())
@@ -373,18 +617,36 @@ int Lamtram::main(int argc, char** argv) {
   desc.add_options()
     ("help", "Produce help message")
     ("verbose", po::value<int>()->default_value(0), "How much verbose output to print")
+    ("batch_size", po::value<int>()->default_value(1), "Number of sentences to decode together as a single batch during generation")
     ("beam", po::value<int>()->default_value(1), "Number of hypotheses to expand")
+    ("beam_max_cands", po::value<int>()->default_value(0), "Max number of candidates that a single hypothesis can add to the next beam (0 for no limit)")
+    ("beam_prune_abs", po::value<float>()->default_value(0.f), "Prune hypotheses with a log probability this much lower than the best hypothesis (0 to disable)")
+    ("beam_prune_rel", po::value<float>()->default_value(0.f), "Prune hypotheses with a probability less than this ratio of the best hypothesis (0 to disable)")
     ("dynet_mem", po::value<int>()->default_value(512), "How much memory to allocate to dynet")
     ("ensemble_op", po::value<string>()->default_value("sum"), "The operation to use when ensembling probabilities (sum/logsum)")
     ("wordprob_out", po::value<string>()->default_value(""), "Output word log probabilities during perplexity calculation")
     ("map_in", po::value<string>()->default_value(""), "A file containing a mapping table (\"src trg prob\" format)")
     ("minibatch_size", po::value<int>()->default_value(1), "Max size of a minibatch in words (may be exceeded if there are longer sentences)")
+    ("model_out", po::value<string>()->default_value(""), "The file to write the binary model to when converting")
     ("models_in", po::value<string>()->default_value(""), "Model files in format \"{encdec,encatt,nlm}=filename\" with encdec for encoder-decoders, encatt for attentional models, nlm for language models. When multiple, separate by a pipe.")
     ("nbest_size", po::value<int>()->default_value(1), "The size of an n-best to generate when generating n-best")
-    ("operation", po::value<string>()->default_value("ppl"), "Operations (ppl: measure perplexity, nbest: score n-best list, gen: generate most likely sentence, samp: sample sentences randomly)")
+    ("operation", po::value<string>()->default_value("ppl"), "Operations (ppl: measure perplexity, nbest: score n-best list, gen: generate most likely sentence, samp: sample sentences randomly, convert: write a model in the binary format, serve: answer gen/nbest/ppl requests over a socket)")
+    ("samp_size", po::value<int>()->default_value(1), "The number of samples to draw for each sentence when sampling")
+    ("samp_temp", po::value<float>()->default_value(1.f), "The temperature to sample with, where lower values give samples closer to the most likely sentence")
+    ("samp_top_k", po::value<int>()->default_value(0), "When sampling, only draw each word from this many most likely words (0 for no limit)")
+    ("shortlist_file", po::value<string>()->default_value(""), "A lexicon for the shortlist in \"src\ttrg\tprob\" format, used along with the lexicons of the models")
+    ("shortlist_freq", po::value<int>()->default_value(0), "When generating, add this many of the most frequent target words to the shortlist")
+    ("shortlist_lex", po::value<int>()->default_value(0), "When generating, only calculate scores for the top this many translations of each source word (and the frequent words)")
+    ("quantize", po::value<string>()->default_value(""), "Quantize the output weights to int8 or fp16 to decode faster on the CPU, or all matrices when converting a model to make the file smaller")
+    ("ppl_trie", po::value<bool>()->default_value(false), "For ppl, score consecutive sentences with the same source together in groups of up to minibatch_size words, calculating prefixes they share only once")
+    ("port", po::value<int>()->default_value(0), "The localhost TCP port to listen on when serving")
     ("sent_range", po::value<string>()->default_value(""), "Optionally specify a comma-delimited range on how many sentences to process")
     ("max_len", po::value<int>()->default_value(200), "Limit on the max length of sentences")
+    ("max_len_ratio", po::value<float>()->default_value(0.f), "If non-zero, limit the length of generated sentences to this ratio times the source length plus max_len_const (and never more than max_len)")
+    ("max_len_const", po::value<int>()->default_value(0), "The constant to add to the source-length based limit when using max_len_ratio")
+    ("socket", po::value<string>()->default_value(""), "The Unix domain socket to listen on when serving (used instead of port)")
     ("src_in", po::value<string>()->default_value("-"), "File to read the source from, if any")
+    ("threads", po::value<int>()->default_value(1), "Number of worker processes to use during generation, which share a single copy of the model parameters (CPU only)")
     ("word_pen", po::value<float>()->default_value(0.f), "The \"word penalty\", a larger value favors longer sentences, shorter favors shorter")
     ("unk_pen", po::value<float>()->default_value(0.f), "A penalty for unknown words, larger will create fewer unknown words when decoding")
     ;
@@ -400,7 +662,7 @@ int Lamtram::main(int argc, char** argv) {
   GlobalVars::verbose = vm["verbose"].as<int>();
 
   string operation = vm["operation"].as<std::string>();
-  if(operation == "ppl" || operation == "nbest" || operation == "gen" || operation == "samp") {
+  if(operation == "ppl" || operation == "nbest" || operation == "gen" || operation == "samp" || operation == "convert" || operation == "serve") {
     return SequenceOperation(vm);
   } else if(operation == "cls" || operation == "clseval") {
     return ClassifierOperation(vm);
@@ -5,6 +5,7 @@
 #include <dynet/nodes.h>
 #include <dynet/rnn.h>
 #include <boost/range/irange.hpp>
+#include <algorithm>
 #include <ctime>
 #include <fstream>
 
@@ -44,6 +45,7 @@ dynet::Expression LinearEncoder::BuildSentGraph(const Sentence & sent, bool add,
   if(add) {
     *word_states_.rbegin() = i_h_t = builder_->add_input(lookup(cg, p_wr_W_, (unsigned)0));
   }
+  final_h_ = builder_->final_h();
   return i_h_t;
 }
 
@@ -54,36 +56,58 @@ dynet::Expression LinearEncoder::BuildSentGraph(const vector<Sentence> & sent, b
   // Get the max size
   size_t max_len = sent[0].size();
   for(size_t i = 1; i < sent.size(); i++) max_len = max(max_len, sent[i].size());
-  // Create the word states
-  word_states_.resize(max_len + (add ? 1 : 0));
+  // Run over all the words. Shorter sentences are padded after their end, and
+  // the reverse encoder reads each sentence from its own last word and pads
+  // it after its first, so every sentence gets the states it would get alone.
+  size_t num_steps = max_len + (add ? 1 : 0);
+  vector<dynet::Expression> step_states(num_steps);
   builder_->start_new_sequence();
-  // First get all the word representations
-  dynet::Expression i_wr_t, i_h_t;
   vector<unsigned> words(sent.size());
-  if(!reverse_) {
-    for(int t = 0; t < max_len; t++) {
-      for(size_t i = 0; i < sent.size(); i++)
-        words[i] = (t < sent[i].size() ? sent[i][t] : 0);
-      i_wr_t = lookup(cg, p_wr_W_, words);
-      i_h_t = builder_->add_input(i_wr_t);
-      word_states_[t] = i_h_t;
+  for(size_t t = 0; t < num_steps; t++) {
+    for(size_t i = 0; i < sent.size(); i++) {
+      size_t len = sent[i].size();
+      words[i] = (t < len ? sent[i][reverse_ ? len-1-t : t] : 0);
     }
+    step_states[t] = builder_->add_input(lookup(cg, p_wr_W_, words));
+  }
+  // Find the step of each sentence's state for every position. Positions past
+  // the end of a sentence (and its added word) just take any state.
+  word_states_.resize(num_steps);
+  vector<int> steps(sent.size());
+  for(size_t t = 0; t < num_steps; t++) {
+    for(size_t i = 0; i < sent.size(); i++)
+      steps[i] = (reverse_ && t < sent[i].size() ? sent[i].size()-1-t : t);
+    word_states_[t] = PickSteps(step_states, steps);
+  }
+  // The final states are after each sentence's last word
+  final_h_.clear();
+  for(size_t i = 0; i < sent.size(); i++)
+    steps[i] = max(0, min((int)sent[i].size() - (add ? 0 : 1), (int)num_steps - 1));
+  if(*min_element(steps.begin(), steps.end()) == (int)num_steps - 1) {
+    final_h_ = builder_->final_h();
   } else {
-    for(int t = max_len-1; t >= 0; t--) {
-      for(size_t i = 0; i < sent.size(); i++)
-        words[i] = (t < sent[i].size() ? sent[i][t] : 0);
-      i_wr_t = lookup(cg, p_wr_W_, words);
-      i_h_t = builder_->add_input(i_wr_t);
-      word_states_[t] = i_h_t;
+    vector<vector<dynet::Expression> > step_hs(num_steps);
+    for(size_t t = 0; t < num_steps; t++)
+      step_hs[t] = builder_->get_h(dynet::RNNPointer(t));
+    for(size_t l = 0; l < step_hs[0].size(); l++) {
+      vector<dynet::Expression> layer_states(num_steps);
+      for(size_t t = 0; t < num_steps; t++)
+        layer_states[t] = step_hs[t][l];
+      final_h_.push_back(PickSteps(layer_states, steps));
     }
   }
-  if(add) {
-    std::fill(words.begin(), words.end(), 0);
-    *word_states_.rbegin() = i_h_t = builder_->add_input(lookup(cg, p_wr_W_, words));
-  }
-  return i_h_t;
+  return *final_h_.rbegin();
 }
 
+// Get a state for each batch element from the step given for it
+dynet::Expression LinearEncoder::PickSteps(const vector<dynet::Expression> & states, const vector<int> & steps) {
+  if(*min_element(steps.begin(), steps.end()) == *max_element(steps.begin(), steps.end()))
+    return states[steps[0]];
+  vector<dynet::Expression> picked(steps.size());
+  for(size_t i = 0; i < steps.size(); i++)
+    picked[i] = pick_batch_elem(states[steps[i]], i);
+  return concatenate_to_batch(picked);
+}
 
 void LinearEncoder::NewGraph(dynet::ComputationGraph & cg) {
   builder_->new_graph(cg);
@@ -116,7 +140,7 @@ void LinearEncoder::Write(std::ostream & out) {
 }
 
 vector<dynet::Expression> LinearEncoder::GetFinalHiddenLayers() const {
-  return builder_->final_h();
+  return final_h_;
 }
 
 void LinearEncoder::SetDropout(float dropout) { builder_->set_dropout(dropout); }
@@ -39,7 +39,8 @@ public:
     // Index the parameters in a computation graph
     void NewGraph(dynet::ComputationGraph & cg);
 
-    // Get the last hidden layers of the encoder
+    // Get the last hidden layers of the encoder, after the last word of each
+    // sentence in the batch
     std::vector<dynet::Expression> GetFinalHiddenLayers() const;
 
     // // Clone the parameters of another linear encoder
@@ -71,8 +72,13 @@ protected:
     // The RNN builder
     BuilderPtr builder_;
 
-    // This records the last set of word states acquired during BuildSentGraph
+    // This records the last set of word states acquired during BuildSentGraph,
+    // and the final hidden layers
     std::vector<dynet::Expression> word_states_;
+    std::vector<dynet::Expression> final_h_;
+
+    // Get a state for each batch element from the step given for it
+    dynet::Expression PickSteps(const std::vector<dynet::Expression> & states, const std::vector<int> & steps);
 
 private:
     // A pointer to the current computation graph.
@@ -0,0 +1,98 @@
+#include <lamtram/mlp-attention.h>
+#include <lamtram/macros.h>
+#include <dynet/dynet.h>
+#include <dynet/tensor.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+// The values of a batch element, which are shared if the tensor isn't batched
+inline const float * BatchPtr(const Tensor & tensor, unsigned b) {
+  return tensor.v + (tensor.d.bd == 1 ? 0 : b * tensor.d.batch_size());
+}
+inline float * BatchPtr(Tensor & tensor, unsigned b) {
+  return tensor.v + (tensor.d.bd == 1 ? 0 : b * tensor.d.batch_size());
+}
+
+// The number of source positions whose tanh values are calculated together
+static const unsigned kBlockSize = 16;
+
+namespace lamtram {
+
+struct MLPAttentionScores : public Node {
+
+    template <typename T> explicit MLPAttentionScores(const T & args) : Node(args) { }
+
+    virtual bool supports_multibatch() const override { return true; }
+
+    virtual std::string as_string(const std::vector<std::string> & arg_names) const override {
+      ostringstream s;
+      s << "mlp_attention_scores(" << arg_names[0] << ", " << arg_names[1] << ", " << arg_names[2] << ')';
+      return s.str();
+    }
+
+    virtual Dim dim_forward(const std::vector<Dim> & xs) const override {
+      if(xs.size() != 3 || xs[1].batch_size() != xs[0][0] || xs[2].batch_size() != xs[0][0] || xs[2].bd != 1 ||
+         (xs[0].bd != 1 && xs[1].bd != 1 && xs[0].bd != xs[1].bd))
+        THROW_ERROR("Bad input dimensions in mlp_attention_scores: " << xs[0] << ", " << xs[1] << ", " << xs[2]);
+      return Dim({xs[0].cols()}, max(xs[0].bd, xs[1].bd));
+    }
+
+    // Calculate the scores a block of source positions at a time, so only the
+    // tanh of one block is ever held in memory
+    virtual void forward_impl(const std::vector<const Tensor*> & xs, Tensor & fx) const override {
+      unsigned hidden_size = xs[0]->d[0], sent_len = xs[0]->d.cols();
+      Eigen::Map<const Eigen::RowVectorXf> v(xs[2]->v, hidden_size);
+      Eigen::MatrixXf t(hidden_size, min(kBlockSize, sent_len));
+      for(unsigned b = 0; b < fx.d.bd; b++) {
+        Eigen::Map<const Eigen::MatrixXf> h(BatchPtr(*xs[0], b), hidden_size, sent_len);
+        Eigen::Map<const Eigen::VectorXf> s(BatchPtr(*xs[1], b), hidden_size);
+        for(unsigned j = 0; j < sent_len; j += kBlockSize) {
+          unsigned n = min(kBlockSize, sent_len - j);
+          for(unsigned k = 0; k < n; k++)
+            t.col(k) = (h.col(j + k) + s).array().tanh();
+          Eigen::Map<Eigen::RowVectorXf>(fx.v + b * sent_len + j, n).noalias() = v * t.leftCols(n);
+        }
+      }
+    }
+
+    // The tanh values aren't kept, so recalculate them block by block
+    virtual void backward_impl(const std::vector<const Tensor*> & xs, const Tensor & fx, const Tensor & dEdf,
+                               unsigned i, Tensor & dEdxi) const override {
+      unsigned hidden_size = xs[0]->d[0], sent_len = xs[0]->d.cols();
+      Eigen::Map<const Eigen::VectorXf> v(xs[2]->v, hidden_size);
+      Eigen::MatrixXf t(hidden_size, min(kBlockSize, sent_len));
+      for(unsigned b = 0; b < fx.d.bd; b++) {
+        Eigen::Map<const Eigen::MatrixXf> h(BatchPtr(*xs[0], b), hidden_size, sent_len);
+        Eigen::Map<const Eigen::VectorXf> s(BatchPtr(*xs[1], b), hidden_size);
+        for(unsigned j = 0; j < sent_len; j += kBlockSize) {
+          unsigned n = min(kBlockSize, sent_len - j);
+          Eigen::Map<const Eigen::RowVectorXf> g(dEdf.v + b * sent_len + j, n);
+          for(unsigned k = 0; k < n; k++)
+            t.col(k) = (h.col(j + k) + s).array().tanh();
+          if(i == 2) {
+            Eigen::Map<Eigen::RowVectorXf>(dEdxi.v, hidden_size).noalias() += g * t.leftCols(n).transpose();
+            continue;
+          }
+          // The gradient before the tanh, which is the same for hpart and spart
+          t.leftCols(n) = (((1.f - t.leftCols(n).array().square()).colwise() * v.array()).rowwise() * g.array()).matrix();
+          if(i == 0) {
+            Eigen::Map<Eigen::MatrixXf>(BatchPtr(dEdxi, b) + j * hidden_size, hidden_size, n) += t.leftCols(n);
+          } else {
+            Eigen::Map<Eigen::VectorXf>(BatchPtr(dEdxi, b), hidden_size) += t.leftCols(n).rowwise().sum();
+          }
+        }
+      }
+    }
+
+};
+
+Expression mlp_attention_scores(const Expression & hpart, const Expression & spart, const Expression & v) {
+  return Expression(hpart.pg, hpart.pg->add_function<MLPAttentionScores>({hpart.i, spart.i, v.i}));
+}
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <dynet/expr.h>
+
+namespace lamtram {
+
+// Calculate the scores of MLP attention, v * tanh(hpart + spart), for every
+// source position at once. hpart is {hidden_size, sent_len}, spart is
+// {hidden_size}, v is {1, hidden_size}, and the result is {sent_len}. hpart
+// and spart may be batched, and if only one of them is, it is shared by the
+// whole batch.
+//
+// This does the same as transpose(v * tanh(colwise_add(hpart, spart))) in a
+// single node, going over the source positions a few at a time so that the
+// {hidden_size, sent_len} sum and tanh are never stored. The backward pass
+// recalculates the tanh. It only runs on the CPU, and is used by the attention
+// when decoding.
+dynet::Expression mlp_attention_scores(const dynet::Expression & hpart, const dynet::Expression & spart, const dynet::Expression & v);
+
+}
@@ -5,11 +5,15 @@
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/encoder-classifier.h>
 #include <lamtram/neural-lm.h>
+#include <lamtram/binary-model.h>
 #include <dynet/model.h>
 #include <dynet/dict.h>
+#include <dynet/io.h>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <fstream>
+#include <sstream>
+#include <vector>
 
 using namespace std;
 using namespace lamtram;
@@ -65,6 +69,60 @@ ModelType* ModelUtils::LoadMonolingualModel(const std::string & file,
     return ModelUtils::LoadMonolingualModel<ModelType>(model_in, mod, vocab_trg);
 }
 
+// Binary models use the mapped file in place, so keep them mapped until the program ends
+static std::vector<BinaryModelFilePtr> mapped_models;
+
+template <class ModelType>
+ModelType* ModelUtils::LoadBilingualModelAndParams(const std::string & file,
+                                                   std::shared_ptr<dynet::ParameterCollection> & mod,
+                                                   DictPtr & vocab_src, DictPtr & vocab_trg) {
+    ModelType* ret;
+    if(BinaryModelFile::IsBinaryModel(file)) {
+        BinaryModelFilePtr binary(new BinaryModelFile(file));
+        istringstream model_in(binary->GetHeader());
+        ret = ModelUtils::LoadBilingualModel<ModelType>(model_in, mod, vocab_src, vocab_trg);
+        binary->Populate(*mod);
+        mapped_models.push_back(binary);
+    } else {
+        ret = ModelUtils::LoadBilingualModel<ModelType>(file, mod, vocab_src, vocab_trg);
+        dynet::TextFileLoader loader(file + ".data");
+        loader.populate(*mod);
+    }
+    return ret;
+}
+
+template <class ModelType>
+ModelType* ModelUtils::LoadMonolingualModelAndParams(const std::string & file,
+                                                     std::shared_ptr<dynet::ParameterCollection> & mod,
+                                                     DictPtr & vocab_trg) {
+    ModelType* ret;
+    if(BinaryModelFile::IsBinaryModel(file)) {
+        BinaryModelFilePtr binary(new BinaryModelFile(file));
+        istringstream model_in(binary->GetHeader());
+        ret = ModelUtils::LoadMonolingualModel<ModelType>(model_in, mod, vocab_trg);
+        binary->Populate(*mod);
+        mapped_models.push_back(binary);
+    } else {
+        ret = ModelUtils::LoadMonolingualModel<ModelType>(file, mod, vocab_trg);
+        dynet::TextFileLoader loader(file + ".data");
+        loader.populate(*mod);
+    }
+    return ret;
+}
+
+void ModelUtils::WriteModel(const std::string & file, const std::string & header,
+                            dynet::ParameterCollection & mod, bool binary) {
+    if(binary) {
+        BinaryModelFile::Write(file, header, mod);
+    } else {
+        ofstream out(file);
+        if(!out) THROW_ERROR("Could not open output file: " << file);
+        out << header;
+        dynet::TextFileSaver saver(file + ".data");
+        saver.save(mod);
+    }
+}
+
 // Instantiate LoadModel
 template
 EncoderDecoder* ModelUtils::LoadBilingualModel<EncoderDecoder>(std::istream & model_in,
@@ -98,3 +156,19 @@ template
 NeuralLM* ModelUtils::LoadMonolingualModel<NeuralLM>(const std::string & infile,
                                                      std::shared_ptr<dynet::ParameterCollection> & mod,
                                                      DictPtr & vocab_trg);
+template
+EncoderDecoder* ModelUtils::LoadBilingualModelAndParams<EncoderDecoder>(const std::string & infile,
+                                                               std::shared_ptr<dynet::ParameterCollection> & mod,
+                                                               DictPtr & vocab_src, DictPtr & vocab_trg);
+template
+EncoderAttentional* ModelUtils::LoadBilingualModelAndParams<EncoderAttentional>(const std::string & infile,
+                                                                       std::shared_ptr<dynet::ParameterCollection> & mod,
+                                                                       DictPtr & vocab_src, DictPtr & vocab_trg);
+template
+EncoderClassifier* ModelUtils::LoadBilingualModelAndParams<EncoderClassifier>(const std::string & infile,
+                                                                     std::shared_ptr<dynet::ParameterCollection> & mod,
+                                                                     DictPtr & vocab_src, DictPtr & vocab_trg);
+template
+NeuralLM* ModelUtils::LoadMonolingualModelAndParams<NeuralLM>(const std::string & infile,
+                                                              std::shared_ptr<dynet::ParameterCollection> & mod,
+                                                              DictPtr & vocab_trg);
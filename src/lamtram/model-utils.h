@@ -42,6 +42,21 @@ public:
                                 std::shared_ptr<dynet::ParameterCollection> & mod,
                                 DictPtr & vocab_trg);
 
+    // Load a model and its parameters from a file in either the text format,
+    // which keeps the parameters in file + ".data", or the binary format
+    template <class ModelType>
+    static ModelType* LoadBilingualModelAndParams(const std::string & infile,
+                                std::shared_ptr<dynet::ParameterCollection> & mod,
+                                DictPtr & vocab_src, DictPtr & vocab_trg);
+    template <class ModelType>
+    static ModelType* LoadMonolingualModelAndParams(const std::string & infile,
+                                std::shared_ptr<dynet::ParameterCollection> & mod,
+                                DictPtr & vocab_trg);
+
+    // Write a model, where header contains the vocabularies and model description
+    static void WriteModel(const std::string & outfile, const std::string & header,
+                           dynet::ParameterCollection & mod, bool binary);
+
 };
 
 }
@@ -28,7 +28,7 @@ NeuralLM::NeuralLM(const DictPtr & vocab, int ngram_context, int extern_context,
            ParameterCollection & model) :
       vocab_(vocab), ngram_context_(ngram_context),
       extern_context_(extern_context), extern_feed_(extern_feed), wordrep_size_(wordrep_size),
-      unk_id_(unk_id), hidden_spec_(hidden_spec), curr_graph_(NULL) {
+      unk_id_(unk_id), hidden_spec_(hidden_spec), dropout_(0.f), curr_graph_(NULL) {
   if(wordrep_size_ <= 0) wordrep_size_ = GlobalVars::layer_size;
   // Hidden layers
   builder_ = BuilderFactory::CreateBuilder(hidden_spec_,
@@ -94,7 +94,7 @@ Expression NeuralLM::BuildSentGraph(
     Expression i_prior;
     // Calculate the extern if existing
     if(extern_context_ > 0) {
-      extern_in = extern_calc->CreateContext(builder_->final_h(), align_sum, train, cg, aligns, align_sum);
+      extern_in = extern_calc->CreateContext(t, builder_->final_h(), align_sum, train, cg, aligns, align_sum);
       i_h_t = concatenate({i_h_t, extern_in});
       i_prior = extern_calc->CalcPrior(*aligns.rbegin());
     }
@@ -186,7 +186,7 @@ Expression NeuralLM::BuildSentGraph(
     Expression i_prior;
     // Calculate the extern if existing
     if(extern_context_ > 0) {
-      extern_in = extern_calc->CreateContext(builder_->final_h(), align_sum, train, cg, aligns, align_sum);
+      extern_in = extern_calc->CreateContext(t, builder_->final_h(), align_sum, train, cg, aligns, align_sum);
       i_h_t = concatenate({i_h_t, extern_in});
       i_prior = extern_calc->CalcPrior(*aligns.rbegin());
     }
@@ -264,25 +264,25 @@ Expression NeuralLM::SampleTrgSentences(
   if(&cg != curr_graph_)
     THROW_ERROR("Initialized computation graph and passed comptuation graph don't match.");
   builder_->start_new_sequence(layer_in);
-  // First get all the word representations
-  vector<unsigned> words(num_samples, 0);
-  Expression i_wr_start = lookup(cg, p_wr_W_, words);
-  vector<Expression> i_wr;
+  // The batch holds the samples that haven't ended yet, ids maps each
+  // element of the batch to its sample. Ended samples that are still in the
+  // batch are mapped to num_samples.
+  vector<unsigned> ids(num_samples), words(num_samples, 0);
+  for(int i = 0; i < num_samples; i++) ids[i] = i;
+  size_t num_active = num_samples;
+  // The representations of the last ngram_context_ words
+  vector<Expression> i_wr(ngram_context_, lookup(cg, p_wr_W_, words));
   // Initialize the previous extern
   Expression extern_in;
   if(extern_context_ != 0 && extern_feed_) extern_in = extern_calc->GetEmptyContext(cg);
   // Next, do the computation
-  vector<Expression> log_probs, aligns;
-  Expression align_sum;
+  vector<Expression> aligns, sample_log_probs(num_samples);
+  Expression align_sum, log_prob_sum;
   vector<Sentence> ctxts(num_samples, Sentence(softmax_->GetCtxtLen(), 0));
   samples.clear(); samples.resize(num_samples);
-  vector<float> mask(num_samples, 1.0);
-  size_t active_words = num_samples;
-  for(int t = 0; t < max_len && active_words > 0; t++) {
+  for(int t = 0; t < max_len && num_active > 0; t++) {
     // Concatenate wordrep and external context into a vector for the hidden unit
-    vector<Expression> i_wrs_t;
-    for(auto hist : boost::irange(t - ngram_context_, t))
-      i_wrs_t.push_back(hist >= 0 ? i_wr[hist] : i_wr_start);
+    vector<Expression> i_wrs_t = i_wr;
     if(extern_context_ > 0 && extern_feed_)
       i_wrs_t.push_back(extern_in);
     // Concatenate the inputs if necessary
@@ -298,48 +298,67 @@ Expression NeuralLM::SampleTrgSentences(
     // Calculate the extern if existing
     Expression i_prior;
     if(extern_context_ > 0) {
-      extern_in = extern_calc->CreateContext(builder_->final_h(), align_sum, train, cg, aligns, align_sum);
+      extern_in = extern_calc->CreateContext(t, builder_->final_h(), align_sum, train, cg, aligns, align_sum);
       i_h_t = concatenate({i_h_t, extern_in});
       i_prior = extern_calc->CalcPrior(*aligns.rbegin());
     }
-    // Create the cache
-    Expression i_err;
-    // Perform sampling if necessary
+    // Sample the next word of each sample, or take it from the answer
     Expression i_prob = softmax_->CalcProb(i_h_t, i_prior, ctxts, train);
     vector<float> probs = as_vector(i_prob.value());
-    if(mask[0]) {
-      if(answer != NULL && t < (int)answer->size())
-        words[0] = (*answer)[t];
+    for(size_t i = 0; i < ids.size(); i++) {
+      if(ids[i] == 0 && answer != NULL && t < (int)answer->size())
+        words[i] = (*answer)[t];
       else
-        words[0] = categorical_dist(probs.begin(), probs.begin()+vocab_->size());
-    }
-    for(size_t i = 1; i < ctxts.size(); i++)
-      if(mask[i])
         words[i] = categorical_dist(probs.begin()+i*vocab_->size(), probs.begin()+(i+1)*vocab_->size());
-    // Get the word representations
-    i_wr.push_back(lookup(cg, p_wr_W_, words));
+    }
     Expression i_log_pick = log(pick(i_prob, words));
-    if(active_words != num_samples)
-      i_log_pick = i_log_pick * input(cg, Dim({1}, num_samples), mask);
-    log_probs.push_back(i_log_pick);
-    // Update the n-grams
-    for(size_t i = 0; i < num_samples; i++) {
-      // Count words, add mask
-      if(mask[i]) {
-        if(ctxts[0].size() > 0) {    
-          for(nt = 0; nt < ctxts[0].size()-1; nt++)
-            ctxts[i][nt] = ctxts[i][nt+1];
-          ctxts[i][nt] = words[i];
-        }
-        samples[i].push_back(words[i]);
-        if(words[i] == 0) {
-          mask[i] = 0.f;
-          active_words--;
-        }
+    log_prob_sum = (t == 0 ? i_log_pick : log_prob_sum + i_log_pick);
+    if(ngram_context_ > 0) {
+      i_wr.erase(i_wr.begin());
+      i_wr.push_back(lookup(cg, p_wr_W_, words));
+    }
+    // Update the n-grams and find the samples that continue
+    vector<unsigned> keep;
+    for(size_t i = 0; i < ids.size(); i++) {
+      if(ids[i] == (unsigned)num_samples) continue;
+      if(ctxts[i].size() > 0) {
+        for(nt = 0; nt < ctxts[i].size()-1; nt++)
+          ctxts[i][nt] = ctxts[i][nt+1];
+        ctxts[i][nt] = words[i];
+      }
+      samples[ids[i]].push_back(words[i]);
+      if(words[i] != 0) {
+        keep.push_back(i);
+      } else {
+        sample_log_probs[ids[i]] = pick_batch_elem(log_prob_sum, i);
+        ids[i] = num_samples;
+      }
+    }
+    num_active = keep.size();
+    // Remove the finished samples from the batch, so later steps only
+    // calculate the ones that remain. Restarting the sequence would draw new
+    // dropout masks in the middle of the samples, so don't when using dropout.
+    if(keep.size() != ids.size() && keep.size() > 0 && (dropout_ == 0.f || !train)) {
+      vector<Expression> state = builder_->final_s();
+      for(auto & s : state) s = pick_batch_elems(s, keep);
+      builder_->start_new_sequence(state);
+      for(auto & wr : i_wr) wr = pick_batch_elems(wr, keep);
+      if(extern_context_ > 0 && extern_feed_) extern_in = pick_batch_elems(extern_in, keep);
+      if(align_sum.pg != nullptr) align_sum = pick_batch_elems(align_sum, keep);
+      log_prob_sum = pick_batch_elems(log_prob_sum, keep);
+      for(size_t i = 0; i < keep.size(); i++) {
+        ids[i] = ids[keep[i]];
+        words[i] = words[keep[i]];
+        ctxts[i] = ctxts[keep[i]];
       }
+      ids.resize(keep.size()); words.resize(keep.size()); ctxts.resize(keep.size());
     }
   }
-  return reshape(sum(log_probs), Dim({(unsigned int)num_samples}));
+  // The samples that reached the maximum length
+  for(size_t i = 0; i < ids.size(); i++)
+    if(ids[i] != (unsigned)num_samples)
+      sample_log_probs[ids[i]] = pick_batch_elem(log_prob_sum, i);
+  return concatenate(sample_log_probs);
 }
 
 void NeuralLM::NewGraph(ComputationGraph & cg) {
@@ -418,7 +437,7 @@ Expression NeuralLM::Forward(const Sent & sent, int t,
   Expression i_prior;
   // Calculate the extern if existing
   if(extern_context_ > 0) {
-    extern_out = extern_calc->CreateContext(builder_->final_h(), align_sum_in, false, cg, align_out, align_sum_out);
+    extern_out = extern_calc->CreateContext(t, builder_->final_h(), align_sum_in, false, cg, align_out, align_sum_out);
     i_h_t = concatenate({i_h_t, extern_out});
     i_prior = extern_calc->CalcPrior(*align_out.rbegin());
   }
@@ -487,5 +506,5 @@ void NeuralLM::Write(std::ostream & out) {
 }
 
 int NeuralLM::GetVocabSize() const { return vocab_->size(); }
-void NeuralLM::SetDropout(float dropout) { builder_->set_dropout(dropout); }
+void NeuralLM::SetDropout(float dropout) { dropout_ = dropout; builder_->set_dropout(dropout); }
 
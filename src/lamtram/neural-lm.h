@@ -9,6 +9,7 @@
 #include <dynet/expr.h>
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 namespace dynet {
 class Model;
@@ -127,6 +128,8 @@ public:
     // Accessors
     int GetVocabSize() const;
     int GetNgramContext() const { return ngram_context_; }
+    // The number of previous words that Forward() looks at
+    int GetHistoryLength() const { return std::max(ngram_context_, softmax_->GetCtxtLen()); }
     int GetExternalContext() const { return extern_context_; }
     int GetWordrepSize() const { return wordrep_size_; }
     int GetUnkId() const { return unk_id_; }
@@ -148,6 +151,7 @@ protected:
     bool extern_feed_;
     int wordrep_size_, unk_id_;
     BuilderSpec hidden_spec_;
+    float dropout_;
 
     // Pointers to the parameters
     dynet::LookupParameter p_wr_W_; // Wordrep weights
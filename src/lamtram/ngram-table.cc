@@ -0,0 +1,121 @@
+#include <lamtram/ngram-table.h>
+#include <lamtram/macros.h>
+#include <cstring>
+
+using namespace std;
+using namespace lamtram;
+
+// The size of each number at the start of a serialized table
+struct NgramTableSizes {
+  uint64_t max_len, num_entries, num_slots;
+};
+
+inline uint64_t HashNgram(const WordId * words, size_t len) {
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len;
+  for(size_t i = 0; i < len; i++) {
+    hash ^= (uint32_t)words[i];
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+// Whether an entry's padded row of words holds exactly this n-gram
+inline bool MatchNgram(const WordId * row, size_t max_len, const WordId * words, size_t len) {
+  return (len == max_len || row[len] == -1) && memcmp(row, words, len * sizeof(WordId)) == 0;
+}
+
+NgramTable::NgramTable(size_t max_len) : max_len_(max_len), num_entries_(0), num_slots_(16), mapped_(false),
+                                         own_slots_(16, -1), slots_(own_slots_.data()), words_(nullptr), values_(nullptr) { }
+
+NgramTable::NgramTable(const NgramTable & rhs) {
+  *this = rhs;
+}
+
+NgramTable & NgramTable::operator=(const NgramTable & rhs) {
+  max_len_ = rhs.max_len_; num_entries_ = rhs.num_entries_; num_slots_ = rhs.num_slots_;
+  mapped_ = rhs.mapped_;
+  own_slots_ = rhs.own_slots_; own_words_ = rhs.own_words_; own_values_ = rhs.own_values_;
+  if(mapped_) {
+    slots_ = rhs.slots_; words_ = rhs.words_; values_ = rhs.values_;
+  } else {
+    slots_ = own_slots_.data(); words_ = own_words_.data(); values_ = own_values_.data();
+  }
+  return *this;
+}
+
+void NgramTable::Insert(const WordId * words, size_t len, int value) {
+  if(mapped_) THROW_ERROR("Can't add n-grams to a mapped table");
+  if(len > max_len_) THROW_ERROR("N-gram of length " << len << " is longer than the maximum of " << max_len_);
+  if(value < 0) THROW_ERROR("N-gram values must not be negative, but got " << value);
+  // Keep at least half of the slots empty so probes stay short
+  if((num_entries_ + 1) * 2 > num_slots_) Grow();
+  size_t slot = HashNgram(words, len) & (num_slots_ - 1);
+  while(own_slots_[slot] != -1) slot = (slot + 1) & (num_slots_ - 1);
+  own_slots_[slot] = num_entries_++;
+  own_words_.insert(own_words_.end(), words, words + len);
+  own_words_.resize(own_words_.size() + max_len_ - len, -1);
+  own_values_.push_back(value);
+  words_ = own_words_.data();
+  values_ = own_values_.data();
+}
+
+const int * NgramTable::Find(const WordId * words, size_t len) const {
+  if(len > max_len_) return nullptr;
+  for(size_t slot = HashNgram(words, len) & (num_slots_ - 1); slots_[slot] != -1; slot = (slot + 1) & (num_slots_ - 1)) {
+    int32_t id = slots_[slot];
+    if(MatchNgram(words_ + id * max_len_, max_len_, words, len))
+      return values_ + id;
+  }
+  return nullptr;
+}
+
+Sentence NgramTable::GetNgram(size_t id) const {
+  const WordId * row = words_ + id * max_len_;
+  size_t len = 0;
+  while(len < max_len_ && row[len] != -1) len++;
+  return Sentence(row, row + len);
+}
+
+void NgramTable::Grow() {
+  num_slots_ *= 2;
+  own_slots_.assign(num_slots_, -1);
+  slots_ = own_slots_.data();
+  for(size_t id = 0; id < num_entries_; id++) {
+    const WordId * row = words_ + id * max_len_;
+    size_t len = 0;
+    while(len < max_len_ && row[len] != -1) len++;
+    size_t slot = HashNgram(row, len) & (num_slots_ - 1);
+    while(own_slots_[slot] != -1) slot = (slot + 1) & (num_slots_ - 1);
+    own_slots_[slot] = id;
+  }
+}
+
+size_t NgramTable::GetByteSize() const {
+  return sizeof(NgramTableSizes) + (num_slots_ + num_entries_ * max_len_ + num_entries_) * sizeof(int32_t);
+}
+
+void NgramTable::Write(std::string & out) const {
+  NgramTableSizes sizes;
+  sizes.max_len = max_len_; sizes.num_entries = num_entries_; sizes.num_slots = num_slots_;
+  out.append((const char*)&sizes, sizeof(sizes));
+  out.append((const char*)slots_, num_slots_ * sizeof(int32_t));
+  out.append((const char*)words_, num_entries_ * max_len_ * sizeof(WordId));
+  out.append((const char*)values_, num_entries_ * sizeof(int32_t));
+}
+
+void NgramTable::Map(const char * data, size_t size) {
+  NgramTableSizes sizes;
+  if(size < sizeof(sizes)) THROW_ERROR("Premature end of n-gram table");
+  memcpy(&sizes, data, sizeof(sizes));
+  if(sizes.num_slots == 0 || (sizes.num_slots & (sizes.num_slots - 1)) != 0 || sizes.num_entries * 2 > sizes.num_slots)
+    THROW_ERROR("Bad number of slots in n-gram table: " << sizes.num_slots);
+  max_len_ = sizes.max_len; num_entries_ = sizes.num_entries; num_slots_ = sizes.num_slots;
+  if(size != GetByteSize())
+    THROW_ERROR("Expecting " << GetByteSize() << " bytes for an n-gram table but got " << size);
+  slots_ = (const int32_t*)(data + sizeof(sizes));
+  words_ = (const WordId*)(slots_ + num_slots_);
+  values_ = (const int32_t*)(words_ + num_entries_ * max_len_);
+  own_slots_.clear(); own_words_.clear(); own_values_.clear();
+  mapped_ = true;
+}
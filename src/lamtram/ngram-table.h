@@ -0,0 +1,65 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// A hash table from n-grams of at most max_len words to non-negative values.
+//
+// Everything is kept in three flat arrays: the open-addressing slots, which
+// hold the position of each entry, the words of each entry padded to max_len
+// with -1, and the values. Looking up an n-gram hashes the words in place and
+// compares them against a single row of the words array, so nothing is
+// allocated. The arrays can also be pointed at memory that was mapped from a
+// file, so a large table can be used without reading it in.
+class NgramTable {
+
+public:
+    NgramTable(size_t max_len = 0);
+    // Copies point at their own arrays, or at the same mapped data
+    NgramTable(const NgramTable & rhs);
+    NgramTable & operator=(const NgramTable & rhs);
+
+    // Add an n-gram, which must not be in the table yet
+    void Insert(const WordId * words, size_t len, int value);
+    void Insert(const Sentence & ngram, int value) { Insert(ngram.data(), ngram.size(), value); }
+
+    // Find the value of an n-gram, or null if it is not in the table
+    const int * Find(const WordId * words, size_t len) const;
+    const int * Find(const Sentence & ngram) const { return Find(ngram.data(), ngram.size()); }
+
+    // The entries in the order they were added
+    size_t GetSize() const { return num_entries_; }
+    size_t GetMaxLen() const { return max_len_; }
+    Sentence GetNgram(size_t id) const;
+    int GetValue(size_t id) const { return values_[id]; }
+
+    // Serialize the table, which takes GetByteSize() bytes, and use a
+    // serialized table in place. The data must stay valid and 4-byte aligned,
+    // and the table can't be changed afterwards.
+    void Write(std::string & out) const;
+    void Map(const char * data, size_t size);
+    size_t GetByteSize() const;
+
+protected:
+
+    // Double the number of slots and put the entries back in
+    void Grow();
+
+    size_t max_len_, num_entries_, num_slots_;
+    bool mapped_;
+    std::vector<int32_t> own_slots_;
+    std::vector<WordId> own_words_;
+    std::vector<int32_t> own_values_;
+    // The arrays in use, which point either into the vectors or mapped data
+    const int32_t * slots_;
+    const WordId * words_;
+    const int32_t * values_;
+
+};
+
+}
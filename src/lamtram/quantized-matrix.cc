@@ -0,0 +1,227 @@
+#include <lamtram/quantized-matrix.h>
+#include <lamtram/macros.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LAMTRAM_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace lamtram;
+
+// Convert to IEEE half precision, rounding to the nearest even value
+inline uint16_t FloatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint16_t sign = (x >> 16) & 0x8000;
+  uint32_t mag = x & 0x7fffffff;
+  // Infinity and NaN
+  if(mag >= 0x7f800000) return sign | 0x7c00 | (mag > 0x7f800000 ? 0x200 : 0);
+  // Too large, rounds to infinity
+  if(mag >= 0x477ff000) return sign | 0x7c00;
+  // Too small for a normal half, count in units of 2^-24
+  if(mag < 0x38800000) {
+    float abs_f;
+    memcpy(&abs_f, &mag, sizeof(abs_f));
+    return sign | (uint16_t)nearbyint(abs_f * 16777216.f);
+  }
+  uint32_t h = (mag - 0x38000000) >> 13, rem = mag & 0x1fff;
+  if(rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+  return sign | h;
+}
+
+inline float HalfToFloat(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff, x;
+  if(exp == 0) {
+    float f = mant / 16777216.f;
+    return sign ? -f : f;
+  } else if(exp == 31) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+inline float DotInt8(const int8_t * w, const float * x, unsigned n) {
+  float sum = 0.f;
+  for(unsigned i = 0; i < n; i++) sum += w[i] * x[i];
+  return sum;
+}
+
+inline float DotHalf(const uint16_t * w, const float * x, unsigned n) {
+  float sum = 0.f;
+  for(unsigned i = 0; i < n; i++) sum += HalfToFloat(w[i]) * x[i];
+  return sum;
+}
+
+#ifdef LAMTRAM_X86_KERNELS
+// The kernels are compiled for AVX2 and used only if the CPU supports it, so
+// the rest of the library doesn't need to be built for it.
+__attribute__((target("avx2,fma")))
+static inline float SumAvx2(__m256 acc) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+  sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+  sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+  return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static float DotInt8Avx2(const int8_t * w, const float * x, unsigned n) {
+  __m256 acc = _mm256_setzero_ps();
+  unsigned i = 0;
+  for(; i + 8 <= n; i += 8) {
+    __m256 wv = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)(w + i))));
+    acc = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x + i), acc);
+  }
+  float sum = SumAvx2(acc);
+  for(; i < n; i++) sum += w[i] * x[i];
+  return sum;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+static float DotHalfAvx2(const uint16_t * w, const float * x, unsigned n) {
+  __m256 acc = _mm256_setzero_ps();
+  unsigned i = 0;
+  for(; i + 8 <= n; i += 8) {
+    __m256 wv = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(w + i)));
+    acc = _mm256_fmadd_ps(wv, _mm256_loadu_ps(x + i), acc);
+  }
+  float sum = SumAvx2(acc);
+  for(; i < n; i++) sum += HalfToFloat(w[i]) * x[i];
+  return sum;
+}
+
+static bool UseAvx2() {
+  static bool use = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c");
+  return use;
+}
+#endif
+
+QuantizedMatrix::QuantizedMatrix(Type type, unsigned rows, unsigned cols) : type_(type), rows_(rows), cols_(cols) {
+  if(type_ == kInt8) {
+    own_data_.resize((size_t)rows_ * cols_);
+    own_scales_.resize(rows_);
+  } else if(type_ == kFloat16) {
+    own_data_.resize((size_t)rows_ * cols_ * sizeof(uint16_t));
+  } else {
+    THROW_ERROR("Illegal quantization type: " << type_);
+  }
+  data_ = own_data_.data();
+  scales_ = own_scales_.data();
+}
+
+QuantizedMatrix::QuantizedMatrix(Type type, unsigned rows, unsigned cols, const char * data, size_t size) :
+      type_(type), rows_(rows), cols_(cols), data_(data) {
+  if(size != GetByteSize(type_, rows_, cols_))
+    THROW_ERROR("Expecting " << GetByteSize(type_, rows_, cols_) << " bytes for a quantized matrix but got " << size);
+  // The scales follow the values, so they are only copied if they are not aligned
+  const char * scales = data + (size_t)rows_ * cols_;
+  if(type_ == kFloat16) {
+    scales_ = nullptr;
+  } else if((size_t)scales % sizeof(float) == 0) {
+    scales_ = (const float*)scales;
+  } else {
+    own_scales_.resize(rows_);
+    memcpy(own_scales_.data(), scales, rows_ * sizeof(float));
+    scales_ = own_scales_.data();
+  }
+}
+
+size_t QuantizedMatrix::GetByteSize(Type type, unsigned rows, unsigned cols) {
+  if(type == kInt8) return (size_t)rows * cols + rows * sizeof(float);
+  else if(type == kFloat16) return (size_t)rows * cols * sizeof(uint16_t);
+  THROW_ERROR("Illegal quantization type: " << type);
+}
+
+QuantizedMatrix::Type QuantizedMatrix::ParseType(const std::string & name) {
+  if(name == "int8") return kInt8;
+  else if(name == "fp16") return kFloat16;
+  THROW_ERROR("Illegal quantization type (must be int8 or fp16): " << name);
+}
+
+void QuantizedMatrix::SetRow(unsigned row, const float * vals, size_t stride) {
+  if(data_ != own_data_.data()) THROW_ERROR("Can't set the values of a mapped quantized matrix");
+  if(type_ == kInt8) {
+    float max_abs = 0.f;
+    for(unsigned i = 0; i < cols_; i++) max_abs = max(max_abs, fabs(vals[i*stride]));
+    float scale = max_abs / 127.f;
+    int8_t * out = (int8_t*)own_data_.data() + (size_t)row * cols_;
+    for(unsigned i = 0; i < cols_; i++)
+      out[i] = (scale == 0.f ? 0 : (int8_t)max(-127.f, min(127.f, nearbyintf(vals[i*stride] / scale))));
+    own_scales_[row] = scale;
+  } else {
+    uint16_t * out = (uint16_t*)own_data_.data() + (size_t)row * cols_;
+    for(unsigned i = 0; i < cols_; i++)
+      out[i] = FloatToHalf(vals[i*stride]);
+  }
+}
+
+void QuantizedMatrix::SetRowMajor(const float * vals) {
+  for(unsigned r = 0; r < rows_; r++)
+    SetRow(r, vals + (size_t)r * cols_, 1);
+}
+
+void QuantizedMatrix::SetColumnMajor(const float * vals) {
+  for(unsigned r = 0; r < rows_; r++)
+    SetRow(r, vals + r, rows_);
+}
+
+void QuantizedMatrix::GetColumnMajor(float * vals) const {
+  for(unsigned r = 0; r < rows_; r++) {
+    for(unsigned c = 0; c < cols_; c++) {
+      size_t pos = (size_t)r * cols_ + c;
+      vals[(size_t)c * rows_ + r] = (type_ == kInt8 ? scales_[r] * ((const int8_t*)data_)[pos] :
+                                                      HalfToFloat(((const uint16_t*)data_)[pos]));
+    }
+  }
+}
+
+void QuantizedMatrix::Multiply(const float * x, unsigned batch_size, const std::vector<unsigned> * ids, float * y) const {
+  size_t num_rows = (ids != nullptr ? ids->size() : rows_);
+#ifdef LAMTRAM_X86_KERNELS
+  bool avx2 = UseAvx2();
+#endif
+  // Each row is used for the whole batch while it is in the cache
+  for(size_t i = 0; i < num_rows; i++) {
+    unsigned row = (ids != nullptr ? (*ids)[i] : i);
+    for(unsigned b = 0; b < batch_size; b++) {
+      const float * xb = x + (size_t)b * cols_;
+      float val;
+      if(type_ == kInt8) {
+        const int8_t * w = (const int8_t*)data_ + (size_t)row * cols_;
+#ifdef LAMTRAM_X86_KERNELS
+        val = scales_[row] * (avx2 ? DotInt8Avx2(w, xb, cols_) : DotInt8(w, xb, cols_));
+#else
+        val = scales_[row] * DotInt8(w, xb, cols_);
+#endif
+      } else {
+        const uint16_t * w = (const uint16_t*)data_ + (size_t)row * cols_;
+#ifdef LAMTRAM_X86_KERNELS
+        val = (avx2 ? DotHalfAvx2(w, xb, cols_) : DotHalf(w, xb, cols_));
+#else
+        val = DotHalf(w, xb, cols_);
+#endif
+      }
+      y[b * num_rows + i] = val;
+    }
+  }
+}
+
+void QuantizedMatrix::Write(std::string & out) const {
+  out.append(data_, GetByteSize() - (type_ == kInt8 ? rows_ * sizeof(float) : 0));
+  if(type_ == kInt8) out.append((const char*)scales_, rows_ * sizeof(float));
+}
+
+void QuantizedMatrix::Read(const char * data, size_t size) {
+  if(size != GetByteSize())
+    THROW_ERROR("Expecting " << GetByteSize() << " bytes for a quantized matrix but got " << size);
+  if(data_ != own_data_.data()) THROW_ERROR("Can't set the values of a mapped quantized matrix");
+  memcpy(own_data_.data(), data, own_data_.size());
+  memcpy(own_scales_.data(), data + own_data_.size(), own_scales_.size() * sizeof(float));
+}
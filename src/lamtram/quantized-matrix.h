@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// A matrix stored with less precision, which takes less memory and less
+// memory bandwidth when multiplying it with a vector while decoding.
+//
+// The rows are stored one after another, either as 8-bit integers with one
+// scale per row, which maps the largest absolute value of the row to 127, or
+// as 16-bit floats. The error of an int8 value is at most max|row|/254, and
+// fp16 values keep about three significant digits.
+class QuantizedMatrix {
+
+public:
+    // The values are stored in binary model files
+    enum Type { kInt8 = 1, kFloat16 = 2 };
+
+    QuantizedMatrix(Type type, unsigned rows, unsigned cols);
+    // Use serialized values in place without copying them, so a matrix in a
+    // mapped model file takes no memory of its own. The data must stay valid,
+    // and the values can't be set afterwards.
+    QuantizedMatrix(Type type, unsigned rows, unsigned cols, const char * data, size_t size);
+    QuantizedMatrix(const QuantizedMatrix & rhs) = delete;
+    QuantizedMatrix & operator=(const QuantizedMatrix & rhs) = delete;
+
+    // Get the type from its name ("int8" or "fp16")
+    static Type ParseType(const std::string & name);
+
+    // Quantize values of a matrix in row-major order, or in the column-major
+    // order that dynet uses
+    void SetRowMajor(const float * vals);
+    void SetColumnMajor(const float * vals);
+    // Get approximate values of the matrix in column-major order
+    void GetColumnMajor(float * vals) const;
+
+    // Multiply with a batch of vectors, each of length cols. For each vector,
+    // this writes the products with the rows in ids, or all rows if ids is null.
+    void Multiply(const float * x, unsigned batch_size, const std::vector<unsigned> * ids, float * y) const;
+
+    // Serialize the values and scales, which take GetByteSize() bytes
+    void Write(std::string & out) const;
+    void Read(const char * data, size_t size);
+    size_t GetByteSize() const { return GetByteSize(type_, rows_, cols_); }
+    static size_t GetByteSize(Type type, unsigned rows, unsigned cols);
+
+    Type GetType() const { return type_; }
+    unsigned GetRows() const { return rows_; }
+    unsigned GetCols() const { return cols_; }
+
+protected:
+
+    // Quantize one row of cols values spaced stride apart
+    void SetRow(unsigned row, const float * vals, size_t stride);
+
+    Type type_;
+    unsigned rows_, cols_;
+    std::vector<char> own_data_;
+    std::vector<float> own_scales_;
+    // The values in use, which point either into the vectors or mapped data
+    const char * data_;
+    const float * scales_;
+
+};
+
+typedef std::shared_ptr<QuantizedMatrix> QuantizedMatrixPtr;
+
+}
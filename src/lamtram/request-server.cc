@@ -0,0 +1,166 @@
+#include <lamtram/request-server.h>
+#include <lamtram/macros.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+
+using namespace std;
+using namespace lamtram;
+
+// Remove a socket file left at this path, but never any other kind of file
+static bool RemoveSocketFile(const std::string & path) {
+  struct stat st;
+  if(lstat(path.c_str(), &st) == -1) return true;
+  if(!S_ISSOCK(st.st_mode)) return false;
+  unlink(path.c_str());
+  return true;
+}
+
+RequestServer::RequestServer(const std::string & socket_path, int port) : socket_path_(socket_path), listen_fd_(-1), next_client_(0) {
+  if(socket_path_ != "") {
+    struct sockaddr_un addr;
+    if(socket_path_.size() >= sizeof(addr.sun_path))
+      THROW_ERROR("Socket path is too long: " << socket_path_);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path_.c_str());
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listen_fd_ == -1) THROW_ERROR("Could not create socket");
+    if(!RemoveSocketFile(socket_path_))
+      THROW_ERROR("Not replacing " << socket_path_ << ", which exists and is not a socket");
+    if(::bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+      THROW_ERROR("Could not bind to socket " << socket_path_ << ": " << strerror(errno));
+  } else {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_fd_ == -1) THROW_ERROR("Could not create socket");
+    int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if(::bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) == -1)
+      THROW_ERROR("Could not bind to port " << port << ": " << strerror(errno));
+  }
+  if(listen(listen_fd_, SOMAXCONN) == -1)
+    THROW_ERROR("Could not listen for connections: " << strerror(errno));
+}
+
+RequestServer::~RequestServer() {
+  for(auto & client : client_fds_)
+    close(client.second);
+  if(listen_fd_ != -1) close(listen_fd_);
+  if(socket_path_ != "") RemoveSocketFile(socket_path_);
+}
+
+void RequestServer::CloseClient(int client) {
+  auto it = client_fds_.find(client);
+  if(it == client_fds_.end()) return;
+  close(it->second);
+  client_fds_.erase(it);
+  client_buffers_.erase(client);
+  client_out_.erase(client);
+  client_waiting_.erase(client);
+  client_ended_.erase(client);
+}
+
+void RequestServer::Poll(int timeout) {
+  vector<struct pollfd> fds(1);
+  vector<int> clients(1, -1);
+  fds[0].fd = listen_fd_;
+  fds[0].events = POLLIN;
+  for(auto & client : client_fds_) {
+    struct pollfd fd;
+    fd.fd = client.second;
+    fd.events = (client_ended_.count(client.first) ? 0 : POLLIN) | (client_out_[client.first].size() ? POLLOUT : 0);
+    if(fd.events == 0) continue;
+    fds.push_back(fd);
+    clients.push_back(client.first);
+  }
+  int ret = poll(&fds[0], fds.size(), timeout);
+  if(ret == -1) {
+    if(errno == EINTR) return;
+    THROW_ERROR("Error waiting for requests: " << strerror(errno));
+  }
+  char buf[65536];
+  for(size_t i = 1; i < fds.size(); i++) {
+    if(fds[i].revents & POLLOUT) Flush(clients[i]);
+    // The client may have been closed, or only be waiting for its output
+    if(client_fds_.count(clients[i]) == 0 || !(fds[i].events & POLLIN)) continue;
+    if(!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+    ssize_t len = read(fds[i].fd, buf, sizeof(buf));
+    if(len < 0) {
+      if(errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) CloseClient(clients[i]);
+      continue;
+    }
+    // Once the client is done sending, it still gets the responses it is waiting for
+    if(len == 0) {
+      if(client_waiting_[clients[i]] > 0 || client_out_[clients[i]].size() > 0)
+        client_ended_.insert(clients[i]);
+      else
+        CloseClient(clients[i]);
+      continue;
+    }
+    // Split off all the complete lines as requests
+    string & buffer = client_buffers_[clients[i]];
+    buffer.append(buf, len);
+    size_t start = 0, end;
+    while((end = buffer.find('\n', start)) != string::npos) {
+      pending_.push_back(ServerRequest(clients[i], buffer.substr(start, end - start)));
+      client_waiting_[clients[i]]++;
+      start = end + 1;
+    }
+    buffer.erase(0, start);
+  }
+  if(fds[0].revents & POLLIN) {
+    int fd = accept(listen_fd_, nullptr, nullptr);
+    if(fd != -1) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+      client_fds_[next_client_++] = fd;
+    }
+  }
+}
+
+void RequestServer::GetRequests(int max_requests, std::vector<ServerRequest> & requests) {
+  // Gather everything that has already arrived, then wait if there is nothing
+  Poll(0);
+  while(pending_.size() == 0)
+    Poll(-1);
+  size_t num = min(pending_.size(), (size_t)max_requests);
+  requests.assign(pending_.begin(), pending_.begin() + num);
+  pending_.erase(pending_.begin(), pending_.begin() + num);
+}
+
+void RequestServer::Respond(int client, const std::string & line) {
+  if(client_fds_.count(client) == 0) return;
+  client_out_[client] += line + '\n';
+  client_waiting_[client]--;
+  Flush(client);
+}
+
+void RequestServer::Flush(int client) {
+  string & out = client_out_[client];
+  size_t pos = 0;
+  while(pos < out.size()) {
+    ssize_t len = send(client_fds_[client], out.data() + pos, out.size() - pos, MSG_NOSIGNAL);
+    if(len == -1 && errno == EINTR) continue;
+    // The rest is sent once the client has read more
+    if(len == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if(len <= 0) {
+      CloseClient(client);
+      return;
+    }
+    pos += len;
+  }
+  out.erase(0, pos);
+  if(out.empty() && client_waiting_[client] == 0 && client_ended_.count(client))
+    CloseClient(client);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// A request received by a RequestServer, which is a single line of text
+struct ServerRequest {
+    ServerRequest(int client, const std::string & line) : client(client), line(line) { }
+    int client;
+    std::string line;
+};
+
+// A server that accepts connections on a Unix domain socket or a localhost
+// TCP port, and reads newline-terminated requests from any number of clients.
+// Everything happens in a single thread, and requests that arrive at the same
+// time are returned together so they can be processed as a batch.
+class RequestServer {
+
+public:
+    // Listen on socket_path if it is not empty, and otherwise on port
+    RequestServer(const std::string & socket_path, int port);
+    ~RequestServer();
+
+    // Wait until at least one request is available, and get up to max_requests
+    // requests in the order they were received
+    void GetRequests(int max_requests, std::vector<ServerRequest> & requests);
+
+    // Send a response line to a client, which is ignored if it has disconnected.
+    // What the client doesn't read right away is buffered and sent while
+    // waiting for requests, so a slow client doesn't hold up the others. A
+    // client that has closed its end is disconnected after it gets a response
+    // to each of its requests.
+    void Respond(int client, const std::string & line);
+
+protected:
+
+    // Accept new clients and read any available data, waiting at most timeout ms
+    void Poll(int timeout);
+    // Send as much of the buffered output of a client as possible
+    void Flush(int client);
+    void CloseClient(int client);
+
+    std::string socket_path_;
+    int listen_fd_;
+    int next_client_;
+    // The socket, buffered unfinished input, and unsent output for each client
+    std::map<int,int> client_fds_;
+    std::map<int,std::string> client_buffers_;
+    std::map<int,std::string> client_out_;
+    // The number of requests of each client without a response, and the
+    // clients that won't send any more
+    std::map<int,int> client_waiting_;
+    std::set<int> client_ended_;
+    std::vector<ServerRequest> pending_;
+
+};
+
+}
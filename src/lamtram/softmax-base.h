@@ -49,6 +49,16 @@ public:
   virtual dynet::Expression CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, int cache_id,                       const Sentence & ctxt, bool train) { return CalcLogProb(in,prior,ctxt,train); }
   virtual dynet::Expression CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, const Sentence & cache_ids, const std::vector<Sentence> & ctxt, bool train) { return CalcLogProb(in,prior,ctxt,train); }
 
+  // Restrict the words that CalcProb and CalcLogProb score until the next graph is
+  // created, so output i is the score of words[i]. Returns false if not supported.
+  virtual bool SetShortlist(const std::vector<unsigned> & words) { return words.size() == 0; }
+  // Get the num words that are most likely without considering the context
+  virtual void GetFrequentWords(int num, std::vector<unsigned> & words) { }
+
+  // Score words with a copy of the output weights quantized to "int8" or "fp16"
+  // while decoding. Returns false if not supported.
+  virtual bool Quantize(const std::string & type) { return false; }
+
   // Cache data for the entire training corpus if necessary
   //  data is the data, set_ids is which data set the sentences belong to
   virtual void Cache(const std::vector<Sentence> & sents, const std::vector<int> & set_ids, std::vector<Sentence> & cache_ids) { }
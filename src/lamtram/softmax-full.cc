@@ -1,7 +1,12 @@
 #include <lamtram/softmax-full.h>
 #include <lamtram/macros.h>
+#include <lamtram/binary-model.h>
 #include <dynet/expr.h>
 #include <dynet/dict.h>
+#include <dynet/tensor.h>
+#include <dynet/globals.h>
+#include <dynet/devices.h>
+#include <algorithm>
 
 using namespace lamtram;
 using namespace dynet;
@@ -15,18 +20,29 @@ SoftmaxFull::SoftmaxFull(const std::string & sig, int input_size, const DictPtr
 void SoftmaxFull::NewGraph(ComputationGraph & cg) {
   i_sm_b_ = parameter(cg, p_sm_b_);
   i_sm_W_ = parameter(cg, p_sm_W_);
+  shortlist_.clear();
 }
 
 // Calculate training loss for one word
 Expression SoftmaxFull::CalcLoss(Expression & in, Expression & prior, const Sentence & ngram, bool train) {
-  Expression score = affine_transform({i_sm_b_, i_sm_W_, in});
-  if(prior.pg != nullptr) score = score + prior;
+  Expression score;
+  if(quant_W_.get() != nullptr && !train) {
+    score = CalcScores(in, prior);
+  } else {
+    score = affine_transform({i_sm_b_, i_sm_W_, in});
+    if(prior.pg != nullptr) score = score + prior;
+  }
   return pickneglogsoftmax(score, *ngram.rbegin());
 }
 // Calculate training loss for multiple words
 Expression SoftmaxFull::CalcLoss(Expression & in, Expression & prior, const std::vector<Sentence> & ngrams, bool train) {
-  Expression score = affine_transform({i_sm_b_, i_sm_W_, in});
-  if(prior.pg != nullptr) score = score + prior;
+  Expression score;
+  if(quant_W_.get() != nullptr && !train) {
+    score = CalcScores(in, prior);
+  } else {
+    score = affine_transform({i_sm_b_, i_sm_W_, in});
+    if(prior.pg != nullptr) score = score + prior;
+  }
   std::vector<unsigned> wvec(ngrams.size());
   for(size_t i = 0; i < ngrams.size(); i++)
     wvec[i] = *ngrams[i].rbegin();
@@ -34,24 +50,71 @@ Expression SoftmaxFull::CalcLoss(Expression & in, Expression & prior, const std:
 }
 
 // Calculate the full probability distribution
+Expression SoftmaxFull::CalcScores(Expression & in, Expression & prior) {
+  if(quant_W_.get() != nullptr) {
+    // Multiply outside of the graph, which only sees the result as an input
+    vector<float> in_vals = as_vector(in.value());
+    unsigned batch_size = in.dim().bd;
+    unsigned num_words = (shortlist_.size() ? shortlist_.size() : quant_W_->GetRows());
+    vector<float> scores(num_words * batch_size);
+    quant_W_->Multiply(in_vals.data(), batch_size, (shortlist_.size() ? &shortlist_ : nullptr), scores.data());
+    Expression score = input(*in.pg, Dim({num_words}, batch_size), scores) + (shortlist_.size() ? i_sl_b_ : i_sm_b_);
+    if(prior.pg == nullptr) return score;
+    return score + (shortlist_.size() ? select_rows(prior, shortlist_) : prior);
+  } else if(shortlist_.size() == 0) {
+    Expression score = affine_transform({i_sm_b_, i_sm_W_, in});
+    return (prior.pg != nullptr ? score + prior : score);
+  } else {
+    Expression score = affine_transform({i_sl_b_, i_sl_W_, in});
+    return (prior.pg != nullptr ? score + select_rows(prior, shortlist_) : score);
+  }
+}
 Expression SoftmaxFull::CalcProb(Expression & in, Expression & prior, const Sentence & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return softmax(CalcScores(in, prior));
 }
 Expression SoftmaxFull::CalcProb(Expression & in, Expression & prior, const vector<Sentence> & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return softmax(CalcScores(in, prior));
 }
 Expression SoftmaxFull::CalcLogProb(Expression & in, Expression & prior, const Sentence & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return log_softmax(CalcScores(in, prior));
 }
 Expression SoftmaxFull::CalcLogProb(Expression & in, Expression & prior, const vector<Sentence> & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return log_softmax(CalcScores(in, prior));
+}
+
+bool SoftmaxFull::SetShortlist(const std::vector<unsigned> & words) {
+  shortlist_ = words;
+  if(shortlist_.size() != 0) {
+    // The quantized weights select their own rows
+    if(quant_W_.get() == nullptr)
+      i_sl_W_ = select_rows(i_sm_W_, shortlist_);
+    i_sl_b_ = select_rows(i_sm_b_, shortlist_);
+  }
+  return true;
 }
 
+bool SoftmaxFull::Quantize(const std::string & type) {
+  if(default_device->type != DeviceType::CPU)
+    THROW_ERROR("Quantized softmax weights are only supported on the CPU");
+  const Tensor & W = *p_sm_W_.values();
+  QuantizedMatrix::Type quant_type = QuantizedMatrix::ParseType(type);
+  // Use the weights in place if they were loaded already quantized this way
+  QuantizedMatrixPtr loaded = BinaryModelFile::GetQuantized(W);
+  if(loaded.get() != nullptr && loaded->GetType() == quant_type) {
+    quant_W_ = loaded;
+  } else {
+    quant_W_.reset(new QuantizedMatrix(quant_type, W.d[0], W.d[1]));
+    quant_W_->SetColumnMajor(W.v);
+  }
+  return true;
+}
+
+// The bias of each word tracks how frequent it is, so use it to find frequent words
+void SoftmaxFull::GetFrequentWords(int num, std::vector<unsigned> & words) {
+  vector<float> bias = as_vector(*p_sm_b_.values());
+  vector<unsigned> ids(bias.size());
+  for(size_t i = 0; i < ids.size(); i++) ids[i] = i;
+  num = min(num, (int)ids.size());
+  partial_sort(ids.begin(), ids.begin() + num, ids.end(), [&bias](unsigned a, unsigned b) { return bias[a] > bias[b]; });
+  words.insert(words.end(), ids.begin(), ids.begin() + num);
+}
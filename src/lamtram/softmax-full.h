@@ -2,6 +2,7 @@
 
 #include <dynet/expr.h>
 #include <lamtram/softmax-base.h>
+#include <lamtram/quantized-matrix.h>
 
 namespace dynet { struct Parameter; }
 
@@ -30,13 +31,30 @@ public:
   virtual dynet::Expression CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const Sentence & ctxt, bool train) override;
   virtual dynet::Expression CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const std::vector<Sentence> & ctxt, bool train) override;
 
+  // Use only some rows of the softmax while decoding
+  virtual bool SetShortlist(const std::vector<unsigned> & words) override;
+  virtual void GetFrequentWords(int num, std::vector<unsigned> & words) override;
+
+  // Calculate the scores outside of the graph with quantized weights when not
+  // training. The float weights stay as they are, and are still used for training.
+  virtual bool Quantize(const std::string & type) override;
+
 protected:
+  // Calculate the scores of all words, or only the ones in the shortlist
+  dynet::Expression CalcScores(dynet::Expression & in, dynet::Expression & prior);
+
   dynet::Parameter p_sm_W_; // Softmax weights
   dynet::Parameter p_sm_b_; // Softmax bias
 
   dynet::Expression i_sm_W_;
   dynet::Expression i_sm_b_;
 
+  std::vector<unsigned> shortlist_;
+  dynet::Expression i_sl_W_;
+  dynet::Expression i_sl_b_;
+
+  QuantizedMatrixPtr quant_W_;
+
 };
 
 }
@@ -0,0 +1,127 @@
+#include <lamtram/streaming-corpus.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/macros.h>
+#include <dynet/dict.h>
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+StreamingCorpus::StreamingCorpus(const std::vector<std::string> & src_files,
+                                 const std::vector<std::string> & trg_files,
+                                 const std::vector<std::string> & weights_files,
+                                 const std::vector<std::string> & kickout_files,
+                                 Dict & vocab_src, Dict & vocab_trg,
+                                 size_t window_size) :
+      src_files_(src_files), trg_files_(trg_files), weights_files_(weights_files), kickout_files_(kickout_files),
+      vocab_src_(vocab_src), vocab_trg_(vocab_trg), window_size_(window_size), file_id_(0), line_no_(0) {
+  if(src_files_.size() != trg_files_.size())
+    THROW_ERROR("Streaming requires the same number of source and target files, but got " << src_files_.size() << " and " << trg_files_.size());
+  if(weights_files_.size() && weights_files_.size() != trg_files_.size())
+    THROW_ERROR("Streaming requires one weights file for each target file");
+  if(kickout_files_.size() && kickout_files_.size() != trg_files_.size())
+    THROW_ERROR("Streaming requires one kickout file for each target file");
+  if(!vocab_src_.is_frozen() || !vocab_trg_.is_frozen())
+    THROW_ERROR("Vocabularies must be frozen before streaming the corpus");
+  if(window_size_ == 0)
+    THROW_ERROR("Streaming window size must be at least one sentence");
+  StartReading();
+}
+
+StreamingCorpus::~StreamingCorpus() {
+  if(reader_.joinable()) reader_.join();
+}
+
+void StreamingCorpus::StartReading() {
+  reader_ = std::thread([this]() {
+    try {
+      ReadWindow(next_);
+    } catch(...) {
+      error_ = std::current_exception();
+    }
+  });
+}
+
+bool StreamingCorpus::NextWindow(StreamingWindow & window) {
+  reader_.join();
+  if(error_) std::rethrow_exception(error_);
+  std::swap(window, next_);
+  // An empty window is the end of the corpus, so go back to the start
+  bool ret = window.trg.size() != 0;
+  if(!ret) {
+    CloseFiles();
+    file_id_ = 0;
+  }
+  StartReading();
+  return ret;
+}
+
+void StreamingCorpus::OpenFiles() {
+  line_no_ = 0;
+  in_trg_.open(trg_files_[file_id_].c_str());
+  if(!in_trg_) THROW_ERROR("Could not find training file: " << trg_files_[file_id_]);
+  in_src_.open(src_files_[file_id_].c_str());
+  if(!in_src_) THROW_ERROR("Could not find training file: " << src_files_[file_id_]);
+  if(weights_files_.size()) {
+    in_weights_.open(weights_files_[file_id_].c_str());
+    if(!in_weights_) THROW_ERROR("Could not find weights file: " << weights_files_[file_id_]);
+  }
+  if(kickout_files_.size()) {
+    in_kickout_.open(kickout_files_[file_id_].c_str());
+    if(!in_kickout_) THROW_ERROR("Could not find kickout file: " << kickout_files_[file_id_]);
+  }
+}
+
+void StreamingCorpus::CloseFiles() {
+  for(ifstream * in : {&in_trg_, &in_src_, &in_weights_, &in_kickout_}) {
+    if(in->is_open()) in->close();
+    in->clear();
+  }
+}
+
+void StreamingCorpus::ReadWindow(StreamingWindow & window) {
+  window.clear();
+  string line_trg, line_src, line;
+  while(window.trg.size() < window_size_ && file_id_ < trg_files_.size()) {
+    if(!in_trg_.is_open()) OpenFiles();
+    if(!getline(in_trg_, line_trg)) {
+      if(getline(in_src_, line_src))
+        THROW_ERROR("Source file " << src_files_[file_id_] << " is longer than target file " << trg_files_[file_id_]);
+      CloseFiles();
+      ++file_id_;
+      continue;
+    }
+    line_no_++;
+    if(!getline(in_src_, line_src))
+      THROW_ERROR("Source file " << src_files_[file_id_] << " is shorter than target file " << trg_files_[file_id_]);
+    Sentence trg = ParseWords(vocab_trg_, line_trg, true);
+    if(trg.size() == 1)
+      THROW_ERROR("Empty line found in " << trg_files_[file_id_] << " at " << line_no_ << endl);
+    Sentence src = ParseWords(vocab_src_, line_src, false);
+    if(src.size() == 0)
+      THROW_ERROR("Empty line found in " << src_files_[file_id_] << " at " << line_no_ << endl);
+    window.trg.push_back(trg);
+    window.src.push_back(src);
+    if(weights_files_.size()) {
+      if(!getline(in_weights_, line))
+        THROW_ERROR("Weights file " << weights_files_[file_id_] << " is shorter than target file " << trg_files_[file_id_]);
+      window.weights.push_back(boost::lexical_cast<float>(line));
+    }
+    if(kickout_files_.size()) {
+      if(!getline(in_kickout_, line))
+        THROW_ERROR("Kickout file " << kickout_files_[file_id_] << " is shorter than target file " << trg_files_[file_id_]);
+      window.kickout_keep.push_back(boost::lexical_cast<float>(line));
+    }
+  }
+}
+
+void StreamingCorpus::ReadVocab(const std::vector<std::string> & files, bool add_last, Dict & vocab) {
+  for(const string & file : files) {
+    ifstream in(file.c_str());
+    if(!in) THROW_ERROR("Could not find training file: " << file);
+    string line;
+    while(getline(in, line))
+      ParseWords(vocab, line, add_last);
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dynet {
+class Dict;
+}
+
+namespace lamtram {
+
+// A window of consecutive training instances read from a streaming corpus
+struct StreamingWindow {
+    std::vector<Sentence> src, trg;
+    std::vector<float> weights, kickout_keep;
+    void clear() { src.clear(); trg.clear(); weights.clear(); kickout_keep.clear(); }
+};
+
+// A parallel corpus that is read in windows of a fixed number of sentences,
+// so the amount of training data in memory does not depend on the corpus size.
+// While one window is being used, the next one is read and converted into word
+// ids on a background thread. The vocabularies must already be frozen.
+class StreamingCorpus {
+
+public:
+    // The i-th source, weight, and kickout files correspond to the i-th target
+    // file, and weights and kickout can be empty
+    StreamingCorpus(const std::vector<std::string> & src_files,
+                    const std::vector<std::string> & trg_files,
+                    const std::vector<std::string> & weights_files,
+                    const std::vector<std::string> & kickout_files,
+                    dynet::Dict & vocab_src, dynet::Dict & vocab_trg,
+                    size_t window_size);
+    ~StreamingCorpus();
+
+    // Get the next window, or return false at the end of the corpus, after
+    // which the next call starts again from the beginning
+    bool NextWindow(StreamingWindow & window);
+
+    // Add the words of all lines in files to the vocabulary without keeping the sentences
+    static void ReadVocab(const std::vector<std::string> & files, bool add_last, dynet::Dict & vocab);
+
+protected:
+
+    // Read the next window on the background thread
+    void StartReading();
+    void ReadWindow(StreamingWindow & window);
+    void OpenFiles();
+    void CloseFiles();
+
+    std::vector<std::string> src_files_, trg_files_, weights_files_, kickout_files_;
+    dynet::Dict & vocab_src_;
+    dynet::Dict & vocab_trg_;
+    size_t window_size_;
+
+    // The position in the corpus
+    size_t file_id_;
+    int line_no_;
+    std::ifstream in_src_, in_trg_, in_weights_, in_kickout_;
+
+    // The window being read, and any error that occurred while reading it
+    std::thread reader_;
+    StreamingWindow next_;
+    std::exception_ptr error_;
+
+};
+typedef std::shared_ptr<StreamingCorpus> StreamingCorpusPtr;
+
+}
@@ -0,0 +1,104 @@
+#include <lamtram/worker-pool.h>
+#include <lamtram/macros.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cstdio>
+#include <exception>
+
+using namespace std;
+using namespace lamtram;
+using namespace boost::iostreams;
+
+WorkerPool::WorkerPool(int num_workers, const WorkFunc & func) : num_sent_(0), num_received_(0) {
+  if(num_workers < 1) THROW_ERROR("Number of workers must be at least one, but got " << num_workers);
+  // Make sure that nothing buffered is written twice by the children
+  cout.flush(); cerr.flush(); fflush(NULL);
+  for(int i = 0; i < num_workers; i++) {
+    int pipefds_input[2], pipefds_output[2];
+    if(pipe(pipefds_input) == -1 || pipe(pipefds_output) == -1)
+      THROW_ERROR("Error creating pipe");
+    pid_t pid = fork();
+    if(pid == pid_t(-1))
+      THROW_ERROR("Error forking worker " << i);
+    if(pid == pid_t(0)) {
+      // Close the inputs of the earlier workers so they see the end of input
+      for(int fd : to_fds_) close(fd);
+      close(pipefds_input[1]);
+      close(pipefds_output[0]);
+      stream_buffer<file_descriptor_source> in_buffer(pipefds_input[0], file_descriptor_flags::close_handle);
+      stream_buffer<file_descriptor_sink> out_buffer(pipefds_output[1], file_descriptor_flags::close_handle);
+      istream in(&in_buffer);
+      ostream out(&out_buffer);
+      string item;
+      int ret = 0;
+      try {
+        while(ReadItem(in, item)) {
+          WriteItem(out, func(item));
+          out.flush();
+        }
+      } catch(std::exception & e) {
+        // The parent sees that the worker exited when reading its result
+        cerr << e.what() << endl;
+        ret = 1;
+      }
+      out.flush();
+      cerr.flush();
+      // Don't run the destructors of the parent's objects
+      _exit(ret);
+    }
+    close(pipefds_input[0]);
+    close(pipefds_output[1]);
+    pids_.push_back(pid);
+    to_fds_.push_back(pipefds_input[1]);
+    to_buffers_.push_back(make_shared<stream_buffer<file_descriptor_sink> >(pipefds_input[1], file_descriptor_flags::close_handle));
+    from_buffers_.push_back(make_shared<stream_buffer<file_descriptor_source> >(pipefds_output[0], file_descriptor_flags::close_handle));
+    to_workers_.push_back(make_shared<ostream>(to_buffers_.back().get()));
+    from_workers_.push_back(make_shared<istream>(from_buffers_.back().get()));
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  // Closing the inputs tells the workers to finish
+  to_workers_.clear();
+  to_buffers_.clear();
+  for(pid_t pid : pids_) {
+    int status;
+    waitpid(pid, &status, 0);
+  }
+}
+
+void WorkerPool::Send(const std::string & item) {
+  // Only one item per worker is outstanding, which means a worker is never
+  // blocked writing a result while we are blocked writing its next item
+  if(GetNumPending() >= GetNumWorkers())
+    THROW_ERROR("Must receive a result before sending more than " << GetNumWorkers() << " items");
+  ostream & out = *to_workers_[num_sent_ % pids_.size()];
+  WriteItem(out, item);
+  out.flush();
+  num_sent_++;
+}
+
+std::string WorkerPool::Receive() {
+  if(GetNumPending() == 0)
+    THROW_ERROR("No items are waiting to be received");
+  string result;
+  if(!ReadItem(*from_workers_[num_received_ % pids_.size()], result))
+    THROW_ERROR("Worker " << num_received_ % pids_.size() << " exited unexpectedly");
+  num_received_++;
+  return result;
+}
+
+// Items are written as their length in bytes on a line, followed by the contents
+void WorkerPool::WriteItem(std::ostream & out, const std::string & item) {
+  out << item.size() << '\n';
+  out.write(item.data(), item.size());
+}
+
+bool WorkerPool::ReadItem(std::istream & in, std::string & item) {
+  string line;
+  if(!getline(in, line)) return false;
+  item.resize(stoul(line));
+  if(item.size() > 0 && !in.read(&item[0], item.size()))
+    return false;
+  return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <sys/types.h>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// A pool of worker processes that apply a function to string work items.
+// The workers are forked from the current process, so any models that were
+// loaded before creating the pool are shared with the workers through
+// copy-on-write memory, while each worker has its own computation graph.
+// Items are handed out round-robin, and results are received in the same
+// order that the items were sent.
+class WorkerPool {
+
+public:
+    typedef std::function<std::string(const std::string &)> WorkFunc;
+
+    WorkerPool(int num_workers, const WorkFunc & func);
+    ~WorkerPool();
+
+    // Send an item to the next worker. If every worker already has an item,
+    // the oldest result must be received first.
+    void Send(const std::string & item);
+    // Receive the result of the oldest item that has not been received yet
+    std::string Receive();
+
+    int GetNumWorkers() const { return pids_.size(); }
+    int GetNumPending() const { return num_sent_ - num_received_; }
+
+protected:
+
+    static void WriteItem(std::ostream & out, const std::string & item);
+    static bool ReadItem(std::istream & in, std::string & item);
+
+    std::vector<pid_t> pids_;
+    std::vector<int> to_fds_;
+    std::vector<std::shared_ptr<boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_sink> > > to_buffers_;
+    std::vector<std::shared_ptr<boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_source> > > from_buffers_;
+    std::vector<std::shared_ptr<std::ostream> > to_workers_;
+    std::vector<std::shared_ptr<std::istream> > from_workers_;
+    int num_sent_, num_received_;
+
+};
+
+}
@@ -0,0 +1,32 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/background-task.h>
+#include <stdexcept>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(background_task)
+
+// The task sees the values at the time it started, not later changes
+BOOST_AUTO_TEST_CASE(TestSnapshot) {
+  vector<double> params = {1.0, 2.0};
+  BackgroundTask task;
+  task.Start([&]() { return vector<double>(1, params[0] + params[1]); });
+  params[0] = 100.0;
+  BOOST_CHECK(task.IsRunning());
+  vector<double> exp_result = {3.0}, act_result = task.Wait();
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_result.begin(), exp_result.end(), act_result.begin(), act_result.end());
+  BOOST_CHECK(!task.IsRunning());
+}
+
+BOOST_AUTO_TEST_CASE(TestFailure) {
+  BackgroundTask task;
+  task.Start([]() -> vector<double> { throw std::runtime_error("failed on purpose"); });
+  BOOST_CHECK_THROW(task.Wait(), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,50 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/sentence.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/binary-corpus.h>
+#include <dynet/dict.h>
+#include <cstdio>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(binary_corpus)
+
+BOOST_AUTO_TEST_CASE(TestWriteRead) {
+  DictPtr vocab_src(CreateNewDict()), vocab_trg(CreateNewDict());
+  vector<Sentence> exp_src = {ParseWords(*vocab_src, "a b", false), ParseWords(*vocab_src, "c", false)};
+  vector<Sentence> exp_trg = {ParseWords(*vocab_trg, "x", true), ParseWords(*vocab_trg, "y z x", true)};
+  vector<float> exp_weights = {0.5, 2.0};
+  string file = "test-binary-corpus.bin";
+  {
+    BinaryCorpusWriter writer(file, true, false);
+    for(size_t i = 0; i < exp_src.size(); i++)
+      writer.AddSentence(exp_src[i], exp_trg[i], exp_weights[i], 1.f);
+    writer.Finish(*vocab_src, *vocab_trg);
+  }
+  {
+    BinaryCorpus corpus(file);
+    BOOST_CHECK_EQUAL(corpus.GetNumSents(), exp_src.size());
+    BOOST_CHECK(corpus.HasWeights());
+    BOOST_CHECK(!corpus.HasKickoutKeep());
+    for(size_t i = 0; i < exp_src.size(); i++) {
+      Sentence act_src, act_trg;
+      corpus.GetSrc(i, act_src);
+      corpus.GetTrg(i, act_trg);
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_src[i].begin(), exp_src[i].end(), act_src.begin(), act_src.end());
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_trg[i].begin(), exp_trg[i].end(), act_trg.begin(), act_trg.end());
+      BOOST_CHECK_EQUAL(corpus.GetWeight(i), exp_weights[i]);
+    }
+    DictPtr act_src, act_trg;
+    corpus.ReadVocab(act_src, act_trg);
+    BOOST_CHECK(act_src->get_words() == vocab_src->get_words());
+    BOOST_CHECK(act_trg->get_words() == vocab_trg->get_words());
+  }
+  remove(file.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/checkpoint.h>
+#include <dynet/model.h>
+#include <dynet/tensor.h>
+#include <dynet/globals.h>
+#include <cstdio>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(checkpoint)
+
+// Reading a checkpoint restores the parameters, trainer, and training state
+BOOST_AUTO_TEST_CASE(TestWriteRead) {
+  string file = "/tmp/lamtram-test-checkpoint";
+  ParameterCollection exp_mod, act_mod;
+  Parameter exp_p = exp_mod.add_parameters({3});
+  LookupParameter exp_lp = exp_mod.add_lookup_parameters(4, {2});
+  act_mod.add_parameters({3});
+  act_mod.add_lookup_parameters(4, {2});
+  CheckpointTrainer<AdamTrainer> exp_trainer(exp_mod, 0.1), act_trainer(act_mod, 0.1);
+  exp_trainer.update();
+  exp_trainer.update_epoch();
+  TrainingState exp_state, act_state;
+  exp_state.epoch = 2; exp_state.loc = 5; exp_state.num_evals = 1;
+  exp_state.learning_rate = 0.05f; exp_state.loss = 12.5f;
+  exp_state.order = {3, 1, 0, 2};
+  Checkpoint::Write(file, exp_state, exp_mod, exp_trainer);
+  unsigned exp_rand = (*rndeng)();
+  Checkpoint::Read(file, act_state, act_mod, act_trainer);
+  unsigned act_rand = (*rndeng)();
+  remove(file.c_str());
+  BOOST_CHECK_EQUAL(exp_state.epoch, act_state.epoch);
+  BOOST_CHECK_EQUAL(exp_state.loc, act_state.loc);
+  BOOST_CHECK_EQUAL(exp_state.learning_rate, act_state.learning_rate);
+  BOOST_CHECK_EQUAL(exp_state.loss, act_state.loss);
+  BOOST_CHECK_EQUAL(exp_state.last_loss, act_state.last_loss);
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_state.order.begin(), exp_state.order.end(), act_state.order.begin(), act_state.order.end());
+  BOOST_CHECK_EQUAL(exp_trainer.updates, act_trainer.updates);
+  BOOST_CHECK_EQUAL(exp_rand, act_rand);
+  vector<float> exp_vals = as_vector(exp_mod.parameters_list()[0]->values), act_vals = as_vector(act_mod.parameters_list()[0]->values);
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_vals.begin(), exp_vals.end(), act_vals.begin(), act_vals.end());
+  exp_vals = as_vector(exp_mod.lookup_parameters_list()[0]->all_values); act_vals = as_vector(act_mod.lookup_parameters_list()[0]->all_values);
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_vals.begin(), exp_vals.end(), act_vals.begin(), act_vals.end());
+  exp_vals = as_vector(exp_trainer.m[0].h); act_vals = as_vector(act_trainer.m[0].h);
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_vals.begin(), exp_vals.end(), act_vals.begin(), act_vals.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestNotCheckpoint) {
+  string file = "/tmp/lamtram-test-not-checkpoint";
+  FILE * out = fopen(file.c_str(), "w");
+  fputs("not a checkpoint\n", out);
+  fclose(out);
+  ParameterCollection mod;
+  mod.add_parameters({3});
+  CheckpointTrainer<SimpleSGDTrainer> trainer(mod, 0.1);
+  TrainingState state;
+  BOOST_CHECK_THROW(Checkpoint::Read(file, state, mod, trainer), std::runtime_error);
+  remove(file.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
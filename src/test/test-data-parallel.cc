@@ -0,0 +1,95 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/data-parallel.h>
+#include <dynet/dynet.h>
+#include <dynet/expr.h>
+#include <dynet/model.h>
+#include <dynet/tensor.h>
+#include <dynet/training.h>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(data_parallel)
+
+// Asynchronous updates of the same row are all kept, and updating one row
+// doesn't overwrite the rows the other process is updating
+BOOST_AUTO_TEST_CASE(TestAsyncUpdate) {
+  int num_steps = 200;
+  ParameterCollection mod;
+  LookupParameter lp = mod.add_lookup_parameters(3, {2}, ParameterInitConst(0.f));
+  SimpleSGDTrainer trainer(mod, 1.f);
+  trainer.clipping_enabled = false;
+  // Dense lookup updates are what lamtram-train uses otherwise
+  trainer.sparse_updates_enabled = false;
+  DataParallel parallel(2, true, mod);
+  unsigned rank = parallel.GetRank();
+  // Each step adds one to row 2 and to the row of this process
+  for(int i = 0; i < num_steps; i++) {
+    ComputationGraph cg;
+    Expression loss = -(sum_elems(lookup(cg, lp, 2)) + sum_elems(lookup(cg, lp, rank)));
+    cg.forward(loss);
+    cg.backward(loss);
+    parallel.Update(trainer);
+  }
+  parallel.Barrier();
+  if(rank == 0) {
+    vector<float> exp_vals = {(float)num_steps, (float)num_steps, (float)num_steps, (float)num_steps, 2.f*num_steps, 2.f*num_steps};
+    vector<float> act_vals = as_vector(lp.get_storage().all_values);
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_vals.begin(), exp_vals.end(), act_vals.begin(), act_vals.end());
+  }
+}
+
+// Every process gets the same sum of the gradients, including which rows of
+// the lookup parameters have one
+BOOST_AUTO_TEST_CASE(TestSumGradients) {
+  ParameterCollection mod;
+  Parameter p = mod.add_parameters({2}, ParameterInitConst(0.f));
+  LookupParameter lp = mod.add_lookup_parameters(3, {2}, ParameterInitConst(0.f));
+  DataParallel parallel(2, false, mod);
+  unsigned rank = parallel.GetRank();
+  // Each process uses its own row and row 2, with different weights
+  ComputationGraph cg;
+  Expression loss = sum_elems(parameter(cg, p)) * (rank + 1.f) + sum_elems(lookup(cg, lp, rank)) * (rank + 1.f) + sum_elems(lookup(cg, lp, 2));
+  cg.forward(loss);
+  cg.backward(loss);
+  parallel.SumGradients();
+  // Sum what each process got into its own range, so the first one sees both
+  vector<double> grads(16, 0.0), rows(6, 0.0);
+  vector<float> dense = as_vector(p.get_storage().g), sparse = as_vector(lp.get_storage().all_grads);
+  for(size_t i = 0; i < dense.size(); i++) grads[rank*8 + i] = dense[i];
+  for(size_t i = 0; i < sparse.size(); i++) grads[rank*8 + dense.size() + i] = sparse[i];
+  for(unsigned row : lp.get_storage().non_zero_grads) rows[rank*3 + row] = 1.0;
+  parallel.SumValues(grads);
+  parallel.SumValues(rows);
+  if(rank == 0) {
+    vector<double> exp_grads = {3.0, 3.0, 1.0, 1.0, 2.0, 2.0, 2.0, 2.0};
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_grads.begin(), exp_grads.end(), grads.begin(), grads.begin() + 8);
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_grads.begin(), exp_grads.end(), grads.begin() + 8, grads.end());
+    vector<double> exp_rows(6, 1.0);
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_rows.begin(), exp_rows.end(), rows.begin(), rows.end());
+  }
+}
+
+// Values are summed over the processes, and too many of them can't be
+BOOST_AUTO_TEST_CASE(TestSumValues) {
+  ParameterCollection mod;
+  mod.add_parameters({1});
+  DataParallel parallel(2, false, mod);
+  vector<double> vals = {1.0, (double)parallel.GetRank()};
+  parallel.SumValues(vals);
+  if(parallel.GetRank() == 0) {
+    vector<double> exp_vals = {2.0, 1.0};
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_vals.begin(), exp_vals.end(), vals.begin(), vals.end());
+  }
+  vector<double> too_many(DataParallel::kMaxValues + 1);
+  BOOST_CHECK_THROW(parallel.SumValues(too_many), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,8 @@
 
 #include <fstream>
 
+#include <boost/algorithm/string.hpp>
+
 #include <dynet/dict.h>
 #include <dynet/training.h>
 
@@ -38,7 +40,8 @@ struct TestEncoderAttentional {
         const std::string & attention_type = "mlp:2",
         bool attention_feed = false,
         const std::string & attention_hist = "none",
-        const std::string & lex_type = "none"
+        const std::string & lex_type = "none",
+        const std::string & encoder_types = "for"
   ) {
     // Create a dummy lexicon file if necessary
     string my_lex_type = lex_type;
@@ -50,8 +53,15 @@ struct TestEncoderAttentional {
     }
     // Create the model
     mod = shared_ptr<dynet::ParameterCollection>(new dynet::ParameterCollection);
-    NeuralLMPtr lmptr(new NeuralLM(vocab_trg_, 1, (attention_feed ? 5 : 0), attention_feed, 5, BuilderSpec("lstm:5:1"), -1, "full", *mod));
-    vector<LinearEncoderPtr> encs(1, LinearEncoderPtr(new LinearEncoder(vocab_src_->size(), 5, BuilderSpec("lstm:5:1"), -1, *mod)));
+    vector<string> enc_types;
+    boost::algorithm::split(enc_types, encoder_types, boost::is_any_of("|"));
+    int context_size = 5 * enc_types.size();
+    NeuralLMPtr lmptr(new NeuralLM(vocab_trg_, 1, (attention_feed ? context_size : 0), attention_feed, 5, BuilderSpec("lstm:5:1"), -1, "full", *mod));
+    vector<LinearEncoderPtr> encs;
+    for(auto & enc_type : enc_types) {
+      encs.push_back(LinearEncoderPtr(new LinearEncoder(vocab_src_->size(), 5, BuilderSpec("lstm:5:1"), -1, *mod)));
+      if(enc_type == "rev") encs.back()->SetReverse(true);
+    }
     ExternAttentionalPtr ext(new ExternAttentional(encs, attention_type, attention_hist, 5, my_lex_type, vocab_src_, vocab_trg_, *mod));
     encatt = shared_ptr<EncoderAttentional>(new EncoderAttentional(ext, lmptr, *mod));
     // Create the ensemble decoder
@@ -123,6 +133,25 @@ struct TestEncoderAttentional {
     BOOST_CHECK_CLOSE(train_ll, decode_ll, 0.01);
   }
 
+  // Decode sources of different lengths in one batch, and check that each
+  // matches decoding it separately
+  void TestBatchDecodingLengths(const std::string & attention_type, const std::string & encoder_types = "for") {
+    shared_ptr<dynet::ParameterCollection> mod;
+    EncoderAttentionalPtr encatt;
+    shared_ptr<EnsembleDecoder> ensdec;
+    CreateModel(mod, encatt, ensdec, attention_type, true, "sum", "none", encoder_types);
+    ensdec->SetBeamSize(3);
+    std::vector<Sentence> batch_src = {sent_src_, {3, 0}, {2, 1, 0}};
+    vector<vector<EnsembleDecoderHypPtr> > batch_hyps = ensdec->GenerateNbest(batch_src, 1);
+    BOOST_CHECK_EQUAL(batch_hyps.size(), batch_src.size());
+    for(size_t i = 0; i < batch_src.size(); i++) {
+      vector<EnsembleDecoderHypPtr> hyps = ensdec->GenerateNbest(batch_src[i], 1);
+      BOOST_CHECK(hyps[0]->GetSentence() == batch_hyps[i][0]->GetSentence());
+      BOOST_CHECK_CLOSE(hyps[0]->GetScore(), batch_hyps[i][0]->GetScore(), 0.01);
+    }
+    ensdec->SetBeamSize(1);
+  }
+
   Sentence sent_src_, sent_trg_, sent_src2_, sent_trg2_, cache_;
   DictPtr vocab_src_, vocab_trg_;
 };
@@ -172,6 +201,8 @@ BOOST_AUTO_TEST_CASE(TestLLScoresDotFalseSum)       { TestLLScores("dot",   fals
 BOOST_AUTO_TEST_CASE(TestLLScoresMLPFalseNone)      { TestLLScores("mlp:5", false, "none", "none"); }
 BOOST_AUTO_TEST_CASE(TestLLScoresMLPTrueSum)        { TestLLScores("mlp:5", true,  "sum" , "none"); }
 BOOST_AUTO_TEST_CASE(TestLLScoresBilinFalseNone)    { TestLLScores("bilin", false, "none", "none"); }
+BOOST_AUTO_TEST_CASE(TestLLScoresLocalFalseNone)    { TestLLScores("local:1", false, "none", "none"); }
+BOOST_AUTO_TEST_CASE(TestLLScoresLocalTrueSum)      { TestLLScores("local:1", true,  "sum" , "none"); }
 
 
 // Test whether log likelihood is the same when batched or not
@@ -204,6 +235,36 @@ BOOST_AUTO_TEST_CASE(TestLLBatchScores) {
   BOOST_CHECK_CLOSE(unbatch_stat.CalcPPL(), batch_stat.CalcPPL(), 0.5);
 }
 
+// Test whether log likelihood is the same when batched or not with local attention
+BOOST_AUTO_TEST_CASE(TestLLBatchScoresLocal) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "local:1", true, "sum");
+  LLStats batch_stat(vocab_trg_->size()), unbatch_stat(vocab_trg_->size());
+  // Do unbatched calculation
+  {
+    dynet::ComputationGraph cg; encatt->NewGraph(cg);
+    dynet::Expression loss_expr = encatt->BuildSentGraph(sent_src_, sent_trg_, cache_, nullptr, 0.f, false, cg, unbatch_stat);
+    unbatch_stat.loss_ += as_scalar(cg.incremental_forward(loss_expr));
+  }
+  {
+    dynet::ComputationGraph cg; encatt->NewGraph(cg);
+    dynet::Expression loss_expr = encatt->BuildSentGraph(sent_src2_, sent_trg2_, cache_, nullptr, 0.f, false, cg, unbatch_stat);
+    unbatch_stat.loss_ += as_scalar(cg.incremental_forward(loss_expr));
+  }
+  // Do batched calculation
+  {
+    std::vector<Sentence> batch_src(2); batch_src[0] = sent_src_; batch_src[1] = sent_src2_;
+    std::vector<Sentence> batch_trg(2); batch_trg[0] = sent_trg_; batch_trg[1] = sent_trg2_;
+    std::vector<Sentence> batch_cache(2); batch_cache[0] = cache_; batch_cache[1] = cache_;
+    dynet::ComputationGraph cg; encatt->NewGraph(cg);
+    dynet::Expression loss_expr = encatt->BuildSentGraph(batch_src, batch_trg, batch_cache, nullptr, 0.f, false, cg, batch_stat);
+    batch_stat.loss_ += as_scalar(cg.incremental_forward(loss_expr));
+  }
+  BOOST_CHECK_CLOSE(unbatch_stat.CalcPPL(), batch_stat.CalcPPL(), 0.5);
+}
+
 // Test whether scores during decoding are the same as training
 BOOST_AUTO_TEST_CASE(TestDecodingDotFalseNone)      { TestDecoding("dot",   false, "none", "none"); }
 BOOST_AUTO_TEST_CASE(TestDecodingDotFalseNonePrior) { TestDecoding("dot",   false, "none", "prior"); }
@@ -212,6 +273,8 @@ BOOST_AUTO_TEST_CASE(TestDecodingDotFalseSum)       { TestDecoding("dot",   fals
 BOOST_AUTO_TEST_CASE(TestDecodingMLPFalseNone)      { TestDecoding("mlp:5", false, "none", "none"); }
 BOOST_AUTO_TEST_CASE(TestDecodingMLPTrueSum)        { TestDecoding("mlp:5", true,  "sum" , "none"); }
 BOOST_AUTO_TEST_CASE(TestDecodingBilinFalseNone)    { TestDecoding("bilin", false, "none", "none"); }
+BOOST_AUTO_TEST_CASE(TestDecodingLocalFalseNone)    { TestDecoding("local:1", false, "none", "none"); }
+BOOST_AUTO_TEST_CASE(TestDecodingLocalTrueSum)      { TestDecoding("local:1", true,  "sum" , "none"); }
 
 // Test whether scores during decoding are the same as training
 BOOST_AUTO_TEST_CASE(TestBeamDecodingScores) {
@@ -241,6 +304,204 @@ BOOST_AUTO_TEST_CASE(TestBeamDecodingScores) {
   BOOST_CHECK_CLOSE(train_ll, decode_ll, 0.01);
 }
 
+// Test whether the scores of every hypothesis in a batched beam match training
+BOOST_AUTO_TEST_CASE(TestBeamNbestScores) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum");
+  ensdec->SetBeamSize(5);
+  vector<EnsembleDecoderHypPtr> hyps = ensdec->GenerateNbest(sent_src_, 3);
+  ensdec->SetBeamSize(1);
+  BOOST_CHECK(hyps.size() > 1);
+  for(auto & hyp : hyps) {
+    LLStats train_stat(vocab_trg_->size());
+    dynet::ComputationGraph cg;
+    encatt->NewGraph(cg);
+    dynet::Expression loss_expr = encatt->BuildSentGraph(sent_src_, hyp->GetSentence(), cache_, nullptr, 0.f, false, cg, train_stat);
+    BOOST_CHECK_CLOSE(-as_scalar(cg.incremental_forward(loss_expr)), hyp->GetScore(), 0.01);
+  }
+}
+
+// Test whether decoding several sentences in one batch matches decoding them separately
+BOOST_AUTO_TEST_CASE(TestBatchDecoding) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum");
+  ensdec->SetBeamSize(3);
+  std::vector<Sentence> batch_src(2); batch_src[0] = sent_src_; batch_src[1] = sent_src2_;
+  vector<vector<EnsembleDecoderHypPtr> > batch_hyps = ensdec->GenerateNbest(batch_src, 1);
+  BOOST_CHECK_EQUAL(batch_hyps.size(), 2);
+  for(size_t i = 0; i < batch_src.size(); i++) {
+    vector<EnsembleDecoderHypPtr> hyps = ensdec->GenerateNbest(batch_src[i], 1);
+    BOOST_CHECK(hyps[0]->GetSentence() == batch_hyps[i][0]->GetSentence());
+    BOOST_CHECK_CLOSE(hyps[0]->GetScore(), batch_hyps[i][0]->GetScore(), 0.01);
+  }
+  ensdec->SetBeamSize(1);
+}
+
+// Test whether batches of sources with different lengths decode as they do alone
+BOOST_AUTO_TEST_CASE(TestBatchDecodingLengthsMLP)   { TestBatchDecodingLengths("mlp:5"); }
+BOOST_AUTO_TEST_CASE(TestBatchDecodingLengthsLocal) { TestBatchDecodingLengths("local:1"); }
+BOOST_AUTO_TEST_CASE(TestBatchDecodingLengthsForRev) { TestBatchDecodingLengths("mlp:5", "for|rev"); }
+
+// Test whether n-best scoring over several sources matches scoring each hypothesis separately
+BOOST_AUTO_TEST_CASE(TestNbestLLScores) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum");
+  std::vector<Sentence> srcs(2); srcs[0] = sent_src_; srcs[1] = sent_src2_;
+  std::vector<Sentence> trgs(4); trgs[0] = sent_trg_; trgs[1] = sent_trg2_; trgs[2] = sent_trg2_; trgs[3] = sent_trg_;
+  std::vector<unsigned> ids = {0, 0, 1, 1};
+  // A budget of 8 words splits the hypotheses into two chunks, one of which spans both sources
+  vector<LLStats> nbest_stats(trgs.size(), LLStats(vocab_trg_->size()));
+  vector<vector<float> > nbest_wordlls(trgs.size());
+  ensdec->CalcNbestLL(srcs, trgs, ids, 8, nbest_stats, nbest_wordlls);
+  for(size_t i = 0; i < trgs.size(); i++) {
+    LLStats stat(vocab_trg_->size());
+    vector<float> wordll;
+    ensdec->CalcSentLL(srcs[ids[i]], trgs[i], stat, wordll);
+    BOOST_CHECK_CLOSE(stat.CalcPPL(), nbest_stats[i].CalcPPL(), 0.01);
+    BOOST_CHECK_EQUAL(wordll.size(), nbest_wordlls[i].size());
+  }
+}
+
+// Test whether n-best scoring over sources of different lengths with a reverse
+// encoder matches scoring each hypothesis against its source alone
+BOOST_AUTO_TEST_CASE(TestNbestLLScoresForRev) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum", "none", "for|rev");
+  std::vector<Sentence> srcs = {sent_src_, {3, 0}, {2, 1, 0}};
+  std::vector<Sentence> trgs = {sent_trg_, sent_trg2_, {2, 0}, sent_trg_, {1, 3, 0}};
+  std::vector<unsigned> ids = {0, 1, 1, 2, 2};
+  // A budget of 10 words puts hypotheses of different sources in each chunk
+  vector<LLStats> nbest_stats(trgs.size(), LLStats(vocab_trg_->size()));
+  vector<vector<float> > nbest_wordlls(trgs.size());
+  ensdec->CalcNbestLL(srcs, trgs, ids, 10, nbest_stats, nbest_wordlls);
+  for(size_t i = 0; i < trgs.size(); i++) {
+    LLStats stat(vocab_trg_->size());
+    vector<float> wordll;
+    ensdec->CalcSentLL(srcs[ids[i]], trgs[i], stat, wordll);
+    BOOST_CHECK_CLOSE(stat.CalcPPL(), nbest_stats[i].CalcPPL(), 0.01);
+    BOOST_CHECK_EQUAL(wordll.size(), nbest_wordlls[i].size());
+  }
+}
+
+// Test whether scoring targets with shared prefixes in a trie matches scoring each separately
+BOOST_AUTO_TEST_CASE(TestTrieLLScores) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum");
+  std::vector<Sentence> trgs = {sent_trg_, {3, 2, 0}, {3, 4, 1, 0}, sent_trg2_, sent_trg_};
+  vector<LLStats> trie_stats(trgs.size(), LLStats(vocab_trg_->size()));
+  vector<vector<float> > trie_wordlls(trgs.size());
+  ensdec->CalcTrieLL(sent_src_, trgs, trie_stats, trie_wordlls);
+  for(size_t i = 0; i < trgs.size(); i++) {
+    LLStats stat(vocab_trg_->size());
+    vector<float> wordll;
+    ensdec->CalcSentLL(sent_src_, trgs[i], stat, wordll);
+    BOOST_CHECK_CLOSE(stat.CalcPPL(), trie_stats[i].CalcPPL(), 0.01);
+    BOOST_CHECK_EQUAL(wordll.size(), trie_wordlls[i].size());
+  }
+}
+
+// Test whether the log probabilities of samples match their scores, also after
+// finished samples are removed from the batch
+BOOST_AUTO_TEST_CASE(TestSampleLogProbs) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum");
+  vector<Sentence> samples;
+  vector<float> samp_log_probs;
+  {
+    dynet::ComputationGraph cg;
+    encatt->NewGraph(cg);
+    dynet::Expression log_probs = encatt->SampleTrgSentences(sent_src_, &sent_trg_, 8, 10, false, cg, samples);
+    samp_log_probs = as_vector(cg.incremental_forward(log_probs));
+  }
+  BOOST_CHECK_EQUAL(samp_log_probs.size(), (size_t)8);
+  BOOST_CHECK_EQUAL_COLLECTIONS(sent_trg_.begin(), sent_trg_.end(), samples[0].begin(), samples[0].end());
+  for(size_t i = 0; i < samples.size(); i++) {
+    if(*samples[i].rbegin() != 0) continue;
+    LLStats stat(vocab_trg_->size());
+    dynet::ComputationGraph cg;
+    encatt->NewGraph(cg);
+    dynet::Expression loss = encatt->BuildSentGraph(sent_src_, samples[i], cache_, nullptr, 0.f, false, cg, stat);
+    BOOST_CHECK_CLOSE(-as_scalar(cg.incremental_forward(loss)), samp_log_probs[i], 0.1);
+  }
+}
+
+// Test whether the scores of samples are their log probabilities, and whether
+// sampling from only the best word gives the greedy output
+BOOST_AUTO_TEST_CASE(TestEnsembleSample) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:5", true, "sum");
+  ensdec->SetSizeLimit(10);
+  vector<EnsembleDecoderHypPtr> samples = ensdec->Sample(sent_src_, 8);
+  BOOST_CHECK_EQUAL(samples.size(), (size_t)8);
+  for(auto & samp : samples) {
+    if(*samp->GetSentence().rbegin() != 0) continue;
+    LLStats stat(vocab_trg_->size());
+    vector<float> wordll;
+    ensdec->CalcSentLL(sent_src_, samp->GetSentence(), stat, wordll);
+    BOOST_CHECK_CLOSE(-stat.loss_, samp->GetScore(), 0.1);
+  }
+  EnsembleDecoderHypPtr exp_hyp = ensdec->Generate(sent_src_);
+  samples = ensdec->Sample(sent_src_, 2, 0.5f, 1);
+  for(auto & samp : samples)
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyp->GetSentence().begin(), exp_hyp->GetSentence().end(), samp->GetSentence().begin(), samp->GetSentence().end());
+}
+
+// Test whether the pruning options keep the best hypothesis and respect the length limit
+BOOST_AUTO_TEST_CASE(TestBeamPruning) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec);
+  ensdec->SetBeamSize(5);
+  vector<EnsembleDecoderHypPtr> hyps = ensdec->GenerateNbest(sent_src_, 1);
+  ensdec->SetPruneAbs(100.f);
+  ensdec->SetPruneRel(1e-10f);
+  ensdec->SetMaxCandsPerParent(5);
+  vector<EnsembleDecoderHypPtr> pruned_hyps = ensdec->GenerateNbest(sent_src_, 1);
+  BOOST_CHECK(hyps[0]->GetSentence() == pruned_hyps[0]->GetSentence());
+  BOOST_CHECK_CLOSE(hyps[0]->GetScore(), pruned_hyps[0]->GetScore(), 0.01);
+  // A limit of 0.5 * 4 + 0 allows at most three words, including the last one
+  ensdec->SetSizeRatio(0.5f);
+  vector<EnsembleDecoderHypPtr> short_hyps = ensdec->GenerateNbest(sent_src_, 3);
+  for(auto & hyp : short_hyps)
+    BOOST_CHECK_LE(hyp->GetSentence().size(), 3);
+  ensdec->SetSizeRatio(0.f);
+  ensdec->SetPruneAbs(0.f);
+  ensdec->SetPruneRel(0.f);
+  ensdec->SetMaxCandsPerParent(0);
+  ensdec->SetBeamSize(1);
+}
+
+// Test whether a shortlist with every word gives the same results as the full vocabulary
+BOOST_AUTO_TEST_CASE(TestShortlist) {
+  shared_ptr<dynet::ParameterCollection> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec);
+  ensdec->SetBeamSize(3);
+  vector<EnsembleDecoderHypPtr> hyps = ensdec->GenerateNbest(sent_src_, 1);
+  ensdec->SetShortlist(0, vocab_trg_->size());
+  vector<EnsembleDecoderHypPtr> shortlist_hyps = ensdec->GenerateNbest(sent_src_, 1);
+  BOOST_CHECK(hyps[0]->GetSentence() == shortlist_hyps[0]->GetSentence());
+  BOOST_CHECK_CLOSE(hyps[0]->GetScore(), shortlist_hyps[0]->GetScore(), 0.01);
+  ensdec->SetShortlist(0, 0);
+  ensdec->SetBeamSize(1);
+}
+
 // Test whether scores improve through beam search
 BOOST_AUTO_TEST_CASE(TestBeamSearchImproves) {
   shared_ptr<dynet::ParameterCollection> mod;
@@ -0,0 +1,50 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/lamtram-train.h>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestLamtramTrain {
+
+  // Source and target lengths of sentences sorted by their total length
+  TestLamtramTrain() {
+    lengths_ = { {1, 1}, {1, 2}, {2, 2}, {3, 3}, {3, 4} };
+    ids_ = {0, 1, 2, 3, 4};
+  }
+  ~TestLamtramTrain() { }
+
+  pair<size_t,size_t> GetLength(size_t id) const { return lengths_[id]; }
+
+  vector<pair<size_t,size_t> > lengths_;
+  vector<size_t> ids_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(lamtram_train, TestLamtramTrain)
+
+// A minibatch is closed once one more of its longest sentence wouldn't fit
+BOOST_AUTO_TEST_CASE(TestSplitMinibatches) {
+  vector<vector<size_t> > exp_ids = { {0, 1}, {2, 3}, {4} }, act_ids;
+  LamtramTrain::SplitMinibatches(ids_, 8, false, [&](size_t id) { return GetLength(id); }, act_ids);
+  BOOST_REQUIRE_EQUAL(exp_ids.size(), act_ids.size());
+  for(size_t i = 0; i < exp_ids.size(); i++)
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_ids[i].begin(), exp_ids[i].end(), act_ids[i].begin(), act_ids[i].end());
+}
+
+// With a padded budget, a minibatch never goes over it unless it only has one
+// sentence
+BOOST_AUTO_TEST_CASE(TestSplitMinibatchesPadded) {
+  vector<vector<size_t> > exp_ids = { {0, 1}, {2}, {3}, {4} }, act_ids;
+  LamtramTrain::SplitMinibatches(ids_, 8, true, [&](size_t id) { return GetLength(id); }, act_ids);
+  BOOST_REQUIRE_EQUAL(exp_ids.size(), act_ids.size());
+  for(size_t i = 0; i < exp_ids.size(); i++)
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_ids[i].begin(), exp_ids[i].end(), act_ids[i].begin(), act_ids[i].end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
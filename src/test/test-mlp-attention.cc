@@ -0,0 +1,69 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/mlp-attention.h>
+#include <dynet/dynet.h>
+#include <dynet/expr.h>
+#include <dynet/model.h>
+#include <dynet/tensor.h>
+
+using namespace std;
+using namespace lamtram;
+using namespace dynet;
+
+// ****** The fixture *******
+struct TestMLPAttention {
+
+  // A {3, 20} hidden part for a sentence longer than one block of the fused
+  // operation, and a batch of two state parts
+  TestMLPAttention() : sent_len_(20) {
+    for(unsigned i = 0; i < 3 * sent_len_; i++)
+      hpart_vals_.push_back(((i * 7) % 11 - 5) * 0.15f);
+    spart_vals_ = {0.2f, -0.1f, 0.4f, -0.5f, 0.3f, 0.f};
+    v_vals_ = {1.f, -0.5f, 0.75f};
+    for(unsigned i = 0; i < 2 * sent_len_; i++)
+      weights_.push_back(((i * 5) % 7 - 3) * 0.5f);
+  }
+  ~TestMLPAttention() { }
+
+  // Weight the scores so every source position gets a different gradient
+  void CalcScores(bool fused, vector<float> & scores, vector<float> & grad_hpart, vector<float> & grad_v) {
+    ParameterCollection mod;
+    Parameter p_hpart = mod.add_parameters({3, sent_len_}), p_v = mod.add_parameters({1, 3});
+    TensorTools::set_elements(p_hpart.get_storage().values, hpart_vals_);
+    TensorTools::set_elements(p_v.get_storage().values, v_vals_);
+    ComputationGraph cg;
+    Expression hpart = parameter(cg, p_hpart), v = parameter(cg, p_v);
+    Expression spart = input(cg, Dim({3}, 2), spart_vals_);
+    Expression e = (fused ? mlp_attention_scores(hpart, spart, v) :
+                            transpose(v * tanh(colwise_add(hpart, spart))));
+    Expression loss = sum_batches(sum_elems(cmult(e, input(cg, Dim({sent_len_}, 2), weights_))));
+    scores = as_vector(cg.forward(e));
+    cg.backward(loss);
+    grad_hpart = as_vector(p_hpart.get_storage().g);
+    grad_v = as_vector(p_v.get_storage().g);
+  }
+
+  unsigned sent_len_;
+  vector<float> hpart_vals_, spart_vals_, v_vals_, weights_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(mlp_attention, TestMLPAttention)
+
+// The fused scores and gradients match those of the separate operations
+BOOST_AUTO_TEST_CASE(TestScoresAndGradients) {
+  vector<float> exp_scores, exp_grad_hpart, exp_grad_v, act_scores, act_grad_hpart, act_grad_v;
+  CalcScores(false, exp_scores, exp_grad_hpart, exp_grad_v);
+  CalcScores(true, act_scores, act_grad_hpart, act_grad_v);
+  BOOST_CHECK_EQUAL(exp_scores.size(), act_scores.size());
+  for(size_t i = 0; i < exp_scores.size(); i++)
+    BOOST_CHECK_SMALL(exp_scores[i] - act_scores[i], 1e-5f);
+  for(size_t i = 0; i < exp_grad_hpart.size(); i++)
+    BOOST_CHECK_SMALL(exp_grad_hpart[i] - act_grad_hpart[i], 1e-5f);
+  for(size_t i = 0; i < exp_grad_v.size(); i++)
+    BOOST_CHECK_SMALL(exp_grad_v[i] - act_grad_v[i], 1e-5f);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
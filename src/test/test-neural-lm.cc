@@ -81,4 +81,38 @@ BOOST_AUTO_TEST_CASE(TestDecodingScores) {
   BOOST_CHECK_CLOSE(train_stat.CalcPPL(), test_stat.CalcPPL(), 0.1);
 }
 
+// Test whether a model written in binary format is read back with the same scores
+BOOST_AUTO_TEST_CASE(TestBinaryWriteRead) {
+  std::shared_ptr<dynet::ParameterCollection> exp_mod(new dynet::ParameterCollection), act_mod;
+  DictPtr exp_vocab(CreateNewDict()); exp_vocab->convert("a"); exp_vocab->convert("b"); exp_vocab->convert("c");
+  NeuralLMPtr exp_lm(new NeuralLM(exp_vocab, 1, 0, false, 3, BuilderSpec("rnn:2:1"), -1, "full", *exp_mod));
+  // Write the LM
+  ostringstream out;
+  WriteDict(*exp_vocab, out);
+  exp_lm->Write(out);
+  string file = "test-neural-lm-binary.mod";
+  ModelUtils::WriteModel(file, out.str(), *exp_mod, true);
+  // Read the LM
+  DictPtr act_vocab;
+  NeuralLMPtr act_lm(ModelUtils::LoadMonolingualModelAndParams<NeuralLM>(file, act_mod, act_vocab));
+  BOOST_CHECK(exp_vocab->get_words() == act_vocab->get_words());
+  // Compare the scores
+  LLStats exp_stat(exp_vocab->size()), act_stat(act_vocab->size());
+  vector<dynet::Expression> layer_in;
+  {
+    dynet::ComputationGraph cg;
+    exp_lm->NewGraph(cg);
+    dynet::Expression loss_expr = exp_lm->BuildSentGraph(sent_trg_, cache_, nullptr, nullptr, layer_in, 0.f, false, cg, exp_stat);
+    exp_stat.loss_ += as_scalar(cg.incremental_forward(loss_expr));
+  }
+  {
+    dynet::ComputationGraph cg;
+    act_lm->NewGraph(cg);
+    dynet::Expression loss_expr = act_lm->BuildSentGraph(sent_trg_, cache_, nullptr, nullptr, layer_in, 0.f, false, cg, act_stat);
+    act_stat.loss_ += as_scalar(cg.incremental_forward(loss_expr));
+  }
+  BOOST_CHECK_CLOSE(exp_stat.CalcPPL(), act_stat.CalcPPL(), 0.001);
+  remove(file.c_str());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
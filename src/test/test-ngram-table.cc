@@ -0,0 +1,80 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/ngram-table.h>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestNgramTable {
+
+  // N-grams of every length up to three, including the empty one
+  TestNgramTable() : table_(3) {
+    ngrams_ = { {}, {2}, {3}, {2, 3}, {3, 2}, {4, 2, 3}, {0, 0, 0} };
+    for(size_t i = 0; i < ngrams_.size(); i++)
+      table_.Insert(ngrams_[i], i * 10);
+  }
+  ~TestNgramTable() { }
+
+  vector<Sentence> ngrams_;
+  NgramTable table_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(ngram_table, TestNgramTable)
+
+// Every n-gram is found with its value, and prefixes or suffixes of them aren't
+BOOST_AUTO_TEST_CASE(TestFind) {
+  BOOST_CHECK_EQUAL(table_.GetSize(), ngrams_.size());
+  for(size_t i = 0; i < ngrams_.size(); i++) {
+    const int * val = table_.Find(ngrams_[i]);
+    BOOST_REQUIRE(val != nullptr);
+    BOOST_CHECK_EQUAL(*val, (int)i * 10);
+    BOOST_CHECK(table_.GetNgram(i) == ngrams_[i]);
+  }
+  for(const Sentence & ngram : vector<Sentence>{ {4}, {4, 2}, {0, 0}, {2, 3, 4} })
+    BOOST_CHECK(table_.Find(ngram) == nullptr);
+  BOOST_CHECK(table_.Find(Sentence{1, 2, 3, 4}) == nullptr);
+  BOOST_CHECK_THROW(table_.Insert(Sentence{1, 2, 3, 4}, 0), std::runtime_error);
+}
+
+// N-grams are still found after the table has grown many times
+BOOST_AUTO_TEST_CASE(TestGrow) {
+  NgramTable table(2);
+  for(int i = 0; i < 1000; i++)
+    table.Insert(Sentence{i % 37, i}, i);
+  for(int i = 0; i < 1000; i++) {
+    const int * val = table.Find(Sentence{i % 37, i});
+    BOOST_REQUIRE(val != nullptr);
+    BOOST_CHECK_EQUAL(*val, i);
+  }
+  BOOST_CHECK(table.Find(Sentence{1, 0}) == nullptr);
+}
+
+// A written table can be used in place, and copies of it share the data
+BOOST_AUTO_TEST_CASE(TestWriteMap) {
+  string data;
+  table_.Write(data);
+  BOOST_CHECK_EQUAL(data.size(), table_.GetByteSize());
+  vector<int32_t> aligned(data.size() / sizeof(int32_t) + 1);
+  memcpy(aligned.data(), data.data(), data.size());
+  NgramTable mapped;
+  mapped.Map((const char*)aligned.data(), data.size());
+  NgramTable copied(mapped);
+  BOOST_CHECK_EQUAL(copied.GetMaxLen(), (size_t)3);
+  BOOST_CHECK_EQUAL(copied.GetSize(), ngrams_.size());
+  for(size_t i = 0; i < ngrams_.size(); i++) {
+    const int * val = copied.Find(ngrams_[i]);
+    BOOST_REQUIRE(val != nullptr);
+    BOOST_CHECK_EQUAL(*val, (int)i * 10);
+  }
+  BOOST_CHECK_THROW(copied.Insert(Sentence{5}, 0), std::runtime_error);
+  BOOST_CHECK_THROW(mapped.Map(data.data(), data.size() - 1), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
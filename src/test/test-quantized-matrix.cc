@@ -0,0 +1,92 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/quantized-matrix.h>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestQuantizedMatrix {
+
+  // A 3x4 matrix in column-major order, and a batch of two vectors
+  TestQuantizedMatrix() {
+    mat_ = {1.f, -0.5f, 0.f, 2.f, 0.25f, 0.f, -1.f, 0.125f, 0.f, 0.5f, 1.f, 0.f};
+    x_ = {1.f, 2.f, 3.f, 4.f, -1.f, 0.f, 0.5f, 2.f};
+    // The products of each row with each vector
+    exp_y_ = {4.f, 4.375f, 0.f, -0.5f, 2.5625f, 0.f};
+  }
+  ~TestQuantizedMatrix() { }
+
+  vector<float> mat_, x_, exp_y_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(quantized_matrix, TestQuantizedMatrix)
+
+BOOST_AUTO_TEST_CASE(TestMultiply) {
+  for(auto type : {QuantizedMatrix::kInt8, QuantizedMatrix::kFloat16}) {
+    QuantizedMatrix quant(type, 3, 4);
+    quant.SetColumnMajor(mat_.data());
+    vector<float> act_y(6);
+    quant.Multiply(x_.data(), 2, nullptr, act_y.data());
+    for(size_t i = 0; i < exp_y_.size(); i++)
+      BOOST_CHECK_SMALL(exp_y_[i] - act_y[i], 0.05f);
+  }
+}
+
+// Only the selected rows are multiplied, in the order they were given
+BOOST_AUTO_TEST_CASE(TestMultiplyRows) {
+  QuantizedMatrix quant(QuantizedMatrix::kFloat16, 3, 4);
+  quant.SetColumnMajor(mat_.data());
+  vector<unsigned> ids = {2, 0};
+  vector<float> exp_y = {exp_y_[2], exp_y_[0], exp_y_[5], exp_y_[3]}, act_y(4);
+  quant.Multiply(x_.data(), 2, &ids, act_y.data());
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_y.begin(), exp_y.end(), act_y.begin(), act_y.end());
+}
+
+BOOST_AUTO_TEST_CASE(TestWriteRead) {
+  for(auto type : {QuantizedMatrix::kInt8, QuantizedMatrix::kFloat16}) {
+    QuantizedMatrix exp_quant(type, 3, 4), act_quant(type, 3, 4);
+    exp_quant.SetColumnMajor(mat_.data());
+    string data;
+    exp_quant.Write(data);
+    BOOST_CHECK_EQUAL(data.size(), QuantizedMatrix::GetByteSize(type, 3, 4));
+    act_quant.Read(data.data(), data.size());
+    vector<float> exp_mat(mat_.size()), act_mat(mat_.size());
+    exp_quant.GetColumnMajor(exp_mat.data());
+    act_quant.GetColumnMajor(act_mat.data());
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_mat.begin(), exp_mat.end(), act_mat.begin(), act_mat.end());
+    // Each value is within half a step, which is at most 2/254 here
+    for(size_t i = 0; i < mat_.size(); i++)
+      BOOST_CHECK_SMALL(mat_[i] - act_mat[i], 0.01f);
+  }
+}
+
+// A written matrix can be used in place, but not changed
+BOOST_AUTO_TEST_CASE(TestMapped) {
+  for(auto type : {QuantizedMatrix::kInt8, QuantizedMatrix::kFloat16}) {
+    QuantizedMatrix exp_quant(type, 3, 4);
+    exp_quant.SetColumnMajor(mat_.data());
+    string data;
+    exp_quant.Write(data);
+    vector<float> aligned(data.size() / sizeof(float) + 1);
+    memcpy(aligned.data(), data.data(), data.size());
+    QuantizedMatrix act_quant(type, 3, 4, (const char*)aligned.data(), data.size());
+    vector<float> exp_y(6), act_y(6);
+    exp_quant.Multiply(x_.data(), 2, nullptr, exp_y.data());
+    act_quant.Multiply(x_.data(), 2, nullptr, act_y.data());
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_y.begin(), exp_y.end(), act_y.begin(), act_y.end());
+    string act_data;
+    act_quant.Write(act_data);
+    BOOST_CHECK(act_data == data);
+    BOOST_CHECK_THROW(act_quant.SetColumnMajor(mat_.data()), std::runtime_error);
+    BOOST_CHECK_THROW(QuantizedMatrix(type, 3, 4, data.data(), data.size() - 1), std::runtime_error);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
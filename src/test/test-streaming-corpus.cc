@@ -0,0 +1,58 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/sentence.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/streaming-corpus.h>
+#include <dynet/dict.h>
+#include <cstdio>
+#include <fstream>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The tests *******
+BOOST_AUTO_TEST_SUITE(streaming_corpus)
+
+BOOST_AUTO_TEST_CASE(TestStreamWindows) {
+  string file_src = "test-streaming-corpus.src", file_trg = "test-streaming-corpus.trg";
+  {
+    ofstream out_src(file_src), out_trg(file_trg);
+    out_src << "a" << endl << "a b" << endl << "b" << endl << "c a" << endl << "c" << endl;
+    out_trg << "x" << endl << "y" << endl << "x y" << endl << "z" << endl << "z x" << endl;
+  }
+  DictPtr vocab_src(CreateNewDict()), vocab_trg(CreateNewDict());
+  StreamingCorpus::ReadVocab(vector<string>(1, file_src), false, *vocab_src);
+  StreamingCorpus::ReadVocab(vector<string>(1, file_trg), true, *vocab_trg);
+  vocab_src->freeze(); vocab_src->set_unk("<unk>");
+  vocab_trg->freeze(); vocab_trg->set_unk("<unk>");
+  BOOST_CHECK_EQUAL(vocab_src->size(), 5);
+  BOOST_CHECK_EQUAL(vocab_trg->size(), 5);
+  {
+    StreamingCorpus stream(vector<string>(1, file_src), vector<string>(1, file_trg), vector<string>(), vector<string>(),
+                           *vocab_src, *vocab_trg, 2);
+    // Two passes over the corpus should give the same windows
+    for(int epoch = 0; epoch < 2; epoch++) {
+      StreamingWindow window;
+      vector<size_t> sizes;
+      while(stream.NextWindow(window)) {
+        BOOST_CHECK_EQUAL(window.src.size(), window.trg.size());
+        sizes.push_back(window.trg.size());
+        if(sizes.size() == 1) {
+          Sentence exp_src = {2, 2, 3}, exp_trg = {2, 0, 3, 0};
+          Sentence act_src = window.src[0]; act_src.insert(act_src.end(), window.src[1].begin(), window.src[1].end());
+          Sentence act_trg = window.trg[0]; act_trg.insert(act_trg.end(), window.trg[1].begin(), window.trg[1].end());
+          BOOST_CHECK_EQUAL_COLLECTIONS(exp_src.begin(), exp_src.end(), act_src.begin(), act_src.end());
+          BOOST_CHECK_EQUAL_COLLECTIONS(exp_trg.begin(), exp_trg.end(), act_trg.begin(), act_trg.end());
+        }
+      }
+      vector<size_t> exp_sizes = {2, 2, 1};
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_sizes.begin(), exp_sizes.end(), sizes.begin(), sizes.end());
+    }
+  }
+  remove(file_src.c_str());
+  remove(file_trg.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()